@@ -0,0 +1,589 @@
+#include "apu.h"
+#include "system.h"
+
+#include <string.h>
+
+static const uint8_t length_table[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const uint8_t duty_table[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },     // 12.5%
+    { 0, 1, 1, 0, 0, 0, 0, 0 },     // 25%
+    { 0, 1, 1, 1, 1, 0, 0, 0 },     // 50%
+    { 1, 0, 0, 1, 1, 1, 1, 1 }      // 25% negated
+};
+
+static const uint8_t triangle_table[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15
+};
+
+// NTSC timer periods in CPU cycles
+static const uint16_t noise_periods[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+static const uint16_t dmc_periods[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+// Frame counter steps, in CPU cycles from the start of the sequence. The last step of each also ends it.
+static const uint32_t frame_steps_4[4] = { 7457, 14913, 22371, 29829 };
+static const uint32_t frame_steps_5[5] = { 7457, 14913, 22371, 29829, 37281 };
+#define FRAME_PERIOD_4 29830
+#define FRAME_PERIOD_5 37282
+
+// Non-linear mixer (see the nesdev wiki's APU Mixer page); full scale is 1.0
+static float pulse_mix[31];
+static float tnd_mix[203];
+
+void apu_init(APU* apu){
+    memset(apu, 0, sizeof(*apu));
+
+    for(int i = 1; i < 31; i++){
+        pulse_mix[i] = 95.52 / (8128.0 / i + 100);
+    }
+    for(int i = 1; i < 203; i++){
+        tnd_mix[i] = 163.67 / (24329.0 / i + 100);
+    }
+
+    apu->pulse[0].ones_complement = true;
+    apu->noise.shift = 1;
+    apu->noise.period = noise_periods[0];
+    apu->dmc.period = dmc_periods[0];
+    apu->dmc.bits_remaining = 8;
+    apu->dmc.silence = true;
+
+    apu->frame_next = frame_steps_4[0];
+    apu->next_event = apu->frame_next;
+
+    audio_init(&apu->audio, APU_CPU_FREQUENCY);
+}
+
+/* ------------------------------------ Channel units ------------------------------------ */
+static void envelope_clock(Envelope* envelope){
+    if(envelope->start){
+        envelope->start = false;
+        envelope->decay = 15;
+        envelope->divider = envelope->period;
+    } else if(envelope->divider == 0){
+        envelope->divider = envelope->period;
+        if(envelope->decay > 0){
+            envelope->decay--;
+        } else if(envelope->loop){
+            envelope->decay = 15;
+        }
+    } else{
+        envelope->divider--;
+    }
+}
+
+static inline uint8_t envelope_volume(const Envelope* envelope){
+    return envelope->constant ? envelope->period : envelope->decay;
+}
+
+static int pulse_sweep_target(const Pulse* pulse){
+    int change = pulse->period >> pulse->sweep_shift;
+    if(pulse->sweep_negate){
+        return pulse->period - change - (pulse->ones_complement ? 1 : 0);
+    }
+    return pulse->period + change;
+}
+
+// The sweep unit silences the channel whenever the period is (or would become) out of range, even if disabled
+static inline bool pulse_muted(const Pulse* pulse){
+    return pulse->period < 8 || pulse_sweep_target(pulse) > 0x7FF;
+}
+
+static void pulse_sweep_clock(Pulse* pulse){
+    if(pulse->sweep_divider == 0 && pulse->sweep_enabled && pulse->sweep_shift > 0 && !pulse_muted(pulse)){
+        int target = pulse_sweep_target(pulse);
+        pulse->period = (target < 0) ? 0 : target;
+    }
+
+    if(pulse->sweep_divider == 0 || pulse->sweep_reload){
+        pulse->sweep_divider = pulse->sweep_period;
+        pulse->sweep_reload = false;
+    } else{
+        pulse->sweep_divider--;
+    }
+}
+
+// Number of times a timer firing every `period` cycles from next_clock fires before `cycle`, moving next_clock on
+static inline uint64_t timer_run(uint64_t* next_clock, uint32_t period, uint64_t cycle){
+    if(*next_clock >= cycle){
+        return 0;
+    }
+    uint64_t clocks = (cycle - *next_clock + period - 1) / period;
+    *next_clock += clocks * period;
+    return clocks;
+}
+
+// Whether clocking a channel's timer can change what it outputs. Only these need stepping clock by clock.
+static inline bool pulse_audible(const Pulse* pulse){
+    return pulse->length > 0 && !pulse_muted(pulse) && envelope_volume(&pulse->envelope) > 0;
+}
+
+// The triangle is stopped by either counter. Ultrasonic periods (< 2) are held too, as they'd only be aliasing.
+static inline bool triangle_playing(const Triangle* triangle){
+    return triangle->length > 0 && triangle->linear > 0 && triangle->period >= 2;
+}
+
+static inline bool noise_audible(const Noise* noise){
+    return noise->length > 0 && envelope_volume(&noise->envelope) > 0;
+}
+
+static inline uint32_t pulse_timer_period(const Pulse* pulse){
+    return 2 * (pulse->period + 1);
+}
+
+static void pulse_run(Pulse* pulse, uint64_t cycle){
+    uint64_t clocks = timer_run(&pulse->next_clock, pulse_timer_period(pulse), cycle);
+
+    // The sequencer counts down through the duty cycle
+    pulse->sequence = (pulse->sequence - clocks) & 7;
+}
+
+static void triangle_run(Triangle* triangle, uint64_t cycle){
+    uint64_t clocks = timer_run(&triangle->next_clock, triangle->period + 1, cycle);
+
+    if(triangle_playing(triangle)){
+        triangle->step = (triangle->step + clocks) & 31;
+    }
+}
+
+static inline void noise_clock(Noise* noise){
+    int tap = noise->mode ? 6 : 1;
+    uint16_t feedback = (noise->shift ^ (noise->shift >> tap)) & 1;
+    noise->shift = (noise->shift >> 1) | (feedback << 14);
+}
+
+static void noise_run(Noise* noise, uint64_t cycle){
+    uint64_t clocks = timer_run(&noise->next_clock, noise->period, cycle);
+
+    while(clocks--){
+        noise_clock(noise);
+    }
+}
+
+static void dmc_fetch(DMC* dmc){
+    if(dmc->buffer_full || dmc->bytes_remaining == 0){
+        return;
+    }
+
+    dmc->buffer = read(dmc->current_addr);
+    dmc->buffer_full = true;
+    dmc->current_addr = (dmc->current_addr == 0xFFFF) ? 0x8000 : dmc->current_addr + 1;
+
+    if(--dmc->bytes_remaining == 0){
+        if(dmc->loop){
+            dmc->current_addr = dmc->sample_addr;
+            dmc->bytes_remaining = dmc->sample_length;
+        } else if(dmc->irq_enabled){
+            dmc->irq = true;
+        }
+    }
+}
+
+static inline bool dmc_active(const DMC* dmc){
+    return dmc->bytes_remaining > 0 || dmc->buffer_full;
+}
+
+// Playing, or still has sample data to get through
+static inline bool dmc_busy(const DMC* dmc){
+    return !dmc->silence || dmc_active(dmc);
+}
+
+static void dmc_clock(DMC* dmc){
+    if(!dmc->silence){
+        if(dmc->shift & 1){
+            if(dmc->level <= 125){
+                dmc->level += 2;
+            }
+        } else if(dmc->level >= 2){
+            dmc->level -= 2;
+        }
+    }
+    dmc->shift >>= 1;
+
+    if(--dmc->bits_remaining == 0){
+        dmc->bits_remaining = 8;
+        dmc->silence = !dmc->buffer_full;
+        if(dmc->buffer_full){
+            dmc->shift = dmc->buffer;
+            dmc->buffer_full = false;
+            dmc_fetch(dmc);
+        }
+    }
+}
+
+static void dmc_run(DMC* dmc, uint64_t cycle){
+    uint64_t clocks = timer_run(&dmc->next_clock, dmc->period, cycle);
+
+    // Idle: the output unit just counts off empty bytes, so skip straight to where the count ends up
+    if(!dmc_busy(dmc)){
+        dmc->bits_remaining = (uint8_t)(((dmc->bits_remaining - 1 - clocks % 8) + 8) % 8 + 1);
+        return;
+    }
+
+    while(clocks--){
+        dmc_clock(dmc);
+    }
+}
+
+/* ------------------------------------ Frame counter ------------------------------------ */
+static void apu_quarter_frame(APU* apu){
+    envelope_clock(&apu->pulse[0].envelope);
+    envelope_clock(&apu->pulse[1].envelope);
+    envelope_clock(&apu->noise.envelope);
+
+    Triangle* triangle = &apu->triangle;
+    if(triangle->linear_reload){
+        triangle->linear = triangle->linear_reload_value;
+    } else if(triangle->linear > 0){
+        triangle->linear--;
+    }
+    if(!triangle->control){
+        triangle->linear_reload = false;
+    }
+}
+
+static void apu_half_frame(APU* apu){
+    for(int i = 0; i < 2; i++){
+        Pulse* pulse = &apu->pulse[i];
+        if(pulse->length > 0 && !pulse->envelope.loop){
+            pulse->length--;
+        }
+        pulse_sweep_clock(pulse);
+    }
+    if(apu->triangle.length > 0 && !apu->triangle.control){
+        apu->triangle.length--;
+    }
+    if(apu->noise.length > 0 && !apu->noise.envelope.loop){
+        apu->noise.length--;
+    }
+}
+
+static void apu_frame_step(APU* apu){
+    int last = apu->five_step ? 4 : 3;
+
+    if(apu->frame_step == last){
+        apu_quarter_frame(apu);
+        apu_half_frame(apu);
+        if(!apu->five_step && !apu->irq_inhibit){
+            apu->frame_irq = true;
+        }
+
+        apu->frame_origin += apu->five_step ? FRAME_PERIOD_5 : FRAME_PERIOD_4;
+        apu->frame_step = 0;
+    } else{
+        // Steps 0 and 2 are quarter frames, 1 is a half frame too. (Step 3 of 5 does nothing.)
+        if(apu->frame_step != 3){
+            apu_quarter_frame(apu);
+        }
+        if(apu->frame_step == 1){
+            apu_half_frame(apu);
+        }
+        apu->frame_step++;
+    }
+
+    const uint32_t* steps = apu->five_step ? frame_steps_5 : frame_steps_4;
+    apu->frame_next = apu->frame_origin + steps[apu->frame_step];
+}
+
+/* ------------------------------------ Mixer ------------------------------------ */
+static float apu_mix(APU* apu){
+    int pulse_out = 0;
+    for(int i = 0; i < 2; i++){
+        const Pulse* pulse = &apu->pulse[i];
+        if(pulse->length > 0 && !pulse_muted(pulse) && duty_table[pulse->duty][pulse->sequence]){
+            pulse_out += envelope_volume(&pulse->envelope);
+        }
+    }
+
+    // The triangle holds its last output when stopped
+    int triangle_out = triangle_table[apu->triangle.step];
+    int noise_out = (apu->noise.length > 0 && !(apu->noise.shift & 1)) ? envelope_volume(&apu->noise.envelope) : 0;
+
+    return pulse_mix[pulse_out] + tnd_mix[3 * triangle_out + 2 * noise_out + apu->dmc.level];
+}
+
+// Pass any change in the mixed output on to audio, as happening at the given cycle
+static void apu_update_output(APU* apu, uint64_t cycle){
+    float output = apu_mix(apu);
+    if(output != apu->output){
+        audio_delta(&apu->audio, cycle, output - apu->output);
+        apu->output = output;
+    }
+}
+
+// Step the audible channels one timer clock at a time up to (not including) the given cycle, so each change in
+// output is timed exactly
+static void apu_run_audible(APU* apu, uint64_t cycle){
+    Pulse* pulse = apu->pulse;
+    Triangle* triangle = &apu->triangle;
+    Noise* noise = &apu->noise;
+    DMC* dmc = &apu->dmc;
+
+    // Audibility only changes on frame counter steps and register writes, which never happen in here
+    bool pulse_0 = pulse_audible(&pulse[0]);
+    bool pulse_1 = pulse_audible(&pulse[1]);
+    bool triangle_on = triangle_playing(triangle);
+    bool noise_on = noise_audible(noise);
+
+    for(;;){
+        uint64_t next = cycle;
+        if(pulse_0 && pulse[0].next_clock < next){
+            next = pulse[0].next_clock;
+        }
+        if(pulse_1 && pulse[1].next_clock < next){
+            next = pulse[1].next_clock;
+        }
+        if(triangle_on && triangle->next_clock < next){
+            next = triangle->next_clock;
+        }
+        if(noise_on && noise->next_clock < next){
+            next = noise->next_clock;
+        }
+        if(dmc_busy(dmc) && dmc->next_clock < next){
+            next = dmc->next_clock;
+        }
+        if(next >= cycle){
+            return;
+        }
+
+        for(int i = 0; i < 2; i++){
+            if(pulse[i].next_clock == next && (i ? pulse_1 : pulse_0)){
+                pulse[i].sequence = (pulse[i].sequence - 1) & 7;
+                pulse[i].next_clock += pulse_timer_period(&pulse[i]);
+            }
+        }
+        if(triangle_on && triangle->next_clock == next){
+            triangle->step = (triangle->step + 1) & 31;
+            triangle->next_clock += triangle->period + 1;
+        }
+        if(noise_on && noise->next_clock == next){
+            noise_clock(noise);
+            noise->next_clock += noise->period;
+        }
+        if(dmc_busy(dmc) && dmc->next_clock == next){
+            dmc_clock(dmc);
+            dmc->next_clock += dmc->period;
+        }
+
+        apu_update_output(apu, next);
+    }
+}
+
+/* ------------------------------------ Scheduling ------------------------------------ */
+// Work out the next cycle at which the APU affects something outside itself without being asked
+static void apu_schedule(APU* apu){
+    apu->next_event = UINT64_MAX;
+
+    // The frame IRQ is raised on the last step of the 4-step sequence
+    if(!apu->five_step && !apu->irq_inhibit && !apu->frame_irq){
+        apu->next_event = apu->frame_next;
+    }
+
+    // A playing DMC reads memory (which may be bank switched under it) and can raise its IRQ on any of its clocks
+    if(dmc_active(&apu->dmc) && apu->dmc.next_clock < apu->next_event){
+        apu->next_event = apu->dmc.next_clock + 1;
+    }
+}
+
+void apu_run(APU* apu, uint64_t cycle){
+    while(apu->cycle < cycle){
+        // Channel timers run freely between frame counter steps
+        uint64_t end = (apu->frame_next < cycle) ? apu->frame_next : cycle;
+
+        apu_run_audible(apu, end);
+
+        // Whatever can't be heard catches up in one go (the audible channels are already there)
+        pulse_run(&apu->pulse[0], end);
+        pulse_run(&apu->pulse[1], end);
+        triangle_run(&apu->triangle, end);
+        noise_run(&apu->noise, end);
+        dmc_run(&apu->dmc, end);
+        apu->cycle = end;
+
+        if(end == apu->frame_next){
+            apu_frame_step(apu);
+            apu_update_output(apu, end);
+        }
+    }
+
+    apu_schedule(apu);
+}
+
+void apu_end_frame(APU* apu, uint64_t cycle){
+    apu_run(apu, cycle);
+    audio_end_frame(&apu->audio, cycle);
+}
+
+bool apu_irq(APU* apu){
+    return apu->frame_irq || apu->dmc.irq;
+}
+
+/* ------------------------------------ Registers ------------------------------------ */
+uint8_t apu_read_status(){
+    APU* apu = nes.apu;
+    apu_run(apu, nes.cycles);
+
+    uint8_t status = (apu->pulse[0].length > 0)
+        | (apu->pulse[1].length > 0) << 1
+        | (apu->triangle.length > 0) << 2
+        | (apu->noise.length > 0) << 3
+        | (apu->dmc.bytes_remaining > 0) << 4
+        | apu->frame_irq << 6
+        | apu->dmc.irq << 7;
+
+    // Reading acknowledges the frame IRQ (but not the DMC's)
+    apu->frame_irq = false;
+    apu_schedule(apu);
+    return status;
+}
+
+static void apu_write_envelope(Envelope* envelope, uint8_t data){
+    envelope->loop = data & 0x20;
+    envelope->constant = data & 0x10;
+    envelope->period = data & 0x0F;
+}
+
+static void apu_write_pulse(Pulse* pulse, int reg, uint8_t data){
+    switch(reg){
+        case 0:
+            pulse->duty = data >> 6;
+            apu_write_envelope(&pulse->envelope, data);
+            break;
+        case 1:
+            pulse->sweep_enabled = data & 0x80;
+            pulse->sweep_period = (data >> 4) & 0x07;
+            pulse->sweep_negate = data & 0x08;
+            pulse->sweep_shift = data & 0x07;
+            pulse->sweep_reload = true;
+            break;
+        case 2:
+            pulse->period = (pulse->period & 0x700) | data;
+            break;
+        case 3:
+            pulse->period = (pulse->period & 0xFF) | (data & 0x07) << 8;
+            if(pulse->enabled){
+                pulse->length = length_table[data >> 3];
+            }
+            pulse->sequence = 0;
+            pulse->envelope.start = true;
+            break;
+    }
+}
+
+void apu_write_register(uint16_t addr, uint8_t data){
+    APU* apu = nes.apu;
+    apu_run(apu, nes.cycles);
+
+    switch(addr){
+        case 0x4000: case 0x4001: case 0x4002: case 0x4003:
+            apu_write_pulse(&apu->pulse[0], addr & 3, data);
+            break;
+        case 0x4004: case 0x4005: case 0x4006: case 0x4007:
+            apu_write_pulse(&apu->pulse[1], addr & 3, data);
+            break;
+
+        case 0x4008:
+            apu->triangle.control = data & 0x80;
+            apu->triangle.linear_reload_value = data & 0x7F;
+            break;
+        case 0x400A:
+            apu->triangle.period = (apu->triangle.period & 0x700) | data;
+            break;
+        case 0x400B:
+            apu->triangle.period = (apu->triangle.period & 0xFF) | (data & 0x07) << 8;
+            if(apu->triangle.enabled){
+                apu->triangle.length = length_table[data >> 3];
+            }
+            apu->triangle.linear_reload = true;
+            break;
+
+        case 0x400C:
+            apu_write_envelope(&apu->noise.envelope, data);
+            break;
+        case 0x400E:
+            apu->noise.mode = data & 0x80;
+            apu->noise.period = noise_periods[data & 0x0F];
+            break;
+        case 0x400F:
+            if(apu->noise.enabled){
+                apu->noise.length = length_table[data >> 3];
+            }
+            apu->noise.envelope.start = true;
+            break;
+
+        case 0x4010:
+            apu->dmc.irq_enabled = data & 0x80;
+            apu->dmc.loop = data & 0x40;
+            apu->dmc.period = dmc_periods[data & 0x0F];
+            if(!apu->dmc.irq_enabled){
+                apu->dmc.irq = false;
+            }
+            break;
+        case 0x4011:
+            apu->dmc.level = data & 0x7F;
+            break;
+        case 0x4012:
+            apu->dmc.sample_addr = 0xC000 + data * 64;
+            break;
+        case 0x4013:
+            apu->dmc.sample_length = data * 16 + 1;
+            break;
+
+        case 0x4015:
+            apu->pulse[0].enabled = data & 0x01;
+            apu->pulse[1].enabled = data & 0x02;
+            apu->triangle.enabled = data & 0x04;
+            apu->noise.enabled = data & 0x08;
+            if(!apu->pulse[0].enabled){
+                apu->pulse[0].length = 0;
+            }
+            if(!apu->pulse[1].enabled){
+                apu->pulse[1].length = 0;
+            }
+            if(!apu->triangle.enabled){
+                apu->triangle.length = 0;
+            }
+            if(!apu->noise.enabled){
+                apu->noise.length = 0;
+            }
+
+            // DMC: stop, or (re)start the sample if it had finished
+            if(!(data & 0x10)){
+                apu->dmc.bytes_remaining = 0;
+            } else if(apu->dmc.bytes_remaining == 0){
+                apu->dmc.current_addr = apu->dmc.sample_addr;
+                apu->dmc.bytes_remaining = apu->dmc.sample_length;
+                dmc_fetch(&apu->dmc);
+            }
+            apu->dmc.irq = false;
+            break;
+
+        case 0x4017:
+            apu->five_step = data & 0x80;
+            apu->irq_inhibit = data & 0x40;
+            if(apu->irq_inhibit){
+                apu->frame_irq = false;
+            }
+
+            // The sequence restarts 3 or 4 cycles later, depending on where in the APU's 2-cycle clock the write
+            // landed. Entering 5-step mode also clocks everything straight away.
+            apu->frame_origin = apu->cycle + 3 + (apu->cycle & 1);
+            apu->frame_step = 0;
+            apu->frame_next = apu->frame_origin + frame_steps_4[0];
+            if(apu->five_step){
+                apu_quarter_frame(apu);
+                apu_half_frame(apu);
+            }
+            break;
+    }
+
+    apu_update_output(apu, apu->cycle);
+    apu_schedule(apu);
+}
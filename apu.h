@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "audio.h"
+
+/*  APU (2A03 audio): two pulse channels, triangle, noise and DMC, sequenced by the frame counter.
+
+    Nothing here is ticked per CPU cycle. Each channel remembers the CPU cycle its timer next fires on, and
+    apu_run() brings every channel forward to a given cycle in one go. Channels that can be heard step from
+    one timer clock to the next, and every change in the mixed output goes to the Audio pipeline as a delta at
+    the cycle it happened on. Silent ones skip ahead: a pulse or triangle timer firing n times is a single add
+    to its sequencer position. The APU is caught up before any register access, at the end of each frame, and
+    otherwise only when next_event says something visible to the CPU (an IRQ, a DMC sample fetch) is due.
+
+    Register map ($4000-$4017):
+        $4000-$4003     Pulse 1: duty/envelope, sweep, timer low, length/timer high
+        $4004-$4007     Pulse 2
+        $4008-$400B     Triangle: linear counter, (unused), timer low, length/timer high
+        $400C-$400F     Noise: envelope, (unused), mode/period, length
+        $4010-$4013     DMC: flags/rate, direct load, sample address, sample length
+        $4015           Channel enables (write), channel/IRQ status (read)
+        $4017           Frame counter mode and IRQ inhibit (write only; reads are controller 2)
+*/
+
+#define APU_CPU_FREQUENCY   1789773     // NTSC CPU clock (Hz), which the APU runs from
+
+typedef struct Envelope{
+    bool start;
+    bool loop;          // also halts the length counter
+    bool constant;
+    uint8_t period;     // or the constant volume
+    uint8_t divider;
+    uint8_t decay;
+} Envelope;
+
+typedef struct Pulse{
+    bool enabled;
+    bool ones_complement;   // pulse 1's sweep subtracts one more than pulse 2's
+    uint8_t duty;
+    uint8_t sequence;       // position in the 8 step duty cycle
+    uint16_t period;        // timer reload; the sequencer steps every 2 * (period + 1) CPU cycles
+    uint64_t next_clock;    // CPU cycle the timer next fires on
+    uint8_t length;
+    Envelope envelope;
+
+    bool sweep_enabled;
+    bool sweep_negate;
+    bool sweep_reload;
+    uint8_t sweep_period;
+    uint8_t sweep_shift;
+    uint8_t sweep_divider;
+} Pulse;
+
+typedef struct Triangle{
+    bool enabled;
+    bool control;           // halts the length counter and keeps reloading the linear counter
+    bool linear_reload;
+    uint8_t linear_reload_value;
+    uint8_t linear;
+    uint8_t step;           // position in the 32 step triangle
+    uint16_t period;
+    uint64_t next_clock;
+    uint8_t length;
+} Triangle;
+
+typedef struct Noise{
+    bool enabled;
+    bool mode;              // short (93 step) sequence
+    uint16_t shift;         // 15-bit LFSR
+    uint16_t period;        // in CPU cycles
+    uint64_t next_clock;
+    uint8_t length;
+    Envelope envelope;
+} Noise;
+
+typedef struct DMC{
+    bool irq_enabled;
+    bool loop;
+    bool irq;
+    uint16_t period;        // in CPU cycles
+    uint64_t next_clock;
+    uint8_t level;          // 7-bit output
+
+    uint16_t sample_addr;
+    uint16_t sample_length;
+    uint16_t current_addr;
+    uint16_t bytes_remaining;
+
+    uint8_t buffer;
+    bool buffer_full;
+    uint8_t shift;
+    uint8_t bits_remaining;
+    bool silence;
+} DMC;
+
+typedef struct APU{
+    Pulse pulse[2];
+    Triangle triangle;
+    Noise noise;
+    DMC dmc;
+
+    // Frame counter
+    bool five_step;
+    bool irq_inhibit;
+    bool frame_irq;
+    int frame_step;
+    uint64_t frame_origin;  // CPU cycle the current frame counter sequence started on
+    uint64_t frame_next;    // CPU cycle of the next quarter/half frame step
+
+    uint64_t cycle;         // CPU cycle every channel has been run up to
+    uint64_t next_event;    // the APU must be caught up by this cycle even if nothing touches it
+
+    // Mixer level (0 - 1) last passed on to audio
+    float output;
+    Audio audio;
+} APU;
+
+void apu_init(APU* apu);
+
+// Run every channel and the frame counter up to (but not including) the given CPU cycle
+void apu_run(APU* apu, uint64_t cycle);
+
+// Run up to the given cycle and turn everything so far into samples in apu->audio.output
+void apu_end_frame(APU* apu, uint64_t cycle);
+
+// State of the APU's IRQ line (frame counter or DMC)
+bool apu_irq(APU* apu);
+
+// CPU access to $4000-$4017. These catch the APU up to the current CPU cycle first.
+uint8_t apu_read_status();
+void apu_write_register(uint16_t addr, uint8_t data);
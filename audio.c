@@ -0,0 +1,170 @@
+#include "audio.h"
+
+#include <math.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// Impulse for each sub-sample phase, and the decimation filter. Built once and shared by every Audio.
+static _Alignas(16) float step_kernels[AUDIO_STEP_PHASES][AUDIO_STEP_WIDTH];
+static _Alignas(16) float fir_kernel[AUDIO_FIR_TAPS];
+static bool kernels_ready = false;
+
+static double sinc(double x){
+    return (x == 0) ? 1 : sin(M_PI * x) / (M_PI * x);
+}
+
+// Blackman window over -half..half
+static double blackman(double x, double half){
+    return 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2 * M_PI * x / half);
+}
+
+static void audio_build_kernels(){
+    // Steps are cut off at 48kHz, well inside the synthesis rate's 96kHz Nyquist; the FIR does the rest
+    const double step_cutoff = 2.0 * 48000 / (AUDIO_SAMPLE_RATE * AUDIO_OVERSAMPLE);
+    for(int phase = 0; phase < AUDIO_STEP_PHASES; phase++){
+        double sum = 0;
+        for(int i = 0; i < AUDIO_STEP_WIDTH; i++){
+            double x = i - AUDIO_STEP_WIDTH / 2 - (double)phase / AUDIO_STEP_PHASES;
+            step_kernels[phase][i] = sinc(step_cutoff * x) * blackman(x, AUDIO_STEP_WIDTH / 2);
+            sum += step_kernels[phase][i];
+        }
+        // Each impulse must add exactly its delta, or the output would drift
+        for(int i = 0; i < AUDIO_STEP_WIDTH; i++){
+            step_kernels[phase][i] /= sum;
+        }
+    }
+
+    // Pass up to ~12kHz, stop from ~20kHz (16kHz cutoff at the synthesis rate)
+    const double fir_cutoff = 2.0 * 16000 / (AUDIO_SAMPLE_RATE * AUDIO_OVERSAMPLE);
+    double sum = 0;
+    for(int i = 0; i < AUDIO_FIR_TAPS; i++){
+        double x = i - (AUDIO_FIR_TAPS - 1) / 2.0;
+        fir_kernel[i] = fir_cutoff * sinc(fir_cutoff * x) * blackman(x, AUDIO_FIR_TAPS / 2.0);
+        sum += fir_kernel[i];
+    }
+    for(int i = 0; i < AUDIO_FIR_TAPS; i++){
+        fir_kernel[i] /= sum;
+    }
+
+    kernels_ready = true;
+}
+
+void audio_init(Audio* audio, double cpu_frequency){
+    if(!kernels_ready){
+        audio_build_kernels();
+    }
+
+    memset(audio, 0, sizeof(*audio));
+    audio->base_rate = AUDIO_SAMPLE_RATE * AUDIO_OVERSAMPLE / cpu_frequency;
+    audio->rate = audio->base_rate;
+}
+
+void audio_set_ratio(Audio* audio, double ratio){
+    audio->rate = audio->base_rate * ratio;
+}
+
+void audio_delta(Audio* audio, uint64_t cycle, float delta){
+    double position = audio->offset + (cycle - audio->base_cycle) * audio->rate;
+    int index = (int)position;
+    if(index >= AUDIO_SYNTH_SIZE){
+        // Way more than a frame without audio_end_frame(); drop it rather than write past the buffer
+        return;
+    }
+
+    const float* kernel = step_kernels[(int)((position - index) * AUDIO_STEP_PHASES)];
+    float* out = &audio->synth[index];
+
+#ifdef __SSE__
+    __m128 scale = _mm_set1_ps(delta);
+    for(int i = 0; i < AUDIO_STEP_WIDTH; i += 4){
+        _mm_storeu_ps(&out[i], _mm_add_ps(_mm_loadu_ps(&out[i]), _mm_mul_ps(scale, _mm_load_ps(&kernel[i]))));
+    }
+#else
+    for(int i = 0; i < AUDIO_STEP_WIDTH; i++){
+        out[i] += delta * kernel[i];
+    }
+#endif
+}
+
+// One output sample: the FIR over AUDIO_FIR_TAPS synthesis samples (the kernel is symmetric, so no reversal)
+static inline float audio_fir(const float* in){
+#ifdef __SSE__
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for(int i = 0; i < AUDIO_FIR_TAPS; i += 8){
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_load_ps(&fir_kernel[i]), _mm_loadu_ps(&in[i])));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_load_ps(&fir_kernel[i + 4]), _mm_loadu_ps(&in[i + 4])));
+    }
+    __m128 sum = _mm_add_ps(sum0, sum1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#else
+    float sum = 0;
+    for(int i = 0; i < AUDIO_FIR_TAPS; i++){
+        sum += fir_kernel[i] * in[i];
+    }
+    return sum;
+#endif
+}
+
+void audio_end_frame(Audio* audio, uint64_t cycle){
+    double end = audio->offset + (cycle - audio->base_cycle) * audio->rate;
+
+    // Whole output samples only; the rest waits for the next frame
+    int count = (int)end & ~(AUDIO_OVERSAMPLE - 1);
+    if(count > AUDIO_SYNTH_SIZE){
+        count = AUDIO_SYNTH_SIZE;
+    }
+    int outputs = count / AUDIO_OVERSAMPLE;
+    if(outputs > AUDIO_OUTPUT_SIZE - audio->output_count){
+        outputs = AUDIO_OUTPUT_SIZE - audio->output_count;
+    }
+
+    // Integrate the impulses into the waveform
+    float* in = &audio->fir[AUDIO_FIR_TAPS];
+    float level = audio->level;
+    for(int i = 0; i < count; i++){
+        level += audio->synth[i];
+        in[i] = level;
+    }
+    audio->level = level;
+
+    // First-order filters, as on the NES's output (see the nesdev wiki's APU Mixer page)
+    const float dt = 1.0f / AUDIO_SAMPLE_RATE;
+    const float high_90 = 1 / (2 * M_PI * 90) / (1 / (2 * M_PI * 90) + dt);
+    const float high_440 = 1 / (2 * M_PI * 440) / (1 / (2 * M_PI * 440) + dt);
+    const float low_14k = dt / (1 / (2 * M_PI * 14000) + dt);
+
+    int16_t* out = &audio->output[audio->output_count];
+    for(int i = 0; i < outputs; i++){
+        // Output i lines up with the last synthesis sample of its group
+        float sample = audio_fir(&audio->fir[(i + 1) * AUDIO_OVERSAMPLE]);
+
+        audio->high_90_out = high_90 * (audio->high_90_out + sample - audio->high_90_in);
+        audio->high_90_in = sample;
+        sample = audio->high_90_out;
+
+        audio->high_440_out = high_440 * (audio->high_440_out + sample - audio->high_440_in);
+        audio->high_440_in = sample;
+        sample = audio->high_440_out;
+
+        audio->low_14k_out += low_14k * (sample - audio->low_14k_out);
+        sample = audio->low_14k_out * 32767;
+
+        out[i] = (sample > 32767) ? 32767 : (sample < -32768) ? -32768 : (int16_t)sample;
+    }
+    audio->output_count += outputs;
+
+    // Keep the FIR's history, and the steps that overhang into the next block
+    memmove(audio->fir, &audio->fir[count], AUDIO_FIR_TAPS * sizeof(float));
+    memmove(audio->synth, &audio->synth[count], AUDIO_SYNTH_KEEP * sizeof(float));
+    memset(&audio->synth[AUDIO_SYNTH_KEEP], 0, count * sizeof(float));
+
+    audio->offset = end - count;
+    audio->base_cycle = cycle;
+}
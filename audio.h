@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+/*  Audio output pipeline: APU level changes in, 48kHz 16-bit samples out, a frame at a time.
+
+    1. Band-limited step synthesis. The APU reports each change in its mixed output as a delta at the exact CPU
+       cycle it happened (audio_delta()). Each delta adds a short windowed-sinc impulse, offset to the delta's
+       sub-sample position, into a buffer running at AUDIO_OVERSAMPLE times the output rate. The running sum of
+       that buffer is the output waveform, band-limited, with every edge in the right place instead of snapped
+       to the nearest sample.
+    2. Decimation. At the end of each frame the block is integrated and brought down to AUDIO_SAMPLE_RATE by a
+       AUDIO_FIR_TAPS tap low-pass FIR, computing only the samples that are kept (SSE where available).
+    3. The NES's own output filters: high-pass at 90Hz and 440Hz, low-pass at 14kHz.
+
+    The same output serves live playback and WAV capture, so both hear exactly the same thing. The only
+    difference is that live playback resamples by a fraction of a percent to stay in step with the device.
+*/
+
+#define AUDIO_SAMPLE_RATE   48000
+#define AUDIO_OVERSAMPLE    4       // synthesis runs at 192kHz
+#define AUDIO_STEP_WIDTH    8       // taps per band-limited step, at the synthesis rate
+#define AUDIO_STEP_PHASES   32      // sub-sample positions a step can be placed at
+#define AUDIO_FIR_TAPS      128     // decimation filter length, at the synthesis rate
+#define AUDIO_SYNTH_SIZE    16384   // synthesis samples buffered; a frame is ~3200
+#define AUDIO_OUTPUT_SIZE   (AUDIO_SYNTH_SIZE / AUDIO_OVERSAMPLE)
+
+// Samples held over between frames: steps overhanging the end of a block, plus an incomplete output sample
+#define AUDIO_SYNTH_KEEP    (AUDIO_STEP_WIDTH + AUDIO_OVERSAMPLE)
+
+typedef struct Audio{
+    // Synthesis rate in samples per CPU cycle, and what it is with no rate control applied
+    double rate;
+    double base_rate;
+
+    // synth[0] is at CPU cycle base_cycle minus `offset` synthesis samples
+    uint64_t base_cycle;
+    double offset;
+
+    _Alignas(16) float synth[AUDIO_SYNTH_SIZE + AUDIO_SYNTH_KEEP];   // band-limited impulses (output's derivative)
+    float level;                                                    // running sum carried between blocks
+
+    // Integrated synthesis samples, the last AUDIO_FIR_TAPS of the previous block first
+    _Alignas(16) float fir[AUDIO_FIR_TAPS + AUDIO_SYNTH_SIZE];
+
+    // Output filter state
+    float high_90_in, high_90_out;
+    float high_440_in, high_440_out;
+    float low_14k_out;
+
+    // The latest frame's samples
+    int16_t output[AUDIO_OUTPUT_SIZE];
+    int output_count;
+} Audio;
+
+// cpu_frequency is the clock audio_delta() timestamps are counted in
+void audio_init(Audio* audio, double cpu_frequency);
+
+// Add a change in level (full scale is 1.0) at the given CPU cycle. Cycles must not go backwards past the
+// current frame's start.
+void audio_delta(Audio* audio, uint64_t cycle, float delta);
+
+// Scale the output rate by the given ratio (e.g. 1.002 makes 0.2% more samples). Call between frames.
+void audio_set_ratio(Audio* audio, double ratio);
+
+// Finish everything up to the given cycle into output[]. (Appends to output; the caller resets output_count.)
+void audio_end_frame(Audio* audio, uint64_t cycle);
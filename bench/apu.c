@@ -0,0 +1,143 @@
+/*  APU benchmark. Drives all five channels with a synthetic tune (pulse arpeggios with sweeps, a triangle bass
+    line, noise percussion and a looping DMC sample), writing registers once per frame the way a game's sound
+    engine would, and times how long the APU and the audio pipeline (band-limited synthesis, decimation and
+    filters) take to produce the 48kHz output, headless. The CPU and PPU aren't run; the system clock is just
+    moved on a frame at a time, so this is the audio's cost alone.
+
+    Built as the bench-apu target:
+        cmake -S . -B build && cmake --build build --target bench-apu
+    Usage:
+        bench-apu [seconds of audio]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "system.h"
+#include "cartridge.h"
+
+System nes;
+
+// NTSC frame length in CPU cycles (341 * 262 / 3, alternating with one cycle less)
+#define FRAME_CYCLES 29781
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Timer periods for a two octave scale
+static const uint16_t notes[16] = {
+    0x1AB, 0x17C, 0x152, 0x13F, 0x11C, 0x0FD, 0x0E2, 0x0D5,
+    0x0BE, 0x0A9, 0x09F, 0x08E, 0x07E, 0x070, 0x06A, 0x05E
+};
+
+// One frame of the sound engine
+static void play(int frame){
+    // Pulse 1: arpeggio, a new note every 4 frames, decaying envelope
+    if(frame % 4 == 0){
+        uint16_t period = notes[(frame / 4) % 16];
+        write(0x4000, 0x84 | ((frame / 64) % 4) << 6);
+        write(0x4001, 0x00);
+        write(0x4002, period & 0xFF);
+        write(0x4003, 0x08 | period >> 8);
+    }
+
+    // Pulse 2: a slower line, with a downward sweep on every other note
+    if(frame % 12 == 0){
+        uint16_t period = notes[(frame / 12 * 5) % 16];
+        write(0x4004, 0x46);
+        write(0x4005, (frame / 12) % 2 ? 0xA3 : 0x00);
+        write(0x4006, period & 0xFF);
+        write(0x4007, 0x10 | period >> 8);
+    }
+
+    // Triangle: bass an octave down
+    if(frame % 8 == 0){
+        uint16_t period = notes[(frame / 8 * 3) % 8] * 2;
+        write(0x4008, 0x20);
+        write(0x400A, period & 0xFF);
+        write(0x400B, 0x18 | period >> 8);
+    }
+
+    // Noise: hats every 6 frames, a longer snare every 24
+    if(frame % 6 == 0){
+        bool snare = frame % 24 == 12;
+        write(0x400C, snare ? 0x06 : 0x02);
+        write(0x400E, snare ? 0x05 : 0x83);
+        write(0x400F, 0x18);
+    }
+
+    // Retrigger the looping DMC sample now and then, at a new rate
+    if(frame % 120 == 0){
+        write(0x4010, 0x40 | (frame / 120) % 16);
+        write(0x4015, 0x0F);
+        write(0x4015, 0x1F);
+    }
+}
+
+int main(int argc, char** argv){
+    double seconds = (argc > 1) ? atof(argv[1]) : 600;
+    int frames = seconds * 60;
+
+    // The DMC plays whatever it finds at $C000: fill the ROM with noise
+    static uint8_t prg[0x8000];
+    static uint8_t chr[0x2000];
+    srand(1);
+    for(int i = 0; i < (int)sizeof(prg); i++){
+        prg[i] = rand();
+    }
+
+    static CPU cpu;
+    static PPU ppu;
+    static APU apu;
+    Cartridge cart = { 0 };
+    cpu_init(&cpu);
+    ppu_init(&ppu);
+    apu_init(&apu);
+    system_init(&cpu, &ppu, &apu, &cart);
+
+    cart.mapper = mapper_find(0);
+    cart.prg_rom = prg;
+    cart.prg_rom_size = sizeof(prg);
+    cart.chr = chr;
+    cart.chr_size = sizeof(chr);
+    cartridge_reset(&cart);
+
+    write(0x4015, 0x0F);
+    write(0x4017, 0x00);
+    write(0x4011, 0x40);
+    write(0x4012, 0x00);
+    write(0x4013, 0x20);
+
+    long samples = 0;
+    int peak = 0;
+    double start = now();
+    for(int frame = 0; frame < frames; frame++){
+        apu.audio.output_count = 0;
+
+        // Register writes are spread over the start of the frame, as they would be during vblank
+        play(frame);
+        nes.cycles += FRAME_CYCLES - (frame & 1);
+        apu_end_frame(&apu, nes.cycles);
+
+        // Reading $4015 keeps the frame IRQ from staying raised
+        read(0x4015);
+
+        for(int i = 0; i < apu.audio.output_count; i++){
+            int level = abs(apu.audio.output[i]);
+            if(level > peak){
+                peak = level;
+            }
+        }
+        samples += apu.audio.output_count;
+    }
+    double elapsed = now() - start;
+
+    double realtime = seconds / elapsed;
+    printf("%.0fs of audio (%ld samples at %d Hz) in %.3fs: %.0fx real time, %.2f%% of a core, peak %d [%s]\n",
+        seconds, samples, AUDIO_SAMPLE_RATE, elapsed, realtime, 100.0 / realtime, peak, peak > 0 ? "ok" : "SILENT");
+
+    return peak > 0 ? 0 : 1;
+}
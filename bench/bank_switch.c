@@ -0,0 +1,182 @@
+/*  Bank switching benchmark. Runs 6502 loops that do nothing but switch banks and read through them on UxROM,
+    MMC1 and MMC3 (with its scanline IRQ firing), headless, then reports emulated frames and bank switches per
+    second. Each 8kB PRG bank is filled with its own number, so the bank read back after the run checks the
+    mapping as well.
+
+    Built as the bench-bank-switch target:
+        cmake -S . -B build && cmake --build build --target bench-bank-switch
+    Usage:
+        bench-bank-switch [frames]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "system.h"
+#include "cartridge.h"
+
+System nes;
+
+#define BENCH_PRG_SIZE 0x20000 // 128kB: 16 8kB banks
+#define BENCH_CHR_SIZE 0x20000
+
+// Code lives at $E100 in the last bank (fixed on all three mappers), the IRQ handler at $E200, NMI at $E300
+#define CODE_OFFSET (BENCH_PRG_SIZE - 0x2000 + 0x100)
+#define IRQ_OFFSET  (BENCH_PRG_SIZE - 0x2000 + 0x200)
+#define NMI_OFFSET  (BENCH_PRG_SIZE - 0x2000 + 0x300)
+
+// Loop: X++; switch the 16kB bank at $8000 to X & 7; read $8000
+static const uint8_t uxrom_code[] = {
+    0xA2, 0x00,             //       LDX #0
+    0xE8,                   // loop: INX
+    0x8A,                   //       TXA
+    0x29, 0x07,             //       AND #7
+    0x8D, 0x00, 0x80,       //       STA $8000
+    0xAD, 0x00, 0x80,       //       LDA $8000
+    0x85, 0x00,             //       STA $00
+    0x4C, 0x02, 0xE1        //       JMP loop
+};
+
+// Loop: X++; shift X & 7 into the PRG bank register ($E000) a bit at a time; read $8000
+static const uint8_t mmc1_code[] = {
+    0xA2, 0x00,             //       LDX #0
+    0xE8,                   // loop: INX
+    0x8A,                   //       TXA
+    0x29, 0x07,             //       AND #7
+    0x8D, 0x00, 0xE0,       //       STA $E000
+    0x4A,                   //       LSR
+    0x8D, 0x00, 0xE0,       //       STA $E000
+    0x4A,                   //       LSR
+    0x8D, 0x00, 0xE0,       //       STA $E000
+    0x4A,                   //       LSR
+    0x8D, 0x00, 0xE0,       //       STA $E000
+    0x4A,                   //       LSR
+    0x8D, 0x00, 0xE0,       //       STA $E000
+    0xAD, 0x00, 0x80,       //       LDA $8000
+    0x85, 0x00,             //       STA $00
+    0x4C, 0x02, 0xE1        //       JMP loop
+};
+
+// Set up an IRQ every 32 scanlines with rendering on, then loop: X++; R6 (PRG $8000) = X; read $8000; R2 (CHR) = X
+static const uint8_t mmc3_code[] = {
+    0xA9, 0x1F,             //       LDA #31
+    0x8D, 0x00, 0xC0,       //       STA $C000 (IRQ latch)
+    0x8D, 0x01, 0xC0,       //       STA $C001 (IRQ reload)
+    0x8D, 0x01, 0xE0,       //       STA $E001 (IRQ enable)
+    0xA9, 0x18,             //       LDA #$18
+    0x8D, 0x01, 0x20,       //       STA $2001 (show background and sprites)
+    0x58,                   //       CLI
+    0xA2, 0x00,             //       LDX #0
+    0xE8,                   // loop: INX
+    0xA9, 0x06,             //       LDA #6
+    0x8D, 0x00, 0x80,       //       STA $8000
+    0x8E, 0x01, 0x80,       //       STX $8001
+    0xAD, 0x00, 0x80,       //       LDA $8000
+    0x85, 0x00,             //       STA $00
+    0xA9, 0x02,             //       LDA #2
+    0x8D, 0x00, 0x80,       //       STA $8000
+    0x8E, 0x01, 0x80,       //       STX $8001
+    0x4C, 0x13, 0xE1        //       JMP loop
+};
+
+// Acknowledge and re-enable the MMC3 IRQ, count it in $02
+static const uint8_t mmc3_irq[] = {
+    0x8D, 0x00, 0xE0,       // STA $E000
+    0x8D, 0x01, 0xE0,       // STA $E001
+    0xE6, 0x02,             // INC $02
+    0x40                    // RTI
+};
+
+typedef struct Bench{
+    uint16_t mapper;
+    const uint8_t* code;
+    size_t code_size;
+} Bench;
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns 0 if the bank mapped at $8000 at the end matches what the program last selected
+static int run(const Bench* bench, int frames){
+    static uint8_t prg[BENCH_PRG_SIZE];
+    static uint8_t chr[BENCH_CHR_SIZE];
+    static CPU cpu;
+    static PPU ppu;
+    static APU apu;
+    Cartridge cart = { 0 };
+
+    for(int bank = 0; bank < BENCH_PRG_SIZE / 0x2000; bank++){
+        memset(&prg[bank * 0x2000], bank, 0x2000);
+    }
+    memcpy(&prg[CODE_OFFSET], bench->code, bench->code_size);
+    memcpy(&prg[IRQ_OFFSET], mmc3_irq, sizeof(mmc3_irq));
+    prg[NMI_OFFSET] = 0x40; // RTI
+
+    // Vectors: NMI, reset, IRQ
+    uint8_t vectors[6] = { 0x00, 0xE3, 0x00, 0xE1, 0x00, 0xE2 };
+    memcpy(&prg[BENCH_PRG_SIZE - 6], vectors, sizeof(vectors));
+
+    cpu_init(&cpu);
+    ppu_init(&ppu);
+    apu_init(&apu);
+    system_init(&cpu, &ppu, &apu, &cart);
+
+    // The cartridge borrows the static buffers, so it is never freed
+    cart.mapper = mapper_find(bench->mapper);
+    cart.prg_rom = prg;
+    cart.prg_rom_size = sizeof(prg);
+    cart.chr = chr;
+    cart.chr_size = sizeof(chr);
+    cart.mirroring = MIRROR_VERTICAL;
+    cartridge_reset(&cart);
+    cpu.pc = read16(&cpu, 0xFFFC);
+
+    // The programs never acknowledge the APU frame IRQ, so inhibit it as games do at startup
+    write(0x4017, 0x40);
+
+    // Only the CPU and mapper are of interest; the PPU keeps time and flags without drawing
+    ppu.render_skip = true;
+
+    double start = now();
+    for(int frame = 0; frame < frames; frame++){
+        system_run_frame();
+    }
+    double elapsed = now() - start;
+
+    // The bank at $8000 holds its own 8kB bank number
+    int expected;
+    switch(bench->mapper){
+        case 1:  expected = (cart.mmc1.prg_bank & 0x0F) * 2;    break;
+        case 2:  expected = (cart.bank & 0x07) * 2;             break;
+        default: expected = cart.mmc3.banks[6] & 0x0F;          break;
+    }
+    int ok = (read(0x8000) == expected);
+
+    printf("%-6s %6d frames in %6.3fs: %8.1f fps, %10.0f bank switches/s", cart.mapper->name, frames, elapsed,
+        frames / elapsed, cart.bank_switches / elapsed);
+    if(bench->mapper == 4){
+        printf(", %d IRQs", cpu.ram[0x02]);
+    }
+    printf(" [%s]\n", ok ? "ok" : "WRONG BANK");
+
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv){
+    int frames = (argc > 1) ? atoi(argv[1]) : 600;
+
+    Bench benches[] = {
+        { 2, uxrom_code, sizeof(uxrom_code) },
+        { 1, mmc1_code, sizeof(mmc1_code) },
+        { 4, mmc3_code, sizeof(mmc3_code) },
+    };
+
+    int failed = 0;
+    for(int i = 0; i < (int)(sizeof(benches) / sizeof(benches[0])); i++){
+        failed |= run(&benches[i], frames);
+    }
+    return failed;
+}
@@ -0,0 +1,425 @@
+/*  End-to-end benchmark. Plays input movies (or runs ROMs with no input) for a fixed number of frames, headless
+    and unthrottled, through the whole frame: CPU, PPU, rendering, mappers and the APU with its audio pipeline.
+    For each ROM it reports:
+        - emulated frames per second of one instance on its own (the median of --reps runs)
+        - frames per second of each of --instances copies all running at once; with one instance per core
+          that's frames per second per core, and its ratio to the single figure is how well it scales
+        - peak RSS of an instance
+    Every run is a fresh process (this program run again with --instance), so each peak RSS is that instance's
+    own and nothing is shared or already warm between runs. The final state CRC32 of every run has to match, as
+    the same movie always gives the same run; a mismatch fails the benchmark.
+
+    Arguments are ROMs, each optionally followed by a movie to play on it (a movie is recognised by its magic).
+    Frames default to the movie's length, or E2E_DEFAULT_FRAMES without one. --json writes the results, with an
+    optional --label (a commit hash, say), and --baseline reads an earlier JSON file and shows the change in
+    single instance frames per second against it.
+
+    Built as the bench-e2e target:
+        cmake -S . -B build && cmake --build build --target bench-e2e
+    Usage:
+        bench-e2e [--frames N] [--instances N] [--reps N] [--json file] [--label text] [--baseline file]
+            {rom} [movie] [{rom} [movie] ...]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/sysinfo.h>
+#endif
+#include "system.h"
+#include "cartridge.h"
+#include "rom.h"
+#include "save.h"
+#include "movie.h"
+#include "checksum.h"
+
+System nes;
+
+#define E2E_DEFAULT_FRAMES  3600    // a minute of play
+#define E2E_MAX_WORKLOADS   64
+#define E2E_MAX_INSTANCES   256
+
+extern char** environ;
+
+typedef struct Workload{
+    char* rom;
+    char* movie;            // NULL to run with no buttons pressed
+} Workload;
+
+// One run, as an instance reports it
+typedef struct Run{
+    long frames;
+    double seconds;
+    uint32_t crc;
+    long rss_kb;            // peak resident set
+} Run;
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ------------------------------------ Instance ------------------------------------ */
+
+static Movie movie;
+static uint32_t movie_frame;
+
+static void movie_poll_input(){
+    movie_buttons(&movie, movie_frame, nes.buttons);
+}
+
+// Run a workload in this process and print an "E2E" result line. frames < 0 means the movie's length.
+static int instance(const char* rom_path, const char* movie_path, long frames){
+    static CPU cpu;
+    static PPU ppu;
+    static APU apu;
+    static Cartridge cart;
+    cpu_init(&cpu);
+    ppu_init(&ppu);
+    apu_init(&apu);
+    system_init(&cpu, &ppu, &apu, &cart);
+
+    if(load_rom((char*)rom_path, &cart) != 0){
+        return 1;
+    }
+    cpu.pc = read16(&cpu, 0xFFFC);
+    if(movie_path != NULL){
+        if(movie_play(&movie, movie_path, &cart) != 0){
+            cartridge_free(&cart);
+            return 1;
+        }
+        nes.poll_input = movie_poll_input;
+        if(frames < 0){
+            frames = movie.frame_count;
+        }
+    } else{
+        // Never touch the ROM's .sav
+        save_detach(&cart);
+    }
+    if(frames < 0){
+        frames = E2E_DEFAULT_FRAMES;
+    }
+
+    static uint8_t framebuffer[FRAME_WIDTH * FRAME_HEIGHT];
+    ppu_set_framebuffer(&ppu, framebuffer);
+
+    double start = now();
+    for(long frame = 0; frame < frames; frame++){
+        movie_frame = frame;
+        system_run_frame();
+        ppu_set_framebuffer(&ppu, framebuffer);
+    }
+    double seconds = now() - start;
+
+    // CPU RAM, PRG RAM and the last frame, as main.c's final state CRC32
+    crc32_init();
+    uint32_t crc = crc32(0, cpu.ram, sizeof(cpu.ram));
+    if(cart.prg_ram != NULL){
+        crc = crc32(crc, cart.prg_ram, cart.prg_ram_size);
+    }
+    crc = crc32(crc, framebuffer, sizeof(framebuffer));
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    long rss_kb = usage.ru_maxrss / 1024;   // bytes there, kB elsewhere
+#else
+    long rss_kb = usage.ru_maxrss;
+#endif
+
+    printf("E2E %ld %.6f %.8X %ld\n", frames, seconds, crc, rss_kb);
+
+    if(movie_path != NULL){
+        movie_close(&movie);
+    }
+    cartridge_free(&cart);
+    return 0;
+}
+
+/* ------------------------------------ Driver ------------------------------------ */
+
+typedef struct Spawned{
+    pid_t pid;
+    FILE* output;           // the instance's stdout
+    char path[4096];
+} Spawned;
+
+// Start `self --instance frames rom [movie]` with its output going to a temporary file. Returns 0 on success.
+static int spawn_instance(const char* self, const Workload* workload, long frames, Spawned* spawned){
+    const char* tmp = getenv("TMPDIR");
+    snprintf(spawned->path, sizeof(spawned->path), "%s/e2e.XXXXXX", tmp != NULL ? tmp : "/tmp");
+    int fd = mkstemp(spawned->path);
+    if(fd < 0 || (spawned->output = fdopen(fd, "w+")) == NULL){
+        printf("ERROR! Couldn't create a file in '%s'.\n", tmp != NULL ? tmp : "/tmp");
+        return 1;
+    }
+
+    char frames_text[32];
+    snprintf(frames_text, sizeof(frames_text), "%ld", frames);
+    char* argv[] = { (char*)self, "--instance", frames_text, workload->rom, workload->movie, NULL };
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fd, 1);
+    fflush(stdout);
+    int status = posix_spawnp(&spawned->pid, self, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(status != 0){
+        printf("ERROR! Couldn't run '%s'.\n", self);
+        fclose(spawned->output);
+        remove(spawned->path);
+        return 1;
+    }
+    return 0;
+}
+
+// Wait for an instance and read its result. On failure its output is passed on. Returns 0 on success.
+static int collect_instance(Spawned* spawned, Run* run){
+    int status;
+    bool exited = waitpid(spawned->pid, &status, 0) == spawned->pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    // The instance wrote through a shared file offset, so start again from the top
+    rewind(spawned->output);
+    bool found = false;
+    char line[1024];
+    while(fgets(line, sizeof(line), spawned->output) != NULL){
+        if(sscanf(line, "E2E %ld %lf %X %ld", &run->frames, &run->seconds, &run->crc, &run->rss_kb) == 4){
+            found = true;
+        }
+    }
+    if(!exited || !found){
+        rewind(spawned->output);
+        while(fgets(line, sizeof(line), spawned->output) != NULL){
+            printf("    %s", line);
+        }
+    }
+
+    fclose(spawned->output);
+    remove(spawned->path);
+    return (exited && found) ? 0 : 1;
+}
+
+// Run `count` instances of a workload at once. Returns 0 if every one of them finished.
+static int run_instances(const char* self, const Workload* workload, long frames, int count, Run* runs){
+    static Spawned spawned[E2E_MAX_INSTANCES];
+    int started = 0;
+    int failed = 0;
+    for(; started < count; started++){
+        if(spawn_instance(self, workload, frames, &spawned[started]) != 0){
+            failed++;
+            break;
+        }
+    }
+    for(int i = 0; i < started; i++){
+        if(collect_instance(&spawned[i], &runs[i]) != 0){
+            failed++;
+        }
+    }
+    return failed;
+}
+
+static int compare_double(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// A movie file starts with its magic; anything else is taken to be a ROM
+static bool is_movie(const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        return false;
+    }
+    char magic[4] = { 0 };
+    bool movie = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, MOVIE_MAGIC, 4) == 0;
+    fclose(file);
+    return movie;
+}
+
+// Online cores. (unistd.h, for sysconf(), can't be included alongside system.h: their read() and write() clash.)
+static int core_count(){
+#ifdef __linux__
+    return get_nprocs();
+#else
+    return 1;
+#endif
+}
+
+// A ROM's single instance frames per second in an earlier --json file, or 0
+static double baseline_fps(const char* baseline, const char* rom){
+    if(baseline == NULL){
+        return 0;
+    }
+    char key[4096];
+    snprintf(key, sizeof(key), "\"rom\": \"%s\"", rom);
+    const char* entry = strstr(baseline, key);
+    const char* fps = entry ? strstr(entry, "\"fps\": ") : NULL;
+    return fps ? atof(fps + 7) : 0;
+}
+
+static char* read_text(const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        printf("ERROR! Could not open baseline '%s'\n", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = malloc(size + 1);
+    text[fread(text, 1, size, file)] = '\0';
+    fclose(file);
+    return text;
+}
+
+static const char* base_name(const char* path){
+    const char* slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+int main(int argc, char** argv){
+    if(argc >= 4 && strcmp(argv[1], "--instance") == 0){
+        return instance(argv[3], argc >= 5 ? argv[4] : NULL, atol(argv[2]));
+    }
+
+    long frames = -1;
+    int cores = core_count();
+    int instances = cores;
+    int reps = 3;
+    const char* json_path = NULL;
+    const char* label = NULL;
+    const char* baseline_path = NULL;
+    static Workload workloads[E2E_MAX_WORKLOADS];
+    int workload_count = 0;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc){
+            frames = atol(argv[++i]);
+        } else if(strcmp(argv[i], "--instances") == 0 && i + 1 < argc){
+            instances = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--reps") == 0 && i + 1 < argc){
+            reps = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--json") == 0 && i + 1 < argc){
+            json_path = argv[++i];
+        } else if(strcmp(argv[i], "--label") == 0 && i + 1 < argc){
+            label = argv[++i];
+        } else if(strcmp(argv[i], "--baseline") == 0 && i + 1 < argc){
+            baseline_path = argv[++i];
+        } else if(strncmp(argv[i], "--", 2) == 0){
+            printf("Unknown option '%s'\n", argv[i]);
+        } else if(workload_count > 0 && workloads[workload_count - 1].movie == NULL && is_movie(argv[i])){
+            workloads[workload_count - 1].movie = argv[i];
+        } else if(workload_count < E2E_MAX_WORKLOADS){
+            workloads[workload_count++] = (Workload){ argv[i], NULL };
+        }
+    }
+    if(workload_count == 0){
+        printf("ERROR! No ROMs given.\nUsage: e2e [--frames N] [--instances N] [--reps N] [--json file] [--label text] "
+            "[--baseline file] {rom} [movie] [{rom} [movie] ...]\n");
+        return 1;
+    }
+    if(instances < 1){
+        instances = 1;
+    } else if(instances > E2E_MAX_INSTANCES){
+        instances = E2E_MAX_INSTANCES;
+    }
+    if(reps < 1){
+        reps = 1;
+    }
+
+    FILE* json = NULL;
+    if(json_path != NULL){
+        json = fopen(json_path, "w");
+        if(json == NULL){
+            printf("ERROR! Couldn't write '%s'.\n", json_path);
+            return 1;
+        }
+        fprintf(json, "{\n  \"label\": \"%s\",\n  \"instances\": %d,\n  \"cores\": %d,\n  \"reps\": %d,\n"
+            "  \"workloads\": [", label != NULL ? label : "", instances, cores, reps);
+    }
+
+    char* baseline = baseline_path != NULL ? read_text(baseline_path) : NULL;
+
+    printf("%d instance%s in parallel on %d cores\n", instances, instances == 1 ? "" : "s", cores);
+    printf("%-24s %8s %10s %12s %12s %12s %8s %10s  %s%s\n", "rom", "frames", "fps", "fps/inst", "min/inst",
+        "total fps", "scaling", "peak RSS", "crc32", baseline != NULL ? "          vs baseline" : "");
+
+    static Run runs[E2E_MAX_INSTANCES];
+    int failures = 0;
+    bool first = true;
+    for(int w = 0; w < workload_count; w++){
+        const Workload* workload = &workloads[w];
+
+        // On its own
+        double single_fps[reps];
+        Run single = { 0 };
+        int failed = 0;
+        for(int rep = 0; rep < reps && failed == 0; rep++){
+            failed = run_instances(argv[0], workload, frames, 1, &single);
+            single_fps[rep] = single.frames / single.seconds;
+        }
+
+        // All at once
+        if(failed == 0){
+            failed = run_instances(argv[0], workload, frames, instances, runs);
+        }
+        if(failed != 0){
+            printf("ERROR! %d run%s of '%s' failed.\n", failed, failed == 1 ? "" : "s", workload->rom);
+            failures++;
+            continue;
+        }
+
+        qsort(single_fps, reps, sizeof(double), compare_double);
+        double fps = single_fps[reps / 2];
+        double total = 0;
+        double slowest = 0;
+        long rss_kb = single.rss_kb;
+        bool match = true;
+        for(int i = 0; i < instances; i++){
+            double instance_fps = runs[i].frames / runs[i].seconds;
+            total += instance_fps;
+            if(i == 0 || instance_fps < slowest){
+                slowest = instance_fps;
+            }
+            if(runs[i].rss_kb > rss_kb){
+                rss_kb = runs[i].rss_kb;
+            }
+            if(runs[i].crc != single.crc || runs[i].frames != single.frames){
+                match = false;
+            }
+        }
+        double per_instance = total / instances;
+
+        printf("%-24.24s %8ld %10.1f %12.1f %12.1f %12.1f %7.0f%% %8.1fMB  %.8X%s", base_name(workload->rom),
+            single.frames, fps, per_instance, slowest, total, 100 * per_instance / fps, rss_kb / 1024.0, single.crc,
+            match ? "" : " MISMATCH");
+        double before = baseline_fps(baseline, workload->rom);
+        if(before > 0){
+            printf("   %+6.1f%% fps", 100 * (fps - before) / before);
+        }
+        printf("\n");
+        if(!match){
+            printf("ERROR! Runs of '%s' ended in different states.\n", workload->rom);
+            failures++;
+        }
+
+        if(json != NULL){
+            fprintf(json, "%s\n    {\"rom\": \"%s\", \"movie\": \"%s\", \"frames\": %ld, \"fps\": %.2f, "
+                "\"fps_per_instance\": %.2f, \"fps_per_instance_min\": %.2f, \"fps_total\": %.2f, \"scaling\": %.4f, "
+                "\"peak_rss_kb\": %ld, \"crc32\": \"%.8X\", \"match\": %s}", first ? "" : ",", workload->rom,
+                workload->movie != NULL ? workload->movie : "", single.frames, fps, per_instance, slowest, total,
+                per_instance / fps, rss_kb, single.crc, match ? "true" : "false");
+            first = false;
+        }
+    }
+
+    if(json != NULL){
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    free(baseline);
+    return failures > 0 ? 1 : 0;
+}
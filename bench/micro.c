@@ -0,0 +1,480 @@
+/*  Microbenchmarks for the hot paths: the CPU on synthetic 6502 programs (ALU, branches, memory, indirect
+    addressing) run through cpu_step(), bus read()/write() dispatch, get_op_data(), tile decoding into the
+    nametable cache, scanline rendering, OAM DMA and save state copies.
+
+    Each benchmark first finds how many operations take about --time ms, runs for --warmup ms, then times
+    --reps repetitions of that many. Reported per benchmark: ns per operation (mean, standard deviation as a
+    percentage, min and median over the repetitions) and operations per second; for the CPU programs an
+    operation is an instruction, so that's instructions per second. --json writes the same as JSON, with an
+    optional --label (a commit hash, say), and --baseline reads an earlier JSON file and shows the change in
+    mean ns/op against it.
+
+    Built as the bench-micro target:
+        cmake -S . -B build && cmake --build build --target bench-micro
+    Usage:
+        bench-micro [--reps N] [--time ms] [--warmup ms] [--filter text] [--json file] [--label text] [--baseline file]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "system.h"
+#include "cartridge.h"
+#include "state.h"
+
+System nes;
+
+static CPU cpu;
+static PPU ppu;
+static APU apu;
+static Cartridge cart;
+static uint8_t prg[0x8000];
+static uint8_t chr[0x2000];
+static uint8_t prg_ram[0x2000];
+
+// Results are folded into this so nothing is optimised away
+static volatile uint64_t sink;
+
+/* ------------------------------------ 6502 programs ------------------------------------ */
+// Each runs forever from $8000
+
+// Arithmetic and logic on A/X/Y, one branch per 13 instructions
+static const uint8_t alu_code[] = {
+    0xA0, 0x00,             //       LDY #0
+    0x18,                   // loop: CLC
+    0x69, 0x13,             //       ADC #$13
+    0x49, 0x5A,             //       EOR #$5A
+    0x0A,                   //       ASL A
+    0x6A,                   //       ROR A
+    0x29, 0xF7,             //       AND #$F7
+    0x09, 0x21,             //       ORA #$21
+    0x38,                   //       SEC
+    0xE9, 0x07,             //       SBC #$07
+    0xAA,                   //       TAX
+    0xE8,                   //       INX
+    0x8A,                   //       TXA
+    0x88,                   //       DEY
+    0xD0, 0xEC,             //       BNE loop
+    0x4C, 0x00, 0x80        //       JMP $8000
+};
+
+// An LFSR in $00 decides every other branch, so they're as unpredictable for the host as for the game
+static const uint8_t branch_code[] = {
+    0xA5, 0x00,             // loop: LDA $00
+    0x0A,                   //       ASL A
+    0x90, 0x02,             //       BCC no_tap
+    0x49, 0x1D,             //       EOR #$1D
+    0x85, 0x00,             // no_tap: STA $00
+    0xC9, 0x80,             //       CMP #$80
+    0xB0, 0x03,             //       BCS high
+    0xE8,                   //       INX
+    0xD0, 0xF0,             //       BNE loop
+    0xCA,                   // high: DEX
+    0xD0, 0xED,             //       BNE loop
+    0x4C, 0x00, 0x80        //       JMP loop
+};
+
+// Copies between internal RAM and PRG RAM, zero page and absolute indexed
+static const uint8_t memory_code[] = {
+    0xA2, 0x00,             //       LDX #0
+    0xBD, 0x00, 0x03,       // loop: LDA $0300,X
+    0x9D, 0x00, 0x04,       //       STA $0400,X
+    0xB5, 0x10,             //       LDA $10,X
+    0x95, 0x80,             //       STA $80,X
+    0xBD, 0x00, 0x60,       //       LDA $6000,X
+    0x9D, 0x00, 0x61,       //       STA $6100,X
+    0xFE, 0x00, 0x05,       //       INC $0500,X
+    0xE8,                   //       INX
+    0xD0, 0xEA,             //       BNE loop
+    0x4C, 0x00, 0x80        //       JMP $8000
+};
+
+// Pointers in zero page: (zp),Y over RAM and PRG RAM, (zp,X), and a JMP through one
+static const uint8_t indirect_code[] = {
+    0xA0, 0x00,             //       LDY #0
+    0xB1, 0x20,             // loop: LDA ($20),Y
+    0x51, 0x22,             //       EOR ($22),Y
+    0x91, 0x22,             //       STA ($22),Y
+    0xA2, 0x04,             //       LDX #4
+    0xA1, 0x20,             //       LDA ($24 - 4,X)
+    0x81, 0x22,             //       STA ($26 - 4,X)
+    0x6C, 0x40, 0x00,       //       JMP ($0040) -> next
+    0xC8,                   // next: INY
+    0xD0, 0xEE,             //       BNE loop
+    0x4C, 0x00, 0x80        //       JMP $8000
+};
+
+// Zero page pointers for indirect_code
+static const uint8_t indirect_pointers[][3] = {
+    { 0x20, 0x00, 0x03 },   // $0300
+    { 0x22, 0x00, 0x60 },   // $6000
+    { 0x24, 0x80, 0x03 },   // $0380
+    { 0x26, 0x80, 0x61 },   // $6180
+    { 0x40, 0x11, 0x80 }    // next
+};
+
+/* ------------------------------------ Setup ------------------------------------ */
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A powered-on NROM system with CHR RAM and PRG RAM, and random video memory to draw
+static void setup_system(){
+    cpu_init(&cpu);
+    ppu_init(&ppu);
+    apu_init(&apu);
+    memset(&cart, 0, sizeof(cart));
+    system_init(&cpu, &ppu, &apu, &cart);
+
+    srand(1);
+    for(int i = 0; i < (int)sizeof(chr); i++){
+        chr[i] = rand();
+    }
+    cart.mapper = mapper_find(0);
+    cart.prg_rom = prg;
+    cart.prg_rom_size = sizeof(prg);
+    cart.chr = chr;
+    cart.chr_size = sizeof(chr);
+    cart.chr_ram = true;
+    cart.prg_ram = prg_ram;
+    cart.prg_ram_size = sizeof(prg_ram);
+    cart.mirroring = MIRROR_VERTICAL;
+    cartridge_reset(&cart);
+
+    for(uint16_t addr = 0x2000; addr < 0x3000; addr++){
+        ppu_write(addr, rand());
+    }
+    for(uint16_t addr = 0x3F00; addr < 0x3F20; addr++){
+        ppu_write(addr, rand() & 0x3F);
+    }
+    for(int i = 0; i < 256; i++){
+        cpu.ram[0x200 + i] = rand();
+    }
+    ppu_write_oam_page(&ppu, 0, &cpu.ram[0x200]);
+
+    // Background and sprites on, scrolled a little so lines straddle two nametables
+    ppu.reg_ppuctrl = 0x00;
+    ppu.reg_ppumask = 0x1E;
+    for(int y = 0; y < FRAME_HEIGHT; y++){
+        ppu.line_scroll[y] = (Scroll){ (uint16_t)((y & 7) << 12 | (y / 8) << 5 | 5), 3 };
+    }
+    ppu.line_reuse = false;
+}
+
+static void setup_program(const uint8_t* code, size_t size){
+    setup_system();
+    memset(prg, 0xEA, sizeof(prg));
+    memcpy(prg, code, size);
+    cpu.pc = 0x8000;
+    cpu.ram[0x00] = 1;  // LFSR seed
+    for(int i = 0; i < (int)(sizeof(indirect_pointers) / sizeof(indirect_pointers[0])); i++){
+        cpu.ram[indirect_pointers[i][0]] = indirect_pointers[i][1];
+        cpu.ram[indirect_pointers[i][0] + 1] = indirect_pointers[i][2];
+    }
+}
+
+static void setup_alu(){        setup_program(alu_code, sizeof(alu_code));              }
+static void setup_branch(){     setup_program(branch_code, sizeof(branch_code));        }
+static void setup_memory(){     setup_program(memory_code, sizeof(memory_code));        }
+static void setup_indirect(){   setup_program(indirect_code, sizeof(indirect_code));    }
+
+static void setup_cache(){
+    setup_system();
+    ppu.nametable_cache = true;
+}
+
+/* ------------------------------------ Benchmarks ------------------------------------ */
+// Each does about `ops` operations and returns how many it did
+
+static uint64_t run_cpu(uint64_t ops){
+    cpu.cycles = 0;
+    for(uint64_t i = 0; i < ops; i++){
+        cpu_step(&cpu);
+    }
+    sink += cpu.a;
+    return ops;
+}
+
+// A mix of RAM, PRG ROM, PRG RAM and the mirrors
+static const uint16_t bus_addresses[16] = {
+    0x0000, 0x0123, 0x0800, 0x1FFF, 0x8000, 0x9ABC, 0xC000, 0xFFFC,
+    0x6000, 0x6ABC, 0x7FFF, 0x0200, 0x8F00, 0xE123, 0x6400, 0x0742
+};
+
+static uint64_t run_read(uint64_t ops){
+    uint64_t sum = 0;
+    for(uint64_t i = 0; i < ops; i++){
+        sum += read(bus_addresses[i & 15]);
+    }
+    sink += sum;
+    return ops;
+}
+
+// RAM and PRG RAM, plus ROM writes (which go to the mapper)
+static uint64_t run_write(uint64_t ops){
+    for(uint64_t i = 0; i < ops; i++){
+        write(bus_addresses[i & 15], (uint8_t)i);
+    }
+    sink += cpu.ram[0x123];
+    return ops;
+}
+
+static uint64_t run_op_data(uint64_t ops){
+    uint64_t sum = 0;
+    for(uint64_t i = 0; i < ops; i++){
+        sum += get_op_data(i & 0xFF)->cycles;
+    }
+    sink += sum;
+    return ops;
+}
+
+// All 3840 tiles of the four nametables redrawn, a full cache at a time
+static uint64_t run_tiles(uint64_t ops){
+    uint64_t done = 0;
+    while(done < ops){
+        ppu_invalidate(&ppu);
+        ppu_update_nametable_cache(&ppu);
+        done += 60 * 64;
+    }
+    sink += ppu.cache_tiles_drawn;
+    return done;
+}
+
+static uint64_t run_scanlines(uint64_t ops){
+    static uint8_t framebuffer[FRAME_WIDTH * FRAME_HEIGHT];
+    ppu_set_framebuffer(&ppu, framebuffer);
+    if(ppu.nametable_cache){
+        ppu_update_nametable_cache(&ppu);
+    }
+    for(uint64_t i = 0; i < ops; i++){
+        ppu_render_scanline(&ppu, i % FRAME_HEIGHT);
+    }
+    sink += framebuffer[FRAME_WIDTH * 100 + 17];
+    return ops;
+}
+
+static uint64_t run_dma(uint64_t ops){
+    for(uint64_t i = 0; i < ops; i++){
+        ppu_write_OAMDMA(0x02);
+        cpu.stall = 0;
+    }
+    sink += ppu.oam[17];
+    return ops;
+}
+
+static uint8_t* state_buffer;
+
+static uint64_t run_state_save(uint64_t ops){
+    for(uint64_t i = 0; i < ops; i++){
+        state_save(state_buffer);
+    }
+    sink += state_buffer[100];
+    return ops;
+}
+
+static uint64_t run_state_load(uint64_t ops){
+    for(uint64_t i = 0; i < ops; i++){
+        state_load(state_buffer);
+    }
+    sink += cpu.pc;
+    return ops;
+}
+
+static void setup_state(){
+    setup_system();
+    free(state_buffer);
+    state_buffer = malloc(state_size());
+    state_save(state_buffer);
+}
+
+typedef struct Bench{
+    const char* name;
+    const char* unit;   // what an operation is
+    void (*setup)();
+    uint64_t (*run)(uint64_t ops);
+} Bench;
+
+static const Bench benches[] = {
+    { "cpu_alu",            "instruction",  setup_alu,      run_cpu         },
+    { "cpu_branch",         "instruction",  setup_branch,   run_cpu         },
+    { "cpu_memory",         "instruction",  setup_memory,   run_cpu         },
+    { "cpu_indirect",       "instruction",  setup_indirect, run_cpu         },
+    { "bus_read",           "read",         setup_system,   run_read        },
+    { "bus_write",          "write",        setup_system,   run_write       },
+    { "get_op_data",        "lookup",       setup_system,   run_op_data     },
+    { "tile_decode",        "tile",         setup_cache,    run_tiles       },
+    { "scanline_render",    "scanline",     setup_system,   run_scanlines   },
+    { "scanline_cached",    "scanline",     setup_cache,    run_scanlines   },
+    { "oam_dma",            "DMA",          setup_system,   run_dma         },
+    { "state_save",         "save",         setup_state,    run_state_save  },
+    { "state_load",         "load",         setup_state,    run_state_load  },
+};
+
+/* ------------------------------------ Measurement ------------------------------------ */
+
+typedef struct Options{
+    int reps;
+    double rep_seconds;
+    double warmup_seconds;
+    const char* filter;
+    const char* json_path;
+    const char* label;
+    const char* baseline_path;
+} Options;
+
+typedef struct Result{
+    uint64_t ops;       // per repetition
+    double mean, stddev, min, median, max;  // ns per op
+} Result;
+
+static int compare_double(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static Result measure(const Bench* bench, const Options* options){
+    bench->setup();
+
+    // Find how many operations make a repetition, then keep going until warmed up
+    uint64_t ops = 64;
+    double elapsed = 0;
+    double warmup_start = now();
+    while(elapsed < options->rep_seconds / 10){
+        ops *= 2;
+        double start = now();
+        ops = bench->run(ops);
+        elapsed = now() - start;
+    }
+    ops = ops * options->rep_seconds / elapsed + 1;
+    while(now() - warmup_start < options->warmup_seconds){
+        bench->run(ops);
+    }
+
+    double* samples = malloc(options->reps * sizeof(double));
+    Result result = { ops, 0, 0, 0, 0, 0 };
+    for(int rep = 0; rep < options->reps; rep++){
+        double start = now();
+        uint64_t done = bench->run(ops);
+        samples[rep] = (now() - start) * 1e9 / done;
+        result.mean += samples[rep];
+    }
+    result.mean /= options->reps;
+    for(int rep = 0; rep < options->reps; rep++){
+        result.stddev += (samples[rep] - result.mean) * (samples[rep] - result.mean);
+    }
+    result.stddev = (options->reps > 1) ? sqrt(result.stddev / (options->reps - 1)) : 0;
+
+    qsort(samples, options->reps, sizeof(double), compare_double);
+    result.min = samples[0];
+    result.max = samples[options->reps - 1];
+    result.median = (options->reps % 2) ? samples[options->reps / 2]
+        : (samples[options->reps / 2 - 1] + samples[options->reps / 2]) / 2;
+    free(samples);
+    return result;
+}
+
+// Mean ns/op of a benchmark in an earlier --json file, or 0 if it isn't there
+static double baseline_mean(const char* baseline, const char* name){
+    if(baseline == NULL){
+        return 0;
+    }
+    char key[64];
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+    const char* entry = strstr(baseline, key);
+    const char* mean = entry ? strstr(entry, "\"mean\": ") : NULL;
+    return mean ? atof(mean + 8) : 0;
+}
+
+static char* read_text(const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        printf("ERROR! Could not open baseline '%s'\n", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = malloc(size + 1);
+    text[fread(text, 1, size, file)] = '\0';
+    fclose(file);
+    return text;
+}
+
+int main(int argc, char** argv){
+    Options options = { 15, 0.05, 0.2, NULL, NULL, NULL, NULL };
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--reps") == 0 && i + 1 < argc){
+            options.reps = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--time") == 0 && i + 1 < argc){
+            options.rep_seconds = atof(argv[++i]) / 1000;
+        } else if(strcmp(argv[i], "--warmup") == 0 && i + 1 < argc){
+            options.warmup_seconds = atof(argv[++i]) / 1000;
+        } else if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc){
+            options.filter = argv[++i];
+        } else if(strcmp(argv[i], "--json") == 0 && i + 1 < argc){
+            options.json_path = argv[++i];
+        } else if(strcmp(argv[i], "--label") == 0 && i + 1 < argc){
+            options.label = argv[++i];
+        } else if(strcmp(argv[i], "--baseline") == 0 && i + 1 < argc){
+            options.baseline_path = argv[++i];
+        } else{
+            printf("Unknown option '%s'\n", argv[i]);
+        }
+    }
+    if(options.reps < 1){
+        options.reps = 1;
+    }
+
+    char* baseline = options.baseline_path ? read_text(options.baseline_path) : NULL;
+    FILE* json = NULL;
+    if(options.json_path != NULL){
+        json = fopen(options.json_path, "w");
+        if(json == NULL){
+            printf("ERROR! Could not open '%s'\n", options.json_path);
+            return 1;
+        }
+        fprintf(json, "{\n  \"label\": \"%s\",\n  \"reps\": %d,\n  \"rep_ms\": %.1f,\n  \"warmup_ms\": %.1f,\n"
+            "  \"benchmarks\": [", options.label ? options.label : "", options.reps, options.rep_seconds * 1000,
+            options.warmup_seconds * 1000);
+    }
+
+    printf("%-16s %12s %8s %12s %12s %12s  %-12s%s\n", "benchmark", "ns/op", "stddev", "min", "median", "ops/s", "op",
+        baseline ? "   vs baseline" : "");
+    bool first = true;
+    for(int i = 0; i < (int)(sizeof(benches) / sizeof(benches[0])); i++){
+        const Bench* bench = &benches[i];
+        if(options.filter != NULL && strstr(bench->name, options.filter) == NULL){
+            continue;
+        }
+
+        Result r = measure(bench, &options);
+        double per_second = 1e9 / r.mean;
+        printf("%-16s %12.3f %7.1f%% %12.3f %12.3f %11.2fM  %-12s", bench->name, r.mean, 100 * r.stddev / r.mean,
+            r.min, r.median, per_second / 1e6, bench->unit);
+        double before = baseline_mean(baseline, bench->name);
+        if(before > 0){
+            printf("   %+6.1f%%", 100 * (r.mean - before) / before);
+        }
+        printf("\n");
+
+        if(json != NULL){
+            fprintf(json, "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"ops_per_rep\": %llu, \"ns_per_op\": {\"mean\": "
+                "%.4f, \"stddev\": %.4f, \"min\": %.4f, \"median\": %.4f, \"max\": %.4f}, \"ops_per_second\": %.0f}",
+                first ? "" : ",", bench->name, bench->unit, (unsigned long long)r.ops, r.mean, r.stddev, r.min,
+                r.median, r.max, per_second);
+        }
+        first = false;
+    }
+
+    if(json != NULL){
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    free(baseline);
+    free(state_buffer);
+    return 0;
+}
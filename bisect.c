@@ -0,0 +1,470 @@
+#include "bisect.h"
+#include "digest.h"
+#include "trace.h"
+#include "rom.h"
+#include "checksum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+#define BISECT_MAX_ARGS 64
+
+typedef struct Engine{
+    const char* exe;
+    char* options[BISECT_MAX_ARGS];
+    int option_count;
+} Engine;
+
+typedef struct Bisect{
+    const char* rom;
+    const char* movie;
+    const char* dir;
+    Engine a, b;
+    int jobs;
+    long interval;
+    int context;
+} Bisect;
+
+#ifdef _WIN32
+int bisect_main(int argc, char** argv){
+    printf("ERROR! The bisector needs fork(), which this platform doesn't have.\n");
+    return 2;
+}
+#else
+
+static double bisect_now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Split an options string on spaces (it's kept, as the options point into it)
+static void bisect_engine_options(Engine* engine, char* options){
+    engine->option_count = 0;
+    for(char* token = strtok(options, " "); token != NULL && engine->option_count < BISECT_MAX_ARGS - 16;
+        token = strtok(NULL, " ")){
+        engine->options[engine->option_count++] = token;
+    }
+}
+
+// Start `engine rom --play movie <args> <engine options>` with its output going to a log file
+static pid_t bisect_spawn(const Bisect* bisect, const Engine* engine, char** args, const char* log_name){
+    char* argv[BISECT_MAX_ARGS + 8];
+    int count = 0;
+    argv[count++] = (char*)engine->exe;
+    argv[count++] = (char*)bisect->rom;
+    argv[count++] = "--play";
+    argv[count++] = (char*)bisect->movie;
+    for(int i = 0; args[i] != NULL; i++){
+        argv[count++] = args[i];
+    }
+    for(int i = 0; i < engine->option_count; i++){
+        argv[count++] = engine->options[i];
+    }
+    argv[count] = NULL;
+
+    char log_path[4096];
+    snprintf(log_path, sizeof(log_path), "%s/%s", bisect->dir, log_name);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0){
+        int log = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(log >= 0){
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+            close(log);
+        }
+        execv(engine->exe, argv);
+        printf("ERROR! Couldn't run '%s'.\n", engine->exe);
+        _exit(127);
+    }
+    if(pid < 0){
+        printf("ERROR! Couldn't start a worker.\n");
+    }
+    return pid;
+}
+
+// Wait for a worker; true if it finished successfully
+static bool bisect_wait(pid_t pid){
+    int status;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool bisect_exists(const char* dir, const char* name){
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    struct stat info;
+    return stat(path, &info) == 0;
+}
+
+// Frames in a digest log
+static long bisect_log_frames(const char* path){
+    struct stat info;
+    if(stat(path, &info) != 0 || info.st_size < DIGEST_HEADER_SIZE){
+        return -1;
+    }
+    return (info.st_size - DIGEST_HEADER_SIZE) / DIGEST_RECORD_SIZE;
+}
+
+// CRC32 of a whole file, or false if it can't be read
+static bool bisect_file_crc32(const char* path, uint32_t* crc){
+    size_t size;
+    uint8_t* data = rom_map_file(path, &size);
+    if(data == NULL){
+        return false;
+    }
+    *crc = crc32(0, data, size);
+    rom_unmap_file(data, size);
+    return true;
+}
+
+// Describe what a reference run is made from: the ROM, the movie, the interval and A's command line (with the
+// executable's size and modification time, so a rebuilt A counts as a different one). Empty if any is unreadable.
+static void bisect_manifest(const Bisect* bisect, char* out, size_t size){
+    uint32_t rom_crc, movie_crc;
+    struct stat exe;
+    if(!bisect_file_crc32(bisect->rom, &rom_crc) || !bisect_file_crc32(bisect->movie, &movie_crc)
+        || stat(bisect->a.exe, &exe) != 0){
+        out[0] = '\0';
+        return;
+    }
+
+    int length = snprintf(out, size, "rom %08X\nmovie %08X\ninterval %ld\na-exe %s %lld %lld\na-options",
+        rom_crc, movie_crc, bisect->interval, bisect->a.exe, (long long)exe.st_size, (long long)exe.st_mtime);
+    for(int i = 0; i < bisect->a.option_count && length > 0 && (size_t)length < size; i++){
+        length += snprintf(&out[length], size - length, " %s", bisect->a.options[i]);
+    }
+    if(length > 0 && (size_t)length < size){
+        snprintf(&out[length], size - length, "\n");
+    }
+}
+
+// Step 1: the reference run and its checkpoints. A previous one in the directory is reused only if its manifest
+// matches this run's exactly; anything else (another ROM, movie, interval or A) means running it again.
+static int bisect_reference(const Bisect* bisect){
+    char manifest_path[4096], manifest[8192], previous[8192];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/reference.txt", bisect->dir);
+    bisect_manifest(bisect, manifest, sizeof(manifest));
+
+    FILE* file = fopen(manifest_path, "rb");
+    if(file != NULL){
+        size_t length = fread(previous, 1, sizeof(previous) - 1, file);
+        previous[length] = '\0';
+        fclose(file);
+        if(manifest[0] != '\0' && strcmp(manifest, previous) == 0 && bisect_exists(bisect->dir, "a.dig")
+            && bisect_exists(bisect->dir, "0.state")){
+            printf("Reusing the reference run and checkpoints in '%s'\n", bisect->dir);
+            return 0;
+        }
+    }
+    // Until the new run has finished, nothing in the directory can be reused
+    remove(manifest_path);
+
+    char digest_path[4096], interval[32];
+    snprintf(digest_path, sizeof(digest_path), "%s/a.dig", bisect->dir);
+    snprintf(interval, sizeof(interval), "%ld", bisect->interval);
+    char* args[] = { "--digest", digest_path, "--checkpoints", interval, (char*)bisect->dir, NULL };
+
+    double start = bisect_now();
+    if(!bisect_wait(bisect_spawn(bisect, &bisect->a, args, "a.log"))){
+        printf("ERROR! The reference run failed (see %s/a.log).\n", bisect->dir);
+        return 1;
+    }
+    printf("Reference run: %ld frames in %.1fs\n", bisect_log_frames(digest_path), bisect_now() - start);
+
+    file = fopen(manifest_path, "wb");
+    if(file != NULL){
+        fputs(manifest, file);
+        fclose(file);
+    }
+    return 0;
+}
+
+// Step 2: B over every interval, in parallel. Returns the first divergent frame, -1 if none, -2 on error.
+static long bisect_intervals(const Bisect* bisect, long frames, Digest_Divergence* divergence){
+    long intervals = (frames + bisect->interval - 1) / bisect->interval;
+    pid_t* workers = calloc(intervals, sizeof(pid_t));
+    bool* done = calloc(intervals, sizeof(bool));
+    bool* ok = calloc(intervals, sizeof(bool));
+
+    char reference[4096];
+    snprintf(reference, sizeof(reference), "%s/a.dig", bisect->dir);
+
+    double start = bisect_now();
+    long launched = 0, running = 0, checked = 0;
+    long found = -1;
+    while(checked < intervals && found == -1){
+        // Keep every core busy, in frame order
+        while(running < bisect->jobs && launched < intervals){
+            char state[4096], digest[4096], count[32], log_name[64];
+            snprintf(state, sizeof(state), "%s/%ld.state", bisect->dir, launched * bisect->interval);
+            snprintf(digest, sizeof(digest), "%s/b%ld.dig", bisect->dir, launched);
+            snprintf(count, sizeof(count), "%ld", bisect->interval);
+            snprintf(log_name, sizeof(log_name), "b%ld.log", launched);
+            char* args[] = { "--state", state, "--headless", count, "--digest", digest, NULL };
+
+            workers[launched] = bisect_spawn(bisect, &bisect->b, args, log_name);
+            if(workers[launched] <= 0){
+                found = -2;
+                break;
+            }
+            launched++;
+            running++;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if(pid <= 0){
+            break;
+        }
+        for(long i = 0; i < launched; i++){
+            if(workers[i] == pid){
+                done[i] = true;
+                ok[i] = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                running--;
+            }
+        }
+
+        // Results count in order: a divergence only stands once every interval before it is known to agree
+        while(checked < intervals && done[checked] && found == -1){
+            char digest[4096];
+            snprintf(digest, sizeof(digest), "%s/b%ld.dig", bisect->dir, checked);
+            long end = (checked + 1) * bisect->interval;
+            if(end > frames){
+                end = frames;
+            }
+            if(!ok[checked] || digest_diverge(reference, digest, divergence) != 0){
+                printf("ERROR! Worker for frames %ld - %ld failed (see %s/b%ld.log).\n", checked * bisect->interval,
+                    end - 1, bisect->dir, checked);
+                found = -2;
+            } else if(divergence->frame >= 0){
+                found = divergence->frame;
+            } else if(divergence->end_b < (uint64_t)end){
+                // Only the last interval may be short, and then only where the reference run ends too
+                printf("ERROR! Worker for frames %ld - %ld stopped after frame %llu (see %s/b%ld.log).\n",
+                    checked * bisect->interval, end - 1, (unsigned long long)divergence->end_b - 1, bisect->dir,
+                    checked);
+                found = -2;
+            }
+            checked++;
+        }
+    }
+
+    // Anything still running is past the answer
+    for(long i = 0; i < launched; i++){
+        if(!done[i] && workers[i] > 0){
+            kill(workers[i], SIGTERM);
+            waitpid(workers[i], NULL, 0);
+        }
+    }
+
+    printf("Checked %ld of %ld intervals (%ld frames each, %d at a time) in %.1fs\n", checked, intervals,
+        bisect->interval, bisect->jobs, bisect_now() - start);
+
+    free(workers);
+    free(done);
+    free(ok);
+    return found;
+}
+
+typedef struct Trace{
+    uint8_t* data;
+    size_t size;
+    uint32_t count;
+} Trace;
+
+static const char* trace_text(const Trace* trace, long i){
+    return (i >= 0 && i < trace->count) ? (const char*)&trace->data[TRACE_HEADER_SIZE + i * TRACE_RECORD_SIZE + 8] : "";
+}
+
+static uint64_t trace_hash(const Trace* trace, long i){
+    const uint8_t* in = &trace->data[TRACE_HEADER_SIZE + i * TRACE_RECORD_SIZE];
+    uint64_t hash = 0;
+    for(int byte = 7; byte >= 0; byte--){
+        hash = hash << 8 | in[byte];
+    }
+    return hash;
+}
+
+static const uint8_t* trace_picture(const Trace* trace){
+    return &trace->data[TRACE_HEADER_SIZE + (size_t)trace->count * TRACE_RECORD_SIZE];
+}
+
+static bool bisect_load_trace(const Bisect* bisect, const char* name, Trace* trace){
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", bisect->dir, name);
+    trace->data = rom_map_file(path, &trace->size);
+    if(trace->data == NULL || trace->size < TRACE_HEADER_SIZE || memcmp(trace->data, TRACE_MAGIC, 4) != 0){
+        printf("ERROR! Couldn't read trace '%s'.\n", path);
+        return false;
+    }
+    const uint8_t* count = &trace->data[12];
+    trace->count = count[0] | count[1] << 8 | count[2] << 16 | (uint32_t)count[3] << 24;
+    if(trace->size < TRACE_HEADER_SIZE + (size_t)trace->count * TRACE_RECORD_SIZE + FRAME_WIDTH * FRAME_HEIGHT){
+        printf("ERROR! Trace '%s' is truncated.\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Step 3: both engines through the divergent frame, an instruction at a time
+static int bisect_instructions(const Bisect* bisect, long frame){
+    long checkpoint = frame / bisect->interval * bisect->interval;
+    char state[4096], count[32], a_path[4096], b_path[4096];
+    snprintf(state, sizeof(state), "%s/%ld.state", bisect->dir, checkpoint);
+    snprintf(count, sizeof(count), "%ld", frame - checkpoint);
+    snprintf(a_path, sizeof(a_path), "%s/a.trace", bisect->dir);
+    snprintf(b_path, sizeof(b_path), "%s/b.trace", bisect->dir);
+    char* a_args[] = { "--state", state, "--headless", count, "--trace-frame", a_path, NULL };
+    char* b_args[] = { "--state", state, "--headless", count, "--trace-frame", b_path, NULL };
+
+    pid_t a = bisect_spawn(bisect, &bisect->a, a_args, "a_trace.log");
+    pid_t b = bisect_spawn(bisect, &bisect->b, b_args, "b_trace.log");
+    bool a_ok = bisect_wait(a);
+    bool b_ok = bisect_wait(b);
+    Trace ta = { 0 }, tb = { 0 };
+    if(!a_ok || !b_ok || !bisect_load_trace(bisect, "a.trace", &ta) || !bisect_load_trace(bisect, "b.trace", &tb)){
+        printf("ERROR! Tracing frame %ld failed (see %s/a_trace.log and b_trace.log).\n", frame, bisect->dir);
+        rom_unmap_file(ta.data, ta.size);
+        rom_unmap_file(tb.data, tb.size);
+        return 2;
+    }
+
+    long common = (ta.count < tb.count) ? ta.count : tb.count;
+    long first = -1;
+    for(long i = 0; i < common; i++){
+        if(trace_hash(&ta, i) != trace_hash(&tb, i)){
+            first = i;
+            break;
+        }
+    }
+    if(first < 0 && ta.count != tb.count){
+        first = common;
+    }
+
+    if(first >= 0){
+        printf("\nFrame %ld: the machines first differ after instruction %ld (of %u in A, %u in B)\n\n", frame,
+            first, ta.count, tb.count);
+        printf("        %-*s | %s\n", TRACE_LINE_SIZE - 8, "A", "B");
+        long from = (first > bisect->context) ? first - bisect->context : 0;
+        long to = first + bisect->context / 4;
+        for(long i = from; i <= to && (i < ta.count || i < tb.count); i++){
+            const char* line_a = trace_text(&ta, i);
+            const char* line_b = trace_text(&tb, i);
+            char marker = (i == first) ? '>' : strcmp(line_a, line_b) != 0 ? '*' : ' ';
+            printf("%c%6ld %-*s | %s\n", marker, i, TRACE_LINE_SIZE - 8, line_a, line_b);
+        }
+        printf("\n'>' marks the instruction after which the states differ, '*' lines that read differently.\n");
+        printf("Full traces: %s, %s\n", a_path, b_path);
+    } else{
+        // Same machine state all the way through, so it's only the picture
+        const uint8_t* pa = trace_picture(&ta);
+        const uint8_t* pb = trace_picture(&tb);
+        int line = -1, pixels = 0;
+        for(int y = 0; y < FRAME_HEIGHT; y++){
+            for(int x = 0; x < FRAME_WIDTH; x++){
+                if(pa[y * FRAME_WIDTH + x] != pb[y * FRAME_WIDTH + x]){
+                    if(line < 0){
+                        line = y;
+                    }
+                    pixels++;
+                }
+            }
+        }
+        if(line >= 0){
+            printf("\nFrame %ld: the machines agree at every instruction, but the pictures differ from scanline %d "
+                "(%d pixels in all)\n", frame, line, pixels);
+        } else{
+            printf("\nFrame %ld: no difference when traced; the divergence didn't reproduce from the checkpoint\n",
+                frame);
+        }
+    }
+
+    rom_unmap_file(ta.data, ta.size);
+    rom_unmap_file(tb.data, tb.size);
+    return 1;
+}
+
+int bisect_main(int argc, char** argv){
+    Bisect bisect = { 0 };
+    bisect.rom = argv[2];
+    bisect.movie = argv[3];
+    bisect.dir = "bisect";
+    bisect.a.exe = argv[0];
+    bisect.b.exe = argv[0];
+    bisect.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bisect.interval = BISECT_INTERVAL;
+    bisect.context = BISECT_CONTEXT;
+
+    for(int i = 4; i < argc; i++){
+        if(strcmp(argv[i], "--a") == 0 && i + 1 < argc){
+            bisect_engine_options(&bisect.a, argv[++i]);
+        } else if(strcmp(argv[i], "--b") == 0 && i + 1 < argc){
+            bisect_engine_options(&bisect.b, argv[++i]);
+        } else if(strcmp(argv[i], "--a-exe") == 0 && i + 1 < argc){
+            bisect.a.exe = argv[++i];
+        } else if(strcmp(argv[i], "--b-exe") == 0 && i + 1 < argc){
+            bisect.b.exe = argv[++i];
+        } else if(strcmp(argv[i], "--jobs") == 0 && i + 1 < argc){
+            bisect.jobs = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--interval") == 0 && i + 1 < argc){
+            bisect.interval = atol(argv[++i]);
+        } else if(strcmp(argv[i], "--dir") == 0 && i + 1 < argc){
+            bisect.dir = argv[++i];
+        } else if(strcmp(argv[i], "--context") == 0 && i + 1 < argc){
+            bisect.context = atoi(argv[++i]);
+        } else{
+            printf("Unknown option '%s'\n", argv[i]);
+        }
+    }
+    if(bisect.jobs < 1){
+        bisect.jobs = 1;
+    }
+    if(bisect.interval < 1){
+        bisect.interval = BISECT_INTERVAL;
+    }
+
+    if(mkdir(bisect.dir, 0755) != 0 && !bisect_exists(bisect.dir, ".")){
+        printf("ERROR! Couldn't create '%s'.\n", bisect.dir);
+        return 2;
+    }
+
+    if(bisect_reference(&bisect) != 0){
+        return 2;
+    }
+
+    char reference[4096];
+    snprintf(reference, sizeof(reference), "%s/a.dig", bisect.dir);
+    long frames = bisect_log_frames(reference);
+    if(frames <= 0){
+        printf("ERROR! The reference run logged no frames.\n");
+        return 2;
+    }
+
+    Digest_Divergence divergence;
+    long frame = bisect_intervals(&bisect, frames, &divergence);
+    if(frame == -2){
+        return 2;
+    } else if(frame == -1){
+        printf("A and B agree on all %ld frames\n", frames);
+        return 0;
+    }
+
+    printf("First divergence at frame %ld (%s)\n", frame, (divergence.picture && divergence.state)
+        ? "picture and state" : divergence.picture ? "picture only" : "state only");
+    return bisect_instructions(&bisect, frame);
+}
+
+#endif
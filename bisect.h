@@ -0,0 +1,27 @@
+#pragma once
+
+/*  Divergence bisector: finds where two emulator builds, or two modes of one build, first stop agreeing over a
+    movie, down to the frame and then the instruction.
+
+        unicom --bisect {rom} {movie} [--a "options"] [--b "options"] [--a-exe path] [--b-exe path]
+                                      [--jobs N] [--interval frames] [--dir path] [--context instructions]
+
+    A is the reference and B the engine under test; each is an executable (this one by default) plus the
+    options it is run with (e.g. --b "--nt-cache"). Every step runs in worker processes:
+
+    1. A plays the whole movie once, logging per-frame digests and saving a state every `interval` frames
+       (reused on later runs with the same ROM, movie, interval and A, which --dir/reference.txt records).
+    2. B plays every interval from A's checkpoint for its start, `jobs` at a time, logging digests. As B starts
+       each interval from the same state as A, the first interval where they differ holds the first divergence,
+       and its digests give the frame.
+    3. Both run that frame an instruction at a time from the same checkpoint, hashing the whole machine after
+       each one. The first instruction whose hashes differ is printed with the instructions around it, side by
+       side. If the machine states never differ, the picture does, and the first differing scanline is given.
+
+    Returns 0 if A and B agree over the whole movie, 1 if they diverge, 2 on error. POSIX only (fork/exec).
+*/
+
+#define BISECT_INTERVAL     600     // frames between checkpoints
+#define BISECT_CONTEXT      200     // instructions shown before the divergent one (and a quarter as many after)
+
+int bisect_main(int argc, char** argv);
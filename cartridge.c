@@ -0,0 +1,99 @@
+#include "cartridge.h"
+#include "system.h"
+#include "rom.h"
+#include "save.h"
+#include "timeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void cartridge_reset(Cartridge* cart){
+    cart->prg_pages[0] = cart->prg_ram;
+    cart->prg_ram_writable = true;
+    cart->bank_switches = 0;
+
+    // Force the header's arrangement onto the PPU, whatever it was left with
+    ppu_set_mirroring(nes.ppu, cart->mirroring);
+
+    cart->mapper->reset(cart);
+}
+
+void cartridge_free(Cartridge* cart){
+    save_close(cart);
+
+    // ROM lives in the file's mapping; only RAM was allocated
+    if(cart->chr_ram){
+        free(cart->chr);
+    }
+    free(cart->prg_ram);
+    if(cart->file != NULL){
+        rom_unmap_file(cart->file, cart->file_size);
+    }
+
+    cart->file = NULL;
+    cart->prg_rom = NULL;
+    cart->chr = NULL;
+    cart->prg_ram = NULL;
+}
+
+// Byte offset of a bank within memory of a given size, with negative banks counted from the end
+static uint32_t cartridge_bank_offset(uint32_t memory_size, int size, int bank){
+    int bank_size = size * 0x400;
+    int count = memory_size / bank_size;
+    if(count == 0){
+        count = 1;
+    }
+
+    if(bank < 0){
+        bank += count;
+    }
+    return ((uint32_t)bank % count) * bank_size;
+}
+
+void cartridge_map_prg(Cartridge* cart, uint16_t addr, int size, int bank){
+    uint32_t offset = cartridge_bank_offset(cart->prg_rom_size, size, bank);
+    int first = ((addr - 0x6000) / PRG_PAGE_SIZE);
+
+    bool switched = false;
+    for(int i = 0; i < size * 0x400 / PRG_PAGE_SIZE; i++){
+        // Banks bigger than the ROM (e.g. 32kB of a 16kB NROM) mirror it
+        uint8_t* page = &cart->prg_rom[(offset + i * PRG_PAGE_SIZE) % cart->prg_rom_size];
+        switched |= cart->prg_pages[first + i] != page;
+        cart->prg_pages[first + i] = page;
+    }
+
+    // Mappers like MMC3 remap every bank on each register write, so only count the ones that moved something
+    if(switched){
+        cart->bank_switches++;
+        TIMELINE_INSTANT("PRG bank switch");
+    }
+}
+
+void cartridge_map_chr(Cartridge* cart, uint16_t addr, int size, int bank){
+    uint32_t offset = cartridge_bank_offset(cart->chr_size, size, bank);
+    int first = addr / CHR_PAGE_SIZE;
+
+    bool switched = false;
+    for(int i = 0; i < size; i++){
+        uint8_t* page = &cart->chr[(offset + i * CHR_PAGE_SIZE) % cart->chr_size];
+        switched |= nes.ppu->pages[first + i] != page;
+        ppu_set_pattern_page(nes.ppu, first + i, page);
+    }
+
+    if(switched){
+        cart->bank_switches++;
+        TIMELINE_INSTANT("CHR bank switch");
+    }
+}
+
+void cartridge_set_mirroring(Cartridge* cart, Mirroring mirroring){
+    // Four-screen VRAM on the board overrides whatever the mapper asks for
+    if(cart->mirroring == MIRROR_FOUR_SCREEN){
+        return;
+    }
+
+    // Changing mirroring throws away the PPU's cached nametables, so only do it for real changes
+    if(nes.ppu->mirroring != mirroring){
+        ppu_set_mirroring(nes.ppu, mirroring);
+    }
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "ppu.h"
+
+/*  Cartridge memory, as seen by the CPU and PPU:
+    ---------------------------------------
+    Address Range   Description
+    ---------------------------------------
+    CPU $4020-$5FFF Expansion area (mapper specific, usually unused)
+    CPU $6000-$7FFF PRG RAM (work RAM, battery backed on some carts)
+    CPU $8000-$FFFF PRG ROM, in four 8kB windows
+    PPU $0000-$1FFF CHR ROM/RAM, in eight 1kB windows (the PPU's pattern pages)
+
+    Every window is a pointer into ROM/RAM, so a bank switch only ever swaps pointers; nothing is copied. Mappers
+    pick banks in whatever sizes their hardware uses with cartridge_map_prg()/cartridge_map_chr().
+*/
+
+#define PRG_PAGE_SIZE 0x2000
+#define CHR_PAGE_SIZE 0x0400
+
+// TV system a cartridge was made for, as in the NES 2.0 header
+typedef enum Region {
+    REGION_NTSC,
+    REGION_PAL,
+    REGION_MULTI,   // runs on either
+    REGION_DENDY
+} Region;
+
+typedef struct Cartridge Cartridge;
+
+// A mapper's behaviour. Any hook a mapper has no use for is left NULL.
+typedef struct Mapper{
+    uint16_t number; // iNES mapper number
+    const char* name;
+
+    // Put registers and banks into their power-on state
+    void (*reset)(Cartridge* cart);
+
+    // CPU accesses. Reads of $6000-$FFFF go straight through the bank pointers, so cpu_read only sees the
+    // expansion area ($4020-$5FFF). cpu_write sees everything from $4020 up except PRG RAM.
+    uint8_t (*cpu_read)(Cartridge* cart, uint16_t addr);
+    void (*cpu_write)(Cartridge* cart, uint16_t addr, uint8_t data);
+
+    // PPU accesses to pattern memory ($0000-$1FFF), for mappers that watch the PPU bus (e.g. MMC2's CHR latches)
+    void (*ppu_read)(Cartridge* cart, uint16_t addr);
+    void (*ppu_write)(Cartridge* cart, uint16_t addr, uint8_t data);
+
+    // Called once per scanline while rendering, at about the point MMC3 sees PPU A12 rise
+    void (*scanline)(Cartridge* cart);
+
+    // True while the mapper holds the CPU's IRQ line low
+    bool (*irq)(Cartridge* cart);
+} Mapper;
+
+struct Cartridge{
+    const Mapper* mapper;
+
+    // The ROM image (see load_rom()); PRG ROM and CHR ROM point into it
+    uint8_t* file;
+    size_t file_size;
+
+    uint8_t* prg_rom;
+    uint32_t prg_rom_size;
+    uint8_t* chr;               // CHR ROM, or CHR RAM if chr_ram is set
+    uint32_t chr_size;
+    bool chr_ram;
+    uint8_t* prg_ram;
+    uint32_t prg_ram_size;      // at least a whole page when there's any, as $6000-$7FFF is one page
+    bool battery;
+    Region region;
+
+    // With a battery, PRG RAM is the mapped save file (see save.h), which holds its first save_size bytes: the
+    // header's size, which can be less than the page prg_ram_size is rounded up to
+    char* save_path;
+    uint32_t save_size;
+    uint32_t save_frames;
+
+    // Arrangement wired on the board (from the header); mappers with mirroring control override it
+    Mirroring mirroring;
+
+    // CPU $6000-$FFFF in 8kB pages: [0] is PRG RAM ($6000), [1] - [4] are PRG ROM ($8000 - $E000).
+    // A NULL page reads as open bus.
+    uint8_t* prg_pages[5];
+    bool prg_ram_writable;
+
+    uint32_t bank_switches;     // cartridge_map_prg()/cartridge_map_chr() calls that changed a page
+
+    // Mapper registers; each mapper only uses its own
+    union{
+        // UxROM, CNROM, AxROM: a single bank register
+        uint8_t bank;
+
+        struct{
+            uint8_t shift;      // serial port; a 1 in bit 4 marks the register as full after 5 writes
+            uint8_t control;
+            uint8_t chr_bank[2];
+            uint8_t prg_bank;
+        } mmc1;
+
+        struct{
+            uint8_t bank_select;
+            uint8_t banks[8];   // R0 - R7
+            uint8_t irq_latch;
+            uint8_t irq_counter;
+            bool irq_reload;
+            bool irq_enabled;
+            bool irq_pending;
+        } mmc3;
+    };
+};
+
+// Mapper for an iNES mapper number, or NULL if it isn't supported
+const Mapper* mapper_find(uint16_t number);
+
+// Power on/reset: PRG RAM at $6000, header mirroring, then the mapper's own reset. nes.ppu must be set.
+void cartridge_reset(Cartridge* cart);
+// Writes out any battery save, then releases the ROM and RAM
+void cartridge_free(Cartridge* cart);
+
+// Point size kB of CPU space from addr ($8000 - $E000) at a PRG ROM bank, counted in units of size. Negative
+// banks count back from the last one (-1 is the last bank); banks past the end wrap, as the unused ROM address
+// lines would.
+void cartridge_map_prg(Cartridge* cart, uint16_t addr, int size, int bank);
+
+// As cartridge_map_prg(), for size kB of PPU space from addr ($0000 - $1C00)
+void cartridge_map_chr(Cartridge* cart, uint16_t addr, int size, int bank);
+
+void cartridge_set_mirroring(Cartridge* cart, Mirroring mirroring);
+
+static inline void cartridge_scanline(Cartridge* cart){
+    if(cart->mapper->scanline){
+        cart->mapper->scanline(cart);
+    }
+}
+
+static inline bool cartridge_irq(Cartridge* cart){
+    return cart->mapper->irq && cart->mapper->irq(cart);
+}
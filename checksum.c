@@ -0,0 +1,374 @@
+#include "checksum.h"
+
+#include <string.h>
+#include <stdbool.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* ------------------------------------ CRC32 ------------------------------------ */
+// crc_tables[0] is the usual byte-at-a-time table; crc_tables[n] advances a byte through n more zero bytes
+static uint32_t crc_tables[8][256];
+static bool crc_tables_ready = false;
+
+void crc32_init(){
+    if(crc_tables_ready){
+        return;
+    }
+
+    for(int i = 0; i < 256; i++){
+        uint32_t crc = i;
+        for(int bit = 0; bit < 8; bit++){
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+        }
+        crc_tables[0][i] = crc;
+    }
+
+    for(int i = 0; i < 256; i++){
+        for(int n = 1; n < 8; n++){
+            uint32_t previous = crc_tables[n - 1][i];
+            crc_tables[n][i] = (previous >> 8) ^ crc_tables[0][previous & 0xFF];
+        }
+    }
+
+    crc_tables_ready = true;
+}
+
+uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size){
+    crc32_init();
+    crc = ~crc;
+
+    // 8 bytes at a time: the 8 lookups are independent, so they overlap instead of forming one long chain
+    while(size >= 8){
+        uint32_t low = (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24) ^ crc;
+        uint32_t high = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+
+        crc = crc_tables[7][low & 0xFF] ^ crc_tables[6][(low >> 8) & 0xFF]
+            ^ crc_tables[5][(low >> 16) & 0xFF] ^ crc_tables[4][low >> 24]
+            ^ crc_tables[3][high & 0xFF] ^ crc_tables[2][(high >> 8) & 0xFF]
+            ^ crc_tables[1][(high >> 16) & 0xFF] ^ crc_tables[0][high >> 24];
+
+        data += 8;
+        size -= 8;
+    }
+
+    while(size--){
+        crc = (crc >> 8) ^ crc_tables[0][(crc ^ *data++) & 0xFF];
+    }
+
+    return ~crc;
+}
+
+/* ------------------------------------ SHA-1 ------------------------------------ */
+// As described in FIPS 180-4
+static inline uint32_t rotl32(uint32_t value, int bits){
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1_block(SHA1* sha, const uint8_t* block){
+    uint32_t w[80];
+    for(int i = 0; i < 16; i++){
+        w[i] = (uint32_t)block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for(int i = 16; i < 80; i++){
+        w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = sha->state[0], b = sha->state[1], c = sha->state[2], d = sha->state[3], e = sha->state[4];
+    for(int i = 0; i < 80; i++){
+        uint32_t f, k;
+        if(i < 20){
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if(i < 40){
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if(i < 60){
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else{
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        uint32_t temp = rotl32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl32(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    sha->state[0] += a;
+    sha->state[1] += b;
+    sha->state[2] += c;
+    sha->state[3] += d;
+    sha->state[4] += e;
+}
+
+void sha1_init(SHA1* sha){
+    sha->state[0] = 0x67452301;
+    sha->state[1] = 0xEFCDAB89;
+    sha->state[2] = 0x98BADCFE;
+    sha->state[3] = 0x10325476;
+    sha->state[4] = 0xC3D2E1F0;
+    sha->length = 0;
+}
+
+void sha1_update(SHA1* sha, const uint8_t* data, size_t size){
+    size_t used = sha->length % 64;
+    sha->length += size;
+
+    // Top up a partial block first
+    if(used > 0){
+        size_t take = (size < 64 - used) ? size : 64 - used;
+        memcpy(&sha->block[used], data, take);
+        data += take;
+        size -= take;
+        if(used + take < 64){
+            return;
+        }
+        sha1_block(sha, sha->block);
+    }
+
+    // Whole blocks straight from the input
+    while(size >= 64){
+        sha1_block(sha, data);
+        data += 64;
+        size -= 64;
+    }
+
+    memcpy(sha->block, data, size);
+}
+
+void sha1_final(SHA1* sha, uint8_t digest[20]){
+    uint64_t bits = sha->length * 8;
+
+    // Pad with a 1 bit, zeros, then the length in bits, to a whole block
+    uint8_t padding[72] = { 0x80 };
+    size_t used = sha->length % 64;
+    size_t pad = (used < 56) ? 56 - used : 120 - used;
+    for(int i = 0; i < 8; i++){
+        padding[pad + i] = bits >> (56 - i * 8);
+    }
+    sha1_update(sha, padding, pad + 8);
+
+    for(int i = 0; i < 20; i++){
+        digest[i] = sha->state[i / 4] >> (24 - (i % 4) * 8);
+    }
+}
+
+/* ------------------------------------ XXH3 ------------------------------------ */
+// Reference: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+#define XXH_PRIME32_1   0x9E3779B1U
+#define XXH_PRIME32_2   0x85EBCA77U
+#define XXH_PRIME32_3   0xC2B2AE3DU
+#define XXH_PRIME64_1   0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3   0x165667B19E3779F9ULL
+#define XXH_PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5   0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1   0x165667919E3779F9ULL
+#define XXH_PRIME_MX2   0x9FB21C651E98DF25ULL
+
+#define XXH_SECRET_SIZE     192
+#define XXH_STRIPE_SIZE     64
+#define XXH_STRIPES_PER_BLOCK ((XXH_SECRET_SIZE - XXH_STRIPE_SIZE) / 8)
+#define XXH_BLOCK_SIZE      (XXH_STRIPE_SIZE * XXH_STRIPES_PER_BLOCK)
+
+static const _Alignas(16) uint8_t xxh_secret[XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint32_t xxh_read32(const uint8_t* in){
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static inline uint64_t xxh_read64(const uint8_t* in){
+    return xxh_read32(in) | (uint64_t)xxh_read32(&in[4]) << 32;
+}
+
+static inline uint64_t rotl64(uint64_t value, int bits){
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t swap64(uint64_t value){
+    return __builtin_bswap64(value);
+}
+
+// Full 64x64 -> 128 bit product, high and low halves xored together
+static inline uint64_t xxh_mul128_fold64(uint64_t a, uint64_t b){
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 product = (unsigned __int128)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hi_hi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    uint64_t high = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    uint64_t low = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return low ^ high;
+#endif
+}
+
+static inline uint64_t xxh64_avalanche(uint64_t h){
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    return h ^ (h >> 32);
+}
+
+static inline uint64_t xxh3_avalanche(uint64_t h){
+    h ^= h >> 37;
+    h *= XXH_PRIME_MX1;
+    return h ^ (h >> 32);
+}
+
+static inline uint64_t xxh3_rrmxmx(uint64_t h, uint64_t size){
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= XXH_PRIME_MX2;
+    h ^= (h >> 35) + size;
+    h *= XXH_PRIME_MX2;
+    return h ^ (h >> 28);
+}
+
+static inline uint64_t xxh3_mix16(const uint8_t* in, const uint8_t* secret){
+    return xxh_mul128_fold64(xxh_read64(in) ^ xxh_read64(secret), xxh_read64(&in[8]) ^ xxh_read64(&secret[8]));
+}
+
+// Inputs of 0 - 240 bytes
+static uint64_t xxh3_short(const uint8_t* in, size_t size){
+    const uint8_t* secret = xxh_secret;
+
+    if(size == 0){
+        return xxh64_avalanche(xxh_read64(&secret[56]) ^ xxh_read64(&secret[64]));
+    }
+    if(size <= 3){
+        uint32_t combined = (uint32_t)in[0] << 16 | (uint32_t)in[size >> 1] << 24 | in[size - 1] | (uint32_t)size << 8;
+        uint64_t keyed = combined ^ (uint64_t)(xxh_read32(secret) ^ xxh_read32(&secret[4]));
+        return xxh64_avalanche(keyed);
+    }
+    if(size <= 8){
+        uint64_t input = xxh_read32(&in[size - 4]) + ((uint64_t)xxh_read32(in) << 32);
+        return xxh3_rrmxmx(input ^ (xxh_read64(&secret[8]) ^ xxh_read64(&secret[16])), size);
+    }
+    if(size <= 16){
+        uint64_t low = xxh_read64(in) ^ (xxh_read64(&secret[24]) ^ xxh_read64(&secret[32]));
+        uint64_t high = xxh_read64(&in[size - 8]) ^ (xxh_read64(&secret[40]) ^ xxh_read64(&secret[48]));
+        return xxh3_avalanche(size + swap64(low) + high + xxh_mul128_fold64(low, high));
+    }
+
+    uint64_t acc = size * XXH_PRIME64_1;
+    if(size <= 128){
+        // Pairs of 16 byte blocks from either end, meeting in the middle
+        if(size > 32){
+            if(size > 64){
+                if(size > 96){
+                    acc += xxh3_mix16(&in[48], &secret[96]);
+                    acc += xxh3_mix16(&in[size - 64], &secret[112]);
+                }
+                acc += xxh3_mix16(&in[32], &secret[64]);
+                acc += xxh3_mix16(&in[size - 48], &secret[80]);
+            }
+            acc += xxh3_mix16(&in[16], &secret[32]);
+            acc += xxh3_mix16(&in[size - 32], &secret[48]);
+        }
+        acc += xxh3_mix16(in, secret);
+        acc += xxh3_mix16(&in[size - 16], &secret[16]);
+        return xxh3_avalanche(acc);
+    }
+
+    int rounds = size / 16;
+    for(int i = 0; i < 8; i++){
+        acc += xxh3_mix16(&in[16 * i], &secret[16 * i]);
+    }
+    acc = xxh3_avalanche(acc);
+    for(int i = 8; i < rounds; i++){
+        acc += xxh3_mix16(&in[16 * i], &secret[16 * (i - 8) + 3]);
+    }
+    acc += xxh3_mix16(&in[size - 16], &secret[136 - 17]);
+    return xxh3_avalanche(acc);
+}
+
+// One 64 byte stripe into the eight lanes
+static inline void xxh3_accumulate(uint64_t* acc, const uint8_t* in, const uint8_t* secret){
+#ifdef __SSE2__
+    for(int i = 0; i < 4; i++){
+        __m128i data = _mm_loadu_si128((const __m128i*)&in[16 * i]);
+        __m128i key = _mm_xor_si128(data, _mm_loadu_si128((const __m128i*)&secret[16 * i]));
+        // Each lane's low 32 bits times its high 32 bits, plus the neighbouring lane's input
+        __m128i product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+        __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        __m128i* lanes = (__m128i*)&acc[2 * i];
+        _mm_store_si128(lanes, _mm_add_epi64(product, _mm_add_epi64(_mm_load_si128(lanes), swapped)));
+    }
+#else
+    for(int i = 0; i < 8; i++){
+        uint64_t data = xxh_read64(&in[8 * i]);
+        uint64_t key = data ^ xxh_read64(&secret[8 * i]);
+        acc[i ^ 1] += data;
+        acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+    }
+#endif
+}
+
+// Between blocks, so no lane's bits pile up
+static inline void xxh3_scramble(uint64_t* acc, const uint8_t* secret){
+    for(int i = 0; i < 8; i++){
+        uint64_t lane = acc[i];
+        lane ^= lane >> 47;
+        lane ^= xxh_read64(&secret[8 * i]);
+        acc[i] = lane * XXH_PRIME32_1;
+    }
+}
+
+static uint64_t xxh3_long(const uint8_t* in, size_t size){
+    _Alignas(16) uint64_t acc[8] = {
+        XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+    };
+
+    // Whole blocks; the last one is handled below even if it's full
+    size_t blocks = (size - 1) / XXH_BLOCK_SIZE;
+    for(size_t block = 0; block < blocks; block++){
+        for(int stripe = 0; stripe < XXH_STRIPES_PER_BLOCK; stripe++){
+            xxh3_accumulate(acc, &in[block * XXH_BLOCK_SIZE + stripe * XXH_STRIPE_SIZE], &xxh_secret[stripe * 8]);
+        }
+        xxh3_scramble(acc, &xxh_secret[XXH_SECRET_SIZE - XXH_STRIPE_SIZE]);
+    }
+
+    // The last block's whole stripes, then the final 64 bytes (overlapping what came before)
+    const uint8_t* tail = &in[blocks * XXH_BLOCK_SIZE];
+    int stripes = ((size - 1) - blocks * XXH_BLOCK_SIZE) / XXH_STRIPE_SIZE;
+    for(int stripe = 0; stripe < stripes; stripe++){
+        xxh3_accumulate(acc, &tail[stripe * XXH_STRIPE_SIZE], &xxh_secret[stripe * 8]);
+    }
+    xxh3_accumulate(acc, &in[size - XXH_STRIPE_SIZE], &xxh_secret[XXH_SECRET_SIZE - XXH_STRIPE_SIZE - 7]);
+
+    uint64_t result = size * XXH_PRIME64_1;
+    for(int i = 0; i < 4; i++){
+        const uint8_t* secret = &xxh_secret[11 + 16 * i];
+        result += xxh_mul128_fold64(acc[2 * i] ^ xxh_read64(secret), acc[2 * i + 1] ^ xxh_read64(&secret[8]));
+    }
+    return xxh3_avalanche(result);
+}
+
+uint64_t xxh3(const uint8_t* data, size_t size){
+    return (size <= 240) ? xxh3_short(data, size) : xxh3_long(data, size);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* ------------------------------------ CRC32 ------------------------------------ */
+// Standard (zlib/PNG/No-Intro) CRC32. Slice-by-8: eight table lookups per 8 bytes instead of one per byte.
+
+// Builds the lookup tables. Call once before using crc32() from more than one thread.
+void crc32_init();
+
+// Continue a CRC over more data; start with crc = 0
+uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size);
+
+/* ------------------------------------ SHA-1 ------------------------------------ */
+typedef struct SHA1{
+    uint32_t state[5];
+    uint64_t length;        // bytes hashed so far
+    uint8_t block[64];      // partial block waiting for more data
+} SHA1;
+
+void sha1_init(SHA1* sha);
+void sha1_update(SHA1* sha, const uint8_t* data, size_t size);
+void sha1_final(SHA1* sha, uint8_t digest[20]);
+
+/* ------------------------------------ XXH3 ------------------------------------ */
+// XXH3-64 (xxHash 0.8, seed 0, default secret): a fast non-cryptographic hash, for telling states apart.
+// Long inputs are hashed 64 bytes at a time across eight independent lanes, two per SSE2 register where available.
+uint64_t xxh3(const uint8_t* data, size_t size);
@@ -0,0 +1,26 @@
+#include "controller.h"
+
+void controller_init(Controller* controller){
+    controller->strobe = false;
+    controller->shift = 0;
+}
+
+void controller_write(Controller* controller, uint8_t data, uint8_t buttons){
+    // Loaded while the strobe is high, so writing 0 leaves the buttons as they were at that moment
+    if(controller->strobe || (data & 1)){
+        controller->shift = buttons;
+    }
+    controller->strobe = data & 1;
+}
+
+uint8_t controller_read(Controller* controller, uint8_t buttons){
+    if(controller->strobe){
+        // Reloading constantly, so always the first button
+        return CONTROLLER_OPEN_BUS | (buttons & 1);
+    }
+
+    uint8_t bit = controller->shift & 1;
+    // A 4021 fills in behind with 1s
+    controller->shift = (controller->shift >> 1) | 0x80;
+    return CONTROLLER_OPEN_BUS | bit;
+}
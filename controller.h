@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*  Standard NES controller: an 8-bit parallel-in/serial-out shift register on $4016 (port 1) or $4017 (port 2).
+
+    Writing 1 to bit 0 of $4016 (the strobe, shared by both ports) loads the buttons into the shift register
+    continuously; writing 0 freezes them there. Each read returns the next button in bit 0, in the order A, B,
+    Select, Start, Up, Down, Left, Right, and 1s once all eight are out. While the strobe is held every read
+    returns A.
+*/
+
+// Bits 1-7 aren't driven by the controller; the last byte on the bus ($40, from the address) shows through
+#define CONTROLLER_OPEN_BUS 0x40
+
+typedef struct Controller{
+    bool strobe;
+    uint8_t shift;  // buttons still to be read, next in bit 0
+} Controller;
+
+void controller_init(Controller* controller);
+
+// $4016 write, with the host's current buttons for this port
+void controller_write(Controller* controller, uint8_t data, uint8_t buttons);
+
+// $4016/$4017 read; the shift register moves on unless strobed
+uint8_t controller_read(Controller* controller, uint8_t buttons);
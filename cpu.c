@@ -1,13 +1,14 @@
 #include "cpu.h"
 #include "ops.h"
 #include "system.h"
+#include "profile.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
 void cpu_init(CPU* cpu){
-    memset(cpu->memory, 0, sizeof(cpu->memory));
+    memset(cpu->ram, 0, sizeof(cpu->ram));
     cpu->a = 0;
     cpu->x = 0;
     cpu->y = 0;
@@ -16,8 +17,11 @@ void cpu_init(CPU* cpu){
     cpu->p = 0x24;
 
     cpu->cycles = 7;
+    cpu->stall = 0;
 
-    bool nmi = false;
+    cpu->nmi = false;
+    cpu->irq = false;
+    cpu->trace = false;
 
     cpu->addr_extra_cycle = false;
     cpu->instr_extra_cycle = false;
@@ -30,6 +34,22 @@ int cpu_step(CPU* cpu){
         NMI();
         cpu->cycles += 7;
         cpu->nmi = false;
+#ifdef UNICOM_PROFILER
+        if(profile != NULL){
+            profile_interrupt(cpu, PROFILE_NMI, 7);
+        }
+#endif
+        return 7;
+    }
+
+    if(cpu->irq && !check_flag(cpu, FLAG_I)){
+        IRQ();
+        cpu->cycles += 7;
+#ifdef UNICOM_PROFILER
+        if(profile != NULL){
+            profile_interrupt(cpu, PROFILE_IRQ, 7);
+        }
+#endif
         return 7;
     }
 
@@ -37,15 +57,20 @@ int cpu_step(CPU* cpu){
     int cpu_step_cycles = 0;
 
     // Get basic data about current opcode
-    uint8_t opcode = cpu->memory[cpu->pc];
+#ifdef UNICOM_PROFILER
+    uint16_t pc = cpu->pc;
+#endif
+    uint8_t opcode = read(cpu->pc);
     
     Op* op = get_op_data(opcode);
     Mode addr_mode = op->mode;
 
     // print debug information
-    disassemble_op(cpu, op);
-    printf("\tA:%.2X X:%.2X Y:%.2X P:%.2X SP:%.2X ", cpu->a, cpu->x, cpu->y, cpu->p, cpu->s);
-    printf(" Cycles: %d ", cpu->cycles);
+    if(cpu->trace){
+        disassemble_op(cpu, op);
+        printf("\tA:%.2X X:%.2X Y:%.2X P:%.2X SP:%.2X ", cpu->a, cpu->x, cpu->y, cpu->p, cpu->s);
+        printf(" Cycles: %u ", cpu->cycles);
+    }
 
     cpu->pc++;
     
@@ -221,8 +246,25 @@ int cpu_step(CPU* cpu){
     cpu->addr_extra_cycle = false;
     cpu->instr_extra_cycle = false;
 
-    printf("\n");
-    fflush(stdout);
+    // DMA started by this instruction. It has to begin on an even cycle, so an odd one costs one more to align.
+    // The parity comes from the system clock, which this instruction's cycles haven't been added to yet.
+    if(cpu->stall){
+        int stall = cpu->stall + ((nes.cycles + cpu_step_cycles) & 1);
+        cpu->cycles += stall;
+        cpu_step_cycles += stall;
+        cpu->stall = 0;
+    }
+
+    if(cpu->trace){
+        printf("\n");
+        fflush(stdout);
+    }
+
+#ifdef UNICOM_PROFILER
+    if(profile != NULL){
+        profile_instruction(cpu, pc, opcode, cpu_step_cycles);
+    }
+#endif
 
     return cpu_step_cycles;
 }
@@ -281,15 +323,15 @@ void handle_flag_n(CPU* cpu, uint8_t val){
 
 /* ----------------------------------- Stack handling ----------------------------------- */
 void stack_push(CPU* cpu, uint8_t val){
-    cpu->memory[0x0100 + cpu->s] = val;
+    cpu->ram[0x0100 + cpu->s] = val;
     cpu->s--;
 }
 
 uint8_t stack_pull(CPU* cpu){
     cpu->s++;
-    uint8_t val = cpu->memory[0x0100 + cpu->s];
+    uint8_t val = cpu->ram[0x0100 + cpu->s];
     /*printf("\nPulling from stack: %.2X. Prev stack val: %.2X Next stack val: %.2X\n",
-        cpu->memory[0x0100 + cpu->s], cpu->memory[0x0100 + cpu->s - 1], cpu->memory[0x0100 + cpu->s + 1]);*/
+        cpu->ram[0x0100 + cpu->s], cpu->ram[0x0100 + cpu->s - 1], cpu->ram[0x0100 + cpu->s + 1]);*/
     
     return val;
 }
@@ -298,7 +340,7 @@ uint8_t stack_pull(CPU* cpu){
 // Absolute
 uint16_t addr_abs(CPU* cpu){
     cpu->pc += 2;
-    return cpu->memory[cpu->pc - 2] | cpu->memory[cpu->pc - 1] << 8;
+    return read(cpu->pc - 2) | read(cpu->pc - 1) << 8;
 }
 
 // Absolute (X indexed)
@@ -334,7 +376,7 @@ uint16_t addr_acc(CPU* cpu){
 
 // Immediate
 uint16_t addr_imm(CPU* cpu){
-    //printf("\naddr: %.4X val: %.2X\n", cpu->pc + 1, cpu->memory[cpu->pc + 1]);
+    //printf("\naddr: %.4X val: %.2X\n", cpu->pc + 1, read(cpu->pc + 1));
     return cpu->pc++;
 }
 
@@ -412,26 +454,26 @@ uint16_t addr_iny(CPU* cpu){
 
 // Relative - adjusts PC by a given signed +/- offset
 uint16_t addr_rel(CPU* cpu){
-    int8_t offset = cpu->memory[cpu->pc++];
+    int8_t offset = read(cpu->pc++);
     
     return cpu->pc + offset;
 }
 
 // Zero Page
 uint8_t addr_zpg(CPU* cpu){
-    uint16_t addr = cpu->memory[cpu->pc++] & 0x00FF;
+    uint16_t addr = read(cpu->pc++) & 0x00FF;
     return addr;
 }
 
 // Zero Page (X indexed)
 uint8_t addr_zpx(CPU* cpu){
-    uint16_t addr = (cpu->memory[cpu->pc++] + cpu->x) & 0x00FF;
+    uint16_t addr = (read(cpu->pc++) + cpu->x) & 0x00FF;
     return addr;
 }
 
 // Zero Page (Y indexed)
 uint8_t addr_zpy(CPU* cpu){
-    uint16_t addr = (cpu->memory[cpu->pc++] + cpu->y) & 0x00FF;
+    uint16_t addr = (read(cpu->pc++) + cpu->y) & 0x00FF;
     return addr;
 }
 
@@ -642,7 +684,7 @@ void print_disassembly(CPU* cpu, bool dump){
     bool running = true;
 
     while(running){
-        uint8_t opcode = cpu->memory[cpu->pc];
+        uint8_t opcode = read(cpu->pc);
         cpu->pc++;
 
         Op *opdata = get_op_data(opcode);
@@ -752,11 +794,22 @@ void NMI(){
     // Push status to stack
     stack_push(nes.cpu, nes.cpu->p);
     
-    // Read from NMI vector
-    read16(nes.cpu, 0xFFFA);
+    // Jump to the address in the NMI vector
+    nes.cpu->pc = read16(nes.cpu, 0xFFFA);
 
     // Set Interrupt Disable flag
     set_flag(nes.cpu, FLAG_I);
-    printf("NMI!\n");
 
+}
+
+void IRQ(){
+    // As NMI, but through the IRQ/BRK vector, and the pushed status has the B flag clear
+    stack_push(nes.cpu, (nes.cpu->pc >> 8));
+    stack_push(nes.cpu, (nes.cpu->pc) & 0xff);
+
+    stack_push(nes.cpu, nes.cpu->p & ~(0x1 << FLAG_B));
+
+    nes.cpu->pc = read16(nes.cpu, 0xFFFE);
+
+    set_flag(nes.cpu, FLAG_I);
 }
\ No newline at end of file
@@ -28,7 +28,8 @@ typedef struct Op{
 } Op;
 
 typedef struct CPU{
-    uint8_t memory[0xffff];
+    // 2kB internal RAM. Everything else the CPU sees is reached through read()/write().
+    uint8_t ram[0x0800];
 
     // Accumulator
     uint8_t a;
@@ -46,10 +47,17 @@ typedef struct CPU{
     // Processor Status Register 
     uint8_t p;
 
-    // Number of cycles taken
-    int cycles;
+    // Number of cycles taken, wrapping around; nes.cycles is the clock the PPU, APU and DMA timing go by
+    uint32_t cycles;
+
+    // Cycles the CPU is halted for by DMA during the current instruction; cpu_step() adds them to its total
+    int stall;
 
     bool nmi;
+    bool irq; // state of the (level triggered) IRQ line, set by whatever is holding it
+
+    // Print each instruction as it is executed (very slow)
+    bool trace;
 
     // helper values used to determine if the combination of addressing mode and instruction
     // will lead to an extra clock cycle being used up
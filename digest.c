@@ -0,0 +1,256 @@
+#include "digest.h"
+#include "system.h"
+#include "checksum.h"
+#include "rom.h"
+#include "state.h"
+
+#include <string.h>
+#include <stddef.h>
+
+static void put32(uint8_t* out, uint32_t value){
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+static void put64(uint8_t* out, uint64_t value){
+    put32(out, value);
+    put32(&out[4], value >> 32);
+}
+
+static uint32_t get32(const uint8_t* in){
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static uint64_t get64(const uint8_t* in){
+    return get32(in) | (uint64_t)get32(&in[4]) << 32;
+}
+
+uint64_t digest_frame(const uint8_t* framebuffer){
+    return xxh3(framebuffer, FRAME_WIDTH * FRAME_HEIGHT);
+}
+
+// Registers and counters, gathered with no padding left undefined
+typedef struct Digest_Registers{
+    uint64_t cycles;
+    uint32_t cpu_cycles;
+    uint8_t a, x, y, s, p;
+    uint16_t pc;
+    bool nmi, irq;
+
+    uint64_t dots;
+    int32_t ppu_cycles, ppu_scanline;
+    uint8_t ppuctrl, ppumask, ppustatus, oamaddr, read_buffer, fine_x;
+    uint16_t v, t;
+    bool w, nmi_occurred;
+    uint8_t mirroring;
+    uint32_t ppu_pages[16];
+
+    uint32_t prg_pages[5];
+    bool prg_ram_writable;
+    uint8_t mapper[sizeof(((Cartridge*)0)->mmc3)];  // the mapper register union (MMC3's is the largest)
+
+    uint8_t controller_shift[2];
+    bool controller_strobe[2];
+} Digest_Registers;
+
+uint64_t digest_state(){
+    CPU* cpu = nes.cpu;
+    PPU* ppu = nes.ppu;
+    Cartridge* cart = nes.cart;
+
+    Digest_Registers registers;
+    memset(&registers, 0, sizeof(registers));
+    registers.cycles = nes.cycles;
+    registers.cpu_cycles = cpu->cycles;
+    registers.a = cpu->a;
+    registers.x = cpu->x;
+    registers.y = cpu->y;
+    registers.s = cpu->s;
+    registers.p = cpu->p;
+    registers.pc = cpu->pc;
+    registers.nmi = cpu->nmi;
+    registers.irq = cpu->irq;
+
+    registers.dots = ppu->dots;
+    registers.ppu_cycles = ppu->ppu_cycles;
+    registers.ppu_scanline = ppu->ppu_scanline;
+    registers.ppuctrl = ppu->reg_ppuctrl;
+    registers.ppumask = ppu->reg_ppumask;
+    registers.ppustatus = ppu->reg_ppustatus;
+    registers.oamaddr = ppu->reg_oamaddr;
+    registers.read_buffer = ppu->ppu_read_buffer;
+    registers.fine_x = ppu->fine_x;
+    registers.v = ppu->v;
+    registers.t = ppu->t;
+    registers.w = ppu->w;
+    registers.nmi_occurred = ppu->nmi_occurred;
+    registers.mirroring = ppu->mirroring;
+    for(int i = 0; i < 16; i++){
+        registers.ppu_pages[i] = state_pointer_offset(ppu->pages[i]);
+    }
+
+    for(int i = 0; i < 5; i++){
+        registers.prg_pages[i] = state_pointer_offset(cart->prg_pages[i]);
+    }
+    registers.prg_ram_writable = cart->prg_ram_writable;
+    memcpy(registers.mapper, &cart->mmc3, sizeof(registers.mapper));
+
+    // The controllers as the game sees them, so an input divergence shows on the frame it happens rather than when
+    // the game acts on it. The host's buttons aren't machine state: recording and playback update them at
+    // different times between polls.
+    for(int i = 0; i < 2; i++){
+        registers.controller_shift[i] = nes.controllers[i].shift;
+        registers.controller_strobe[i] = nes.controllers[i].strobe;
+    }
+
+    // Each memory is hashed on its own, then the hashes together
+    uint64_t parts[8];
+    int count = 0;
+    parts[count++] = xxh3((const uint8_t*)&registers, sizeof(registers));
+    parts[count++] = xxh3(cpu->ram, sizeof(cpu->ram));
+    parts[count++] = xxh3(ppu->vram, sizeof(ppu->vram));
+    parts[count++] = xxh3(ppu->palette, sizeof(ppu->palette));
+    parts[count++] = xxh3(ppu->oam, sizeof(ppu->oam));
+    // The APU up to its output level (zeroed by apu_init(), so padding is stable); the audio buffers aren't state
+    parts[count++] = xxh3((const uint8_t*)nes.apu, offsetof(APU, output));
+    parts[count++] = cart->prg_ram ? xxh3(cart->prg_ram, cart->prg_ram_size) : 0;
+    parts[count++] = cart->chr_ram ? xxh3(cart->chr, cart->chr_size) : 0;
+
+    return xxh3((const uint8_t*)parts, sizeof(parts));
+}
+
+int digest_log_open(Digest_Log* log, const char* path, const Cartridge* cart, uint32_t first_frame){
+    log->frames = 0;
+    log->file = fopen(path, "wb");
+    if(log->file == NULL){
+        printf("ERROR! Couldn't create digest log '%s'.\n", path);
+        return 1;
+    }
+
+    uint8_t header[DIGEST_HEADER_SIZE] = { 0 };
+    memcpy(header, DIGEST_MAGIC, 4);
+    put32(&header[4], DIGEST_VERSION);
+    put32(&header[8], crc32(0, cart->file, cart->file_size));
+    put32(&header[12], first_frame);
+    fwrite(header, 1, sizeof(header), log->file);
+    return 0;
+}
+
+void digest_log_frame(Digest_Log* log, const uint8_t* framebuffer){
+    uint8_t record[DIGEST_RECORD_SIZE];
+    put64(&record[0], framebuffer ? digest_frame(framebuffer) : 0);
+    put64(&record[8], digest_state());
+    fwrite(record, 1, sizeof(record), log->file);
+    log->frames++;
+}
+
+void digest_log_close(Digest_Log* log){
+    if(log->file != NULL){
+        fclose(log->file);
+        log->file = NULL;
+    }
+}
+
+static const uint8_t* digest_map(const char* path, size_t* frames, size_t* size){
+    uint8_t* data = rom_map_file(path, size);
+    if(data == NULL){
+        printf("ERROR! Couldn't open digest log '%s'.\n", path);
+        return NULL;
+    }
+    if(*size < DIGEST_HEADER_SIZE || memcmp(data, DIGEST_MAGIC, 4) != 0 || get32(&data[4]) != DIGEST_VERSION){
+        printf("ERROR! '%s' is not a digest log (or is from another version).\n", path);
+        rom_unmap_file(data, *size);
+        return NULL;
+    }
+    *frames = (*size - DIGEST_HEADER_SIZE) / DIGEST_RECORD_SIZE;
+    return data;
+}
+
+int digest_diverge(const char* path_a, const char* path_b, Digest_Divergence* result){
+    size_t size_a, size_b, frames_a, frames_b;
+    const uint8_t* a = digest_map(path_a, &frames_a, &size_a);
+    const uint8_t* b = digest_map(path_b, &frames_b, &size_b);
+    if(a == NULL || b == NULL){
+        if(a != NULL){
+            rom_unmap_file((uint8_t*)a, size_a);
+        }
+        if(b != NULL){
+            rom_unmap_file((uint8_t*)b, size_b);
+        }
+        return 1;
+    }
+
+    if(get32(&a[8]) != get32(&b[8])){
+        printf("Warning: the logs are from different ROMs (CRC32 %.8X and %.8X)\n", get32(&a[8]), get32(&b[8]));
+    }
+
+    // Only the frames both logs cover are compared
+    uint32_t first_a = get32(&a[12]), first_b = get32(&b[12]);
+    uint32_t first = (first_a > first_b) ? first_a : first_b;
+    uint64_t end_a = first_a + frames_a, end_b = first_b + frames_b;
+    uint64_t end = (end_a < end_b) ? end_a : end_b;
+    size_t frames = (end > first) ? end - first : 0;
+    const uint8_t* record_a = &a[DIGEST_HEADER_SIZE + (first - first_a) * DIGEST_RECORD_SIZE];
+    const uint8_t* record_b = &b[DIGEST_HEADER_SIZE + (first - first_b) * DIGEST_RECORD_SIZE];
+
+    result->first = first;
+    result->frames = frames;
+    result->end_a = end_a;
+    result->end_b = end_b;
+    result->frame = -1;
+    result->picture = false;
+    result->state = false;
+
+    // Identical stretches go at memcmp() speed; only the frames with any difference are looked at closely
+    size_t frame = 0;
+    while(frame < frames && result->frame < 0){
+        size_t chunk = (frames - frame < 4096) ? frames - frame : 4096;
+        if(memcmp(&record_a[frame * DIGEST_RECORD_SIZE], &record_b[frame * DIGEST_RECORD_SIZE],
+            chunk * DIGEST_RECORD_SIZE) == 0){
+            frame += chunk;
+            continue;
+        }
+
+        for(size_t end = frame + chunk; frame < end; frame++){
+            const uint8_t* ra = &record_a[frame * DIGEST_RECORD_SIZE];
+            const uint8_t* rb = &record_b[frame * DIGEST_RECORD_SIZE];
+            uint64_t picture_a = get64(ra), picture_b = get64(rb);
+            result->picture = picture_a != 0 && picture_b != 0 && picture_a != picture_b;
+            result->state = get64(&ra[8]) != get64(&rb[8]);
+            if(result->picture || result->state){
+                result->frame = first + frame;
+                break;
+            }
+        }
+    }
+
+    rom_unmap_file((uint8_t*)a, size_a);
+    rom_unmap_file((uint8_t*)b, size_b);
+    return 0;
+}
+
+int digest_compare(const char* path_a, const char* path_b){
+    Digest_Divergence result;
+    if(digest_diverge(path_a, path_b, &result) != 0){
+        return 2;
+    }
+
+    if(result.frame >= 0){
+        printf("First divergence at frame %lld (%s differ%s)\n", (long long)result.frame,
+            (result.picture && result.state) ? "picture and state" : result.picture ? "picture" : "state",
+            (result.picture && result.state) ? "" : "s");
+        return 1;
+    }
+
+    // A run that stopped (or crashed) early hasn't matched the other one
+    if(result.end_a != result.end_b){
+        printf("Identical for frames %u - %llu, then '%s' stops (%llu vs %llu frames)\n", result.first,
+            (unsigned long long)result.first + result.frames - 1, (result.end_a < result.end_b) ? path_a : path_b,
+            (unsigned long long)result.end_a, (unsigned long long)result.end_b);
+        return 1;
+    }
+    printf("Identical: frames %u - %llu\n", result.first, (unsigned long long)result.first + result.frames - 1);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "cartridge.h"
+
+/*  Per-frame digests, for checking that a change to the emulator hasn't changed what it emulates. After each frame
+    two 64-bit XXH3 hashes are logged: one of the picture, one of the whole machine state (CPU registers and RAM,
+    PPU memory, OAM and registers, the APU's channels, and the cartridge's RAM, banks and mapper registers). Two
+    runs of the same movie then agree frame for frame, and comparing their logs gives the first frame they don't,
+    without keeping a trace of either.
+
+    File layout (all integers little-endian):
+        Header      magic "UNCD", version (u32), ROM crc32 (u32), first frame (u32)
+        Frames      DIGEST_RECORD_SIZE bytes each: picture hash, state hash (u64 each). A picture hash of 0
+                    means the frame wasn't drawn (frameskip) and isn't compared.
+*/
+
+#define DIGEST_MAGIC        "UNCD"
+#define DIGEST_VERSION      3
+#define DIGEST_HEADER_SIZE  16
+#define DIGEST_RECORD_SIZE  16
+
+typedef struct Digest_Log{
+    FILE* file;
+    uint32_t frames;
+} Digest_Log;
+
+// Hash of the frame as it would be shown (NES colour indices)
+uint64_t digest_frame(const uint8_t* framebuffer);
+
+// Hash of everything the emulation's future depends on (host pointers are hashed as offsets, see state.h)
+uint64_t digest_state();
+
+// first_frame is the number of the first frame logged (0 unless the run starts from a saved state).
+// Returns 0 on success.
+int digest_log_open(Digest_Log* log, const char* path, const Cartridge* cart, uint32_t first_frame);
+
+// Log the frame just run. framebuffer is what it drew, or NULL if it wasn't drawn.
+void digest_log_frame(Digest_Log* log, const uint8_t* framebuffer);
+void digest_log_close(Digest_Log* log);
+
+typedef struct Digest_Divergence{
+    uint32_t first;     // first frame both logs have
+    uint32_t frames;    // frames both logs have
+    uint64_t end_a;     // one past the last frame of each log
+    uint64_t end_b;
+    int64_t frame;      // first frame that differs, or -1
+    bool picture;       // what differs in it
+    bool state;
+} Digest_Divergence;
+
+// Compare the frames two logs have in common (where each ends is left to the caller). Returns 0 on success, 1 if
+// either can't be read.
+int digest_diverge(const char* path_a, const char* path_b, Digest_Divergence* result);
+
+// Compare two logs and report the first frame where they differ, or that one stops before the other. Returns 0 if
+// they agree, 1 if they diverge, 2 if either can't be read.
+int digest_compare(const char* path_a, const char* path_b);
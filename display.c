@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "display.h"
+
+// Standard 2C02 palette
+const uint32_t nes_palette[64] = {
+    0xFF666666, 0xFF002A88, 0xFF1412A7, 0xFF3B00A4, 0xFF5C007E, 0xFF6E0040, 0xFF6C0600, 0xFF561D00,
+    0xFF333500, 0xFF0B4800, 0xFF005200, 0xFF004F08, 0xFF00404D, 0xFF000000, 0xFF000000, 0xFF000000,
+    0xFFADADAD, 0xFF155FD9, 0xFF4240FF, 0xFF7527FE, 0xFFA01ACC, 0xFFB71E7B, 0xFFB53120, 0xFF994E00,
+    0xFF6B6D00, 0xFF388700, 0xFF0C9300, 0xFF008F32, 0xFF007C8D, 0xFF000000, 0xFF000000, 0xFF000000,
+    0xFFFFFEFF, 0xFF64B0FF, 0xFF9290FF, 0xFFC676FF, 0xFFF36AFF, 0xFFFE6ECC, 0xFFFE8170, 0xFFEA9E22,
+    0xFFBCBE00, 0xFF88D800, 0xFF5CE430, 0xFF45E082, 0xFF48CDDE, 0xFF4F4F4F, 0xFF000000, 0xFF000000,
+    0xFFFFFEFF, 0xFFC0DFFF, 0xFFD3D2FF, 0xFFE8C8FF, 0xFFFBC2FF, 0xFFFEC4EA, 0xFFFECCC5, 0xFFF7D8A5,
+    0xFFE4E594, 0xFFCFEF96, 0xFFBDF4AB, 0xFFB3F3CC, 0xFFB5EBF2, 0xFFB8B8B8, 0xFF000000, 0xFF000000
+};
+
+// Scratch space for the debug views, which are drawn as NES colour indices like a normal frame
+static uint8_t debug_buffer[NAMETABLE_VIEW_WIDTH * NAMETABLE_VIEW_HEIGHT];
+
+int display_init(Display* display, int scale, bool vsync){
+    memset(display, 0, sizeof(Display));
+    display->scale = scale;
+    display->vsync = vsync;
+
+    if(SDL_Init(SDL_INIT_VIDEO) != 0){
+        printf("ERROR! Failed to initialise SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    display->window = SDL_CreateWindow("unicom", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        FRAME_WIDTH * scale, FRAME_HEIGHT * scale, SDL_WINDOW_RESIZABLE);
+    if(display->window == NULL){
+        printf("ERROR! Failed to create window: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    Uint32 flags = SDL_RENDERER_ACCELERATED;
+    if(vsync){
+        flags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+
+    display->renderer = SDL_CreateRenderer(display->window, -1, flags);
+    if(display->renderer == NULL){
+        printf("ERROR! Failed to create renderer: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    display->frame_texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING, FRAME_WIDTH, FRAME_HEIGHT);
+    display->pattern_texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING, PATTERN_TABLE_WIDTH * 2, PATTERN_TABLE_HEIGHT);
+    display->nametable_texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING, NAMETABLE_VIEW_WIDTH, NAMETABLE_VIEW_HEIGHT);
+
+    if(display->frame_texture == NULL || display->pattern_texture == NULL || display->nametable_texture == NULL){
+        printf("ERROR! Failed to create textures: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    display_set_view(display, VIEW_FRAME);
+    return 0;
+}
+
+void display_set_view(Display* display, Display_View view){
+    int width = FRAME_WIDTH;
+    int height = FRAME_HEIGHT;
+
+    switch(view){
+        case VIEW_FRAME:            width = FRAME_WIDTH;              height = FRAME_HEIGHT;            break;
+        case VIEW_PATTERN_TABLES:   width = PATTERN_TABLE_WIDTH * 2;  height = PATTERN_TABLE_HEIGHT;    break;
+        case VIEW_NAMETABLES:       width = NAMETABLE_VIEW_WIDTH;     height = NAMETABLE_VIEW_HEIGHT;   break;
+    }
+
+    display->view = view;
+
+    // Let the renderer do the scaling, snapped to whole multiples so pixels stay square
+    SDL_RenderSetLogicalSize(display->renderer, width, height);
+    SDL_RenderSetIntegerScale(display->renderer, SDL_TRUE);
+    SDL_SetWindowSize(display->window, width * display->scale, height * display->scale);
+}
+
+// Convert indexed pixels to ARGB directly inside the locked texture
+static void upload_indexed(SDL_Texture* texture, const uint8_t* src, int width, int height){
+    void* pixels;
+    int pitch;
+
+    if(SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0){
+        printf("[Error] Failed to lock texture: %s\n", SDL_GetError());
+        return;
+    }
+
+    for(int y = 0; y < height; y++){
+        uint32_t* dst = (uint32_t*)((uint8_t*)pixels + y * pitch);
+        const uint8_t* row = &src[y * width];
+
+        for(int x = 0; x < width; x++){
+            dst[x] = nes_palette[row[x] & 0x3F];
+        }
+    }
+
+    SDL_UnlockTexture(texture);
+}
+
+void display_upload(Display* display, const uint8_t* framebuffer){
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    switch(display->view){
+        case VIEW_FRAME:
+            upload_indexed(display->frame_texture, framebuffer, FRAME_WIDTH, FRAME_HEIGHT);
+            break;
+
+        case VIEW_PATTERN_TABLES:
+            // draw the table at 0x1000 on the right
+            draw_pattern_table(debug_buffer, PATTERN_TABLE_WIDTH * 2, 0);
+            draw_pattern_table(debug_buffer + PATTERN_TABLE_WIDTH, PATTERN_TABLE_WIDTH * 2, 0x1000);
+            upload_indexed(display->pattern_texture, debug_buffer, PATTERN_TABLE_WIDTH * 2, PATTERN_TABLE_HEIGHT);
+            break;
+
+        case VIEW_NAMETABLES:
+            draw_nametable(debug_buffer, NAMETABLE_VIEW_WIDTH);
+            upload_indexed(display->nametable_texture, debug_buffer, NAMETABLE_VIEW_WIDTH, NAMETABLE_VIEW_HEIGHT);
+            break;
+    }
+
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+    display->upload_last = elapsed;
+    display->upload_ticks += elapsed;
+    if(elapsed > display->upload_max){
+        display->upload_max = elapsed;
+    }
+}
+
+// Stacked bars of the recent frame times, translucent over the bottom of the game, with a line at 1/60s
+static void draw_graph(Display* display){
+    static const SDL_Color colours[DISPLAY_GRAPH_SEGMENTS] = {
+        { 80, 140, 255, 160 }, { 80, 220, 110, 160 }, { 250, 220, 60, 160 }, { 230, 90, 220, 160 },
+        { 170, 170, 170, 160 }
+    };
+    const float pixels_per_ms = DISPLAY_GRAPH_FRAME * 60 / 1000.0f;
+
+    SDL_SetRenderDrawBlendMode(display->renderer, SDL_BLENDMODE_BLEND);
+    for(int i = 0; i < display->graph_frames; i++){
+        int x = FRAME_WIDTH - 1 - i;
+        float bottom = FRAME_HEIGHT;
+        for(int segment = 0; segment < DISPLAY_GRAPH_SEGMENTS && bottom > 0; segment++){
+            float top = bottom - display->graph[i][segment] * pixels_per_ms;
+            if((int)top < (int)bottom){
+                SDL_Color c = colours[segment];
+                SDL_SetRenderDrawColor(display->renderer, c.r, c.g, c.b, c.a);
+                SDL_RenderDrawLine(display->renderer, x, (top > 0) ? (int)top : 0, x, (int)bottom - 1);
+            }
+            bottom = top;
+        }
+    }
+
+    SDL_SetRenderDrawColor(display->renderer, 255, 60, 60, 200);
+    SDL_RenderDrawLine(display->renderer, 0, FRAME_HEIGHT - DISPLAY_GRAPH_FRAME, FRAME_WIDTH - 1,
+        FRAME_HEIGHT - DISPLAY_GRAPH_FRAME);
+    SDL_SetRenderDrawBlendMode(display->renderer, SDL_BLENDMODE_NONE);
+}
+
+void display_present(Display* display){
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    SDL_Texture* texture = display->frame_texture;
+    if(display->view == VIEW_PATTERN_TABLES){
+        texture = display->pattern_texture;
+    } else if(display->view == VIEW_NAMETABLES){
+        texture = display->nametable_texture;
+    }
+
+    SDL_SetRenderDrawColor(display->renderer, 0, 0, 0, 255);
+    SDL_RenderClear(display->renderer);
+    SDL_RenderCopy(display->renderer, texture, NULL, NULL);
+    if(display->graph_frames > 0 && display->view == VIEW_FRAME){
+        draw_graph(display);
+    }
+    SDL_RenderPresent(display->renderer);
+
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+    display->present_last = elapsed;
+    display->present_ticks += elapsed;
+    if(elapsed > display->present_max){
+        display->present_max = elapsed;
+    }
+    display->presented++;
+}
+
+void display_report(Display* display){
+    if(display->presented == 0){
+        return;
+    }
+
+    double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    printf("Presented %u frames\n", display->presented);
+    printf("  Upload:  avg %.3f ms, max %.3f ms\n",
+        display->upload_ticks * ms / display->presented, display->upload_max * ms);
+    printf("  Present: avg %.3f ms, max %.3f ms\n",
+        display->present_ticks * ms / display->presented, display->present_max * ms);
+}
+
+void display_destroy(Display* display){
+    if(display->frame_texture)      SDL_DestroyTexture(display->frame_texture);
+    if(display->pattern_texture)    SDL_DestroyTexture(display->pattern_texture);
+    if(display->nametable_texture)  SDL_DestroyTexture(display->nametable_texture);
+    if(display->renderer)           SDL_DestroyRenderer(display->renderer);
+    if(display->window)             SDL_DestroyWindow(display->window);
+    SDL_Quit();
+}
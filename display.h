@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL.h>
+#include "ppu.h"
+
+// What the window is currently showing
+typedef enum Display_View {
+    VIEW_FRAME,
+    VIEW_PATTERN_TABLES,
+    VIEW_NAMETABLES
+} Display_View;
+
+// Segments of the frame time graph, bottom up, and the height of 1/60s in it (in NES pixels)
+#define DISPLAY_GRAPH_SEGMENTS  5
+#define DISPLAY_GRAPH_FRAME     120
+
+typedef struct Display{
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+
+    // One streaming texture per view, created once at startup. Each frame is converted straight into the
+    // locked texture memory, so there is no intermediate RGB buffer and no per-pixel draw calls.
+    SDL_Texture* frame_texture;
+    SDL_Texture* pattern_texture;
+    SDL_Texture* nametable_texture;
+
+    Display_View view;
+    int scale;
+
+    // If set, display_present() blocks until the next vertical refresh
+    bool vsync;
+
+    // Presentation cost, in SDL performance counter ticks
+    uint64_t upload_ticks;
+    uint64_t upload_max;
+    uint64_t present_ticks;
+    uint64_t present_max;
+    uint32_t presented;
+    uint64_t upload_last;
+    uint64_t present_last;
+
+    // Frame time graph drawn over the game (see stats.h): one column per frame, newest on the right, each
+    // stacking DISPLAY_GRAPH_SEGMENTS times in ms. No graph while graph_frames is 0.
+    float graph[FRAME_WIDTH][DISPLAY_GRAPH_SEGMENTS];
+    int graph_frames;
+} Display;
+
+// NES colour index (0 - 63) to ARGB8888
+extern const uint32_t nes_palette[64];
+
+int display_init(Display* display, int scale, bool vsync);
+void display_set_view(Display* display, Display_View view);
+
+// Write the current view into its texture. For VIEW_FRAME the given framebuffer (NES colour indices) is used,
+// debug views are drawn from the PPU's memory.
+void display_upload(Display* display, const uint8_t* framebuffer);
+void display_present(Display* display);
+
+// Print the measured upload/present cost
+void display_report(Display* display);
+void display_destroy(Display* display);
@@ -2,35 +2,366 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include <SDL.h>
 #include "cpu.h"
 #include "ppu.h"
 #include "rom.h"
 #include "ops.h"
 #include "system.h"
+#include "display.h"
+#include "queue.h"
+#include "save.h"
+#include "rom_index.h"
+#include "sound.h"
+#include "wav.h"
+#include "movie.h"
+#include "checksum.h"
+#include "digest.h"
+#include "state.h"
+#include "trace.h"
+#include "profile.h"
+#include "stats.h"
+#include "timeline.h"
+#include "bisect.h"
 
 // Global containing the main system components (CPU, PPU, etc)
 System nes; 
 
+// Most frames in a row that will go undrawn, so the screen still updates while skipping
+#define FRAMESKIP_MAX_RUN 8
+
+typedef enum Frameskip_Mode {
+    FRAMESKIP_NONE,
+    FRAMESKIP_FIXED,    // draw 1 frame of every frameskip_interval
+    FRAMESKIP_AUTO      // skip drawing while emulation is behind real time
+} Frameskip_Mode;
+
+// Input latency measurement (--latency-log): how long after the host saw each button change the game sampled
+// it, and how long until the frame the game read it in was finished
+typedef struct Latency_Log{
+    FILE* file;     // NULL when not measuring
+    double tick_ms;
+
+    // Button changes sampled, not yet in a finished frame that read them
+    uint64_t event_time[INPUT_QUEUE_SIZE];
+    uint64_t sampled_time[INPUT_QUEUE_SIZE];
+    int pending;
+
+    uint32_t count;
+    double sampled_total, sampled_max;
+    double frame_total, frame_max;
+} Latency_Log;
+
+// State shared between the presentation (main) thread and the emulation thread
+typedef struct Emulation{
+    Frame_Queue frames;     // completed frames, emulation -> presentation
+    Input_Queue input;      // host input, presentation -> emulation
+    atomic_bool running;
+
+    // Set before the emulation thread starts
+    Frameskip_Mode frameskip;
+    int frameskip_interval;
+
+    // Where each frame's audio goes (either may be NULL)
+    Sound* sound;
+    Wav* wav;
+
+    // Sample input at the start of each frame instead of when the game polls (for comparison)
+    bool early_poll;
+
+    // Input being recorded, and per-frame digests being logged (either may be NULL)
+    Movie* movie;
+    Digest_Log* digest;
+
+    // Emulation thread only
+    bool fast_forward;
+    Latency_Log latency;
+} Emulation;
+
+static Emulation emulation;
+
+// Movie playback: the frame being run, for nes.poll_input
+static Movie playback;
+static uint32_t playback_frame;
+
+// Maps host keys onto controller buttons (bit order as in System.buttons)
+static uint8_t key_to_button(SDL_Keycode key){
+    switch(key){
+        case SDLK_x:        return 0x01; // A
+        case SDLK_z:        return 0x02; // B
+        case SDLK_RSHIFT:   return 0x04; // Select
+        case SDLK_RETURN:   return 0x08; // Start
+        case SDLK_UP:       return 0x10;
+        case SDLK_DOWN:     return 0x20;
+        case SDLK_LEFT:     return 0x40;
+        case SDLK_RIGHT:    return 0x80;
+        default:            return 0;
+    }
+}
+
+// Log the button changes the frame that just finished read
+static void latency_log_frame(Latency_Log* log, uint32_t frame){
+    if(log->file == NULL || log->pending == 0){
+        return;
+    }
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    for(int i = 0; i < log->pending; i++){
+        double sampled = (log->sampled_time[i] - log->event_time[i]) * log->tick_ms;
+        double finished = (now - log->event_time[i]) * log->tick_ms;
+        fprintf(log->file, "%u,%.3f,%.3f\n", frame, sampled, finished);
+
+        log->count++;
+        log->sampled_total += sampled;
+        log->frame_total += finished;
+        if(sampled > log->sampled_max){
+            log->sampled_max = sampled;
+        }
+        if(finished > log->frame_max){
+            log->frame_max = finished;
+        }
+    }
+    log->pending = 0;
+}
+
+// Apply whatever host input has arrived. This is nes.poll_input, so it runs on the emulation thread, mid-frame.
+static void emulation_poll_input(){
+    Emulation* emu = &emulation;
+    Latency_Log* log = &emu->latency;
+    uint64_t now = (log->file != NULL) ? SDL_GetPerformanceCounter() : 0;
+
+    Input_Event event;
+    while(input_queue_pop(&emu->input, &event)){
+        if(event.type == INPUT_BUTTONS){
+            nes.buttons[event.port] = event.value;
+            if(log->file != NULL && log->pending < INPUT_QUEUE_SIZE){
+                log->event_time[log->pending] = event.timestamp;
+                log->sampled_time[log->pending] = now;
+                log->pending++;
+            }
+        } else if(event.type == INPUT_FAST_FORWARD){
+            emu->fast_forward = event.value;
+        }
+    }
+}
+
+static void playback_poll_input(){
+    movie_buttons(&playback, playback_frame, nes.buttons);
+}
+
+// CRC32 of everything a run leaves behind (CPU RAM, PRG RAM and the last frame), to tell two runs apart
+static uint32_t state_crc32(const uint8_t* framebuffer){
+    uint32_t crc = crc32(0, nes.cpu->ram, sizeof(nes.cpu->ram));
+    if(nes.cart->prg_ram != NULL){
+        crc = crc32(crc, nes.cart->prg_ram, nes.cart->prg_ram_size);
+    }
+    return crc32(crc, framebuffer, FRAME_WIDTH * FRAME_HEIGHT);
+}
+
+// Latest frame times for the graph over the game (F4)
+static void fill_graph(Display* display){
+    static const Stats_Series_Id segments[DISPLAY_GRAPH_SEGMENTS] = {
+        STATS_CPU, STATS_PPU, STATS_RENDER, STATS_AUDIO, STATS_FRONTEND
+    };
+    float recent[DISPLAY_GRAPH_SEGMENTS][FRAME_WIDTH];
+    int frames = FRAME_WIDTH;
+    for(int segment = 0; segment < DISPLAY_GRAPH_SEGMENTS; segment++){
+        int count = stats_recent(segments[segment], recent[segment], FRAME_WIDTH);
+        if(count < frames){
+            frames = count;
+        }
+    }
+    for(int i = 0; i < frames; i++){
+        for(int segment = 0; segment < DISPLAY_GRAPH_SEGMENTS; segment++){
+            display->graph[i][segment] = recent[segment][i];
+        }
+    }
+    display->graph_frames = frames;
+}
+
+// Runs the CPU/PPU at 60 frames per second, independent of how fast the host can present them
+static int emulation_thread(void* data){
+    Emulation* emu = (Emulation*)data;
+    TIMELINE_THREAD("emulation");
+
+    // Frames are paced against the performance counter rather than SDL_GetTicks() for sub-millisecond accuracy
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t frame_ticks = frequency / 60;
+    uint64_t next_frame = SDL_GetPerformanceCounter() + frame_ticks;
+
+    // The PPU draws straight into the queue's back buffer
+    ppu_set_framebuffer(nes.ppu, frame_queue_back(&emu->frames));
+
+    bool behind = false;
+    int skipped_run = 0;
+    uint32_t frame = 0;
+
+    // Host input is picked up when the game first strobes or reads a controller in each frame
+    if(!emu->early_poll){
+        nes.poll_input = emulation_poll_input;
+    }
+
+    while(atomic_load(&emu->running)){
+        if(emu->early_poll){
+            emulation_poll_input();
+        }
+        bool fast_forward = emu->fast_forward;
+        stats_frame_start(nes.ppu->dots);
+
+        // Decide whether this frame gets drawn. Skipped frames still run the PPU with exact timing.
+        bool render = true;
+        if(fast_forward){
+            render = skipped_run >= FRAMESKIP_MAX_RUN;
+        } else if(emu->frameskip == FRAMESKIP_FIXED){
+            render = frame % emu->frameskip_interval == 0;
+        } else if(emu->frameskip == FRAMESKIP_AUTO){
+            render = !behind || skipped_run >= FRAMESKIP_MAX_RUN;
+        }
+
+        // Main CPU/PPU Execution
+        nes.ppu->render_skip = !render;
+        system_run_frame();
+        stats_frame_emulated();
+        save_sync(nes.cart);
+        frame++;
+
+        // The buttons the game saw this frame, before anything newer is applied
+        if(emu->movie != NULL){
+            movie_record_frame(emu->movie, nes.buttons);
+        }
+        if(emu->digest != NULL){
+            digest_log_frame(emu->digest, render ? ppu_finished_frame(nes.ppu) : NULL);
+        }
+
+        if(nes.input_polled || emu->early_poll){
+            latency_log_frame(&emu->latency, frame);
+        } else{
+            // The game didn't look at the controllers; keep fast-forward and the buttons current regardless
+            emulation_poll_input();
+        }
+
+        // Live playback and capture get exactly the same samples. Fast-forwarded audio would only overrun the
+        // device, so it isn't played.
+        Audio* audio = &nes.apu->audio;
+        if(emu->sound != NULL && !fast_forward){
+            audio_set_ratio(audio, sound_push(emu->sound, audio->output, audio->output_count));
+        }
+        if(emu->wav != NULL){
+            wav_write(emu->wav, audio->output, audio->output_count);
+        }
+
+        if(render){
+            // Identical frames aren't published at all, so the presenter has nothing to upload
+            if(!nes.ppu->frame_unchanged){
+                ppu_set_framebuffer(nes.ppu, frame_queue_publish(&emu->frames));
+                TIMELINE_INSTANT("publish frame");
+            }
+            skipped_run = 0;
+        } else{
+            skipped_run++;
+        }
+
+        // Sleep off whatever is left of this frame
+        stats_frame_sleep();
+        uint64_t now = SDL_GetPerformanceCounter();
+        if(fast_forward){
+            // Unthrottled
+            next_frame = now + frame_ticks;
+        } else if(now < next_frame){
+            TIMELINE_BEGIN("sleep");
+            SDL_Delay((Uint32)((next_frame - now) * 1000 / frequency));
+            TIMELINE_END();
+            next_frame += frame_ticks;
+            behind = false;
+        } else{
+            // Running behind; keep the schedule so skipped frames can catch up, unless it's hopeless
+            behind = true;
+            next_frame += frame_ticks;
+            if(now - next_frame > FRAMESKIP_MAX_RUN * frame_ticks){
+                next_frame = now + frame_ticks;
+            }
+        }
+        stats_frame_end(nes.ppu->dots);
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[]){
-    // Initialise CPU and PPU
+    // Library indexing runs on its own, without a ROM or a window
+    if(argc >= 3 && strcmp(argv[1], "--index") == 0){
+        const char* index_path = "unicom.idx";
+        if(argc >= 5 && strcmp(argv[3], "-o") == 0){
+            index_path = argv[4];
+        }
+        return rom_index_build(argv[2], index_path, SDL_GetCPUCount());
+    }
+
+    // As is comparing two runs' digest logs, and hunting down where two runs part ways
+    if(argc >= 4 && strcmp(argv[1], "--compare") == 0){
+        return digest_compare(argv[2], argv[3]);
+    }
+    if(argc >= 4 && strcmp(argv[1], "--bisect") == 0){
+        return bisect_main(argc, argv);
+    }
+
+    // Initialise CPU, PPU and APU
     CPU cpu;
     cpu_init(&cpu);
     PPU ppu;
     ppu_init(&ppu);
+    APU apu;
+    apu_init(&apu);
+    Cartridge cart = { 0 };
 
-    // Attach CPU and PPU to main system
-    system_init(&cpu, &ppu);
+    // Attach CPU, PPU, APU and cartridge to main system
+    system_init(&cpu, &ppu, &apu, &cart);
 
-    // Load game ROM
+    // Load game ROM. With a ROM index it can be named by its path as indexed or by its CRC32, and the index's
+    // settings are used instead of the header, unless the file has changed since it was indexed.
     char* rom_path = argv[1];
-    int rom_status = load_rom(rom_path, &cpu, &ppu);
+    char indexed_path[4096];
+    Rom_Header indexed_header;
+    bool indexed = false;
+    for(int i = 2; i + 1 < argc; i++){
+        if(strcmp(argv[i], "--rom-index") == 0){
+            Rom_Index index;
+            if(rom_index_load(argv[i + 1], &index) != 0){
+                printf("ERROR! Couldn't read ROM index '%s'.\n", argv[i + 1]);
+                exit(1);
+            }
+            const Rom_Index_Entry* entry = rom_index_find_path(&index, rom_path);
+            if(entry == NULL && strlen(rom_path) == 8){
+                char* end;
+                uint32_t crc = strtoul(rom_path, &end, 16);
+                entry = (*end == '\0') ? rom_index_find_crc32(&index, crc) : NULL;
+            }
+            if(entry == NULL){
+                printf("ERROR! '%s' is not in ROM index '%s'.\n", rom_path, argv[i + 1]);
+                rom_index_free(&index);
+                exit(1);
+            }
+            indexed = rom_index_current(entry);
+            if(indexed){
+                printf("Indexed ROM '%s': CRC32 %08X, mapper %d, %s\n", entry->path, entry->crc32, entry->mapper,
+                    rom_region_name((Region)entry->region));
+                rom_index_header(entry, &indexed_header);
+            } else{
+                printf("'%s' has changed since it was indexed; reading its own header\n", entry->path);
+            }
+            snprintf(indexed_path, sizeof(indexed_path), "%s", entry->path);
+            rom_path = indexed_path;
+            rom_index_free(&index);
+        }
+    }
+    int rom_status = indexed ? load_rom_header(rom_path, &indexed_header, &cart) : load_rom(rom_path, &cart);
 
     if(rom_status == 0){
         printf("Loaded ROM from '%s'\n", rom_path);
     } else{
         if(argc < 2){
-            printf("ERROR! Not enough arguments.\nUsage: unicom.exe {path_to_rom}\n");
+            printf("ERROR! Not enough arguments.\nUsage: unicom.exe {path_to_rom} [--scale N] [--no-vsync] [--frameskip N|auto] [--no-reuse] [--nt-cache] [--trace]\n                  [--no-audio] [--wav file] [--headless frames] [--rom-index file]\n                  [--latency-log file] [--early-poll] [--record movie] [--play movie] [--digest file]\n                  [--state file] [--checkpoints interval dir] [--trace-frame file]\n                  [--profile file] [--profile-top N] [--stats file] [--stats-overlay] [--timeline file]\n       unicom.exe --index {rom_directory} [-o index_file]\n       unicom.exe {indexed_rom_path|crc32} --rom-index {index_file} [options]\n       unicom.exe --compare {digest_log} {digest_log}\n       unicom.exe --bisect {path_to_rom} {movie} [options, see bisect.h]\n");
         } else{
             printf("ERROR! Failed to load ROM from '%s'\n", rom_path);
         }
@@ -38,82 +369,422 @@ int main(int argc, char *argv[]){
     }
 
     // Set PC to first instruction
-    cpu.pc =  cpu.memory[0xfffc] | (cpu.memory[0xfffd] << 8);
+    cpu.pc = read16(&cpu, 0xFFFC);
 
-    SDL_Event event;
-    SDL_Renderer *renderer;
-    SDL_Window *window;
+    // Optional arguments follow the ROM path
+    int scale = 2;
+    bool vsync = true;
+    bool audio_enabled = true;
+    const char* wav_path = NULL;
+    const char* latency_path = NULL;
+    const char* record_path = NULL;
+    const char* play_path = NULL;
+    const char* digest_path = NULL;
+    const char* state_path = NULL;
+    const char* checkpoint_dir = NULL;
+    const char* trace_path = NULL;
+    const char* profile_path = NULL;
+    int profile_top = PROFILE_TOP;
+    const char* stats_path = NULL;
+    const char* timeline_path = NULL;
+    bool stats_overlay = false;
+    long checkpoint_interval = 0;
+    long headless_frames = -1;
+    emulation.frameskip = FRAMESKIP_NONE;
+    emulation.frameskip_interval = 1;
+    for(int i = 2; i < argc; i++){
+        if(strcmp(argv[i], "--trace") == 0){
+            cpu.trace = true;
+        } else if(strcmp(argv[i], "--scale") == 0 && i + 1 < argc){
+            scale = atoi(argv[++i]);
+            if(scale < 1){
+                scale = 1;
+            }
+        } else if(strcmp(argv[i], "--no-vsync") == 0){
+            vsync = false;
+        } else if(strcmp(argv[i], "--no-audio") == 0){
+            audio_enabled = false;
+        } else if(strcmp(argv[i], "--wav") == 0 && i + 1 < argc){
+            wav_path = argv[++i];
+        } else if(strcmp(argv[i], "--latency-log") == 0 && i + 1 < argc){
+            latency_path = argv[++i];
+        } else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc){
+            record_path = argv[++i];
+        } else if(strcmp(argv[i], "--play") == 0 && i + 1 < argc){
+            play_path = argv[++i];
+        } else if(strcmp(argv[i], "--digest") == 0 && i + 1 < argc){
+            digest_path = argv[++i];
+        } else if(strcmp(argv[i], "--state") == 0 && i + 1 < argc){
+            state_path = argv[++i];
+        } else if(strcmp(argv[i], "--checkpoints") == 0 && i + 2 < argc){
+            checkpoint_interval = atol(argv[++i]);
+            checkpoint_dir = argv[++i];
+        } else if(strcmp(argv[i], "--trace-frame") == 0 && i + 1 < argc){
+            trace_path = argv[++i];
+        } else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc){
+            profile_path = argv[++i];
+        } else if(strcmp(argv[i], "--profile-top") == 0 && i + 1 < argc){
+            profile_top = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--stats") == 0 && i + 1 < argc){
+            stats_path = argv[++i];
+        } else if(strcmp(argv[i], "--timeline") == 0 && i + 1 < argc){
+            timeline_path = argv[++i];
+        } else if(strcmp(argv[i], "--stats-overlay") == 0){
+            stats_overlay = true;
+        } else if(strcmp(argv[i], "--early-poll") == 0){
+            emulation.early_poll = true;
+        } else if(strcmp(argv[i], "--rom-index") == 0 && i + 1 < argc){
+            i++;    // used above, to find the ROM
+        } else if(strcmp(argv[i], "--headless") == 0 && i + 1 < argc){
+            headless_frames = atol(argv[++i]);
+        } else if(strcmp(argv[i], "--no-reuse") == 0){
+            ppu.line_reuse = false;
+        } else if(strcmp(argv[i], "--nt-cache") == 0){
+            ppu.nametable_cache = true;
+        } else if(strcmp(argv[i], "--frameskip") == 0 && i + 1 < argc){
+            i++;
+            if(strcmp(argv[i], "auto") == 0){
+                emulation.frameskip = FRAMESKIP_AUTO;
+            } else if(atoi(argv[i]) > 1){
+                emulation.frameskip = FRAMESKIP_FIXED;
+                emulation.frameskip_interval = atoi(argv[i]);
+            }
+        } else{
+            printf("Unknown option '%s'\n", argv[i]);
+        }
+    }
+
+    Wav wav;
+    if(wav_path != NULL){
+        if(wav_open(&wav, wav_path, AUDIO_SAMPLE_RATE) != 0){
+            cartridge_free(&cart);
+            exit(1);
+        }
+        emulation.wav = &wav;
+    }
+
+    // A movie starts from power on, so it's set up before anything runs
+    Movie movie;
+    if(play_path != NULL){
+        if(movie_play(&playback, play_path, &cart) != 0){
+            if(emulation.wav != NULL){
+                wav_close(emulation.wav);
+            }
+            cartridge_free(&cart);
+            exit(1);
+        }
+        nes.poll_input = playback_poll_input;
+    } else if(record_path != NULL && movie_record(&movie, record_path, &cart) == 0){
+        emulation.movie = &movie;
+    }
+
+    // ...unless it picks up from a saved state
+    if(state_path != NULL && state_load_file(state_path) != 0){
+        if(emulation.wav != NULL){
+            wav_close(emulation.wav);
+        }
+        cartridge_free(&cart);
+        exit(1);
+    }
+    uint32_t first_frame = ppu.frame_count;
+
+    // The profile covers whatever runs from here on
+    if(profile_path != NULL){
+#ifdef UNICOM_PROFILER
+        profile_start(profile_path);
+#else
+        printf("ERROR! Built without the profiler; --profile needs -DUNICOM_PROFILER.\n");
+#endif
+    }
+
+    // Frame timing, for the graph and/or written out at exit and on SIGUSR1
+    if((stats_path != NULL || stats_overlay) && stats_start() == 0 && stats_path != NULL){
+        stats_install_signal();
+    }
+
+    // Chrome trace of every thread (F5 pauses and resumes it)
+    if(timeline_path != NULL){
+#ifdef UNICOM_TIMELINE
+        TIMELINE_THREAD(headless_frames >= 0 || play_path != NULL ? "headless" : "presentation");
+        timeline_start(timeline_path);
+#else
+        printf("ERROR! Built without the timeline; --timeline needs -DUNICOM_TIMELINE.\n");
+#endif
+    }
+
+    Digest_Log digest;
+    if(digest_path != NULL && digest_log_open(&digest, digest_path, &cart, first_frame) == 0){
+        emulation.digest = &digest;
+    }
 
-    // Create a window of 128x128 pixels to draw a single pattern table
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_CreateWindowAndRenderer(256, 128, 0, &window, &renderer);
-    // SDL_RenderSetScale(renderer, 4.0,4.0);
-    
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-    SDL_RenderClear(renderer);
+    // Headless: no window or audio device, just run the given number of frames (or the movie) as fast as possible
+    if(headless_frames >= 0 || play_path != NULL){
+        if(play_path != NULL){
+            long remaining = (playback.frame_count > first_frame) ? playback.frame_count - first_frame : 0;
+            if(headless_frames < 0 || headless_frames > remaining){
+                headless_frames = remaining;
+            }
+        }
+
+        static uint8_t framebuffer[FRAME_WIDTH * FRAME_HEIGHT];
+        ppu_set_framebuffer(&ppu, framebuffer);
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        for(long frame = first_frame; frame < first_frame + headless_frames; frame++){
+            if(checkpoint_dir != NULL && checkpoint_interval > 0 && frame % checkpoint_interval == 0){
+                char path[4096];
+                snprintf(path, sizeof(path), "%s/%ld.state", checkpoint_dir, frame);
+                state_save_file(path);
+            }
+
+            playback_frame = frame;
+            stats_frame_start(ppu.dots);
+            system_run_frame();
+            stats_frame_emulated();
+            save_sync(nes.cart);
+            if(emulation.movie != NULL){
+                movie_record_frame(emulation.movie, nes.buttons);
+            }
+            if(emulation.digest != NULL){
+                digest_log_frame(emulation.digest, ppu_finished_frame(nes.ppu));
+            }
+            if(emulation.wav != NULL){
+                wav_write(emulation.wav, apu.audio.output, apu.audio.output_count);
+            }
+
+            // Single buffered: the frame just drawn is also the one unchanged lines are kept from
+            ppu_set_framebuffer(&ppu, framebuffer);
+
+            // Nothing to wait for
+            stats_frame_sleep();
+            stats_frame_end(ppu.dots);
+            if(stats_dump_requested()){
+                stats_write_json(stats_path);
+            }
+        }
+        double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        printf("Ran %ld frames in %.3fs (%.1f fps)\n", headless_frames, seconds, headless_frames / seconds);
+        crc32_init();
+        printf("Final state CRC32: %.8X\n", state_crc32(framebuffer));
+        profile_finish(profile_top);
+        if(frame_stats != NULL){
+            stats_report();
+            stats_write_json(stats_path);
+            stats_stop();
+        }
+#ifdef UNICOM_TIMELINE
+        timeline_finish();
+#endif
+
+        // One more frame, an instruction at a time
+        if(trace_path != NULL){
+            playback_frame = first_frame + headless_frames;
+            trace_frame(trace_path);
+        }
+
+        if(emulation.movie != NULL){
+            movie_close(emulation.movie);
+        }
+        if(emulation.digest != NULL){
+            printf("Logged digests of %u frames\n", emulation.digest->frames);
+            digest_log_close(emulation.digest);
+        }
+        if(play_path != NULL){
+            movie_close(&playback);
+        }
+        if(emulation.wav != NULL){
+            wav_close(emulation.wav);
+        }
+        cartridge_free(&cart);
+        return 0;
+    }
 
-    draw_pattern_table(window, renderer, 0);
-    draw_pattern_table(window, renderer, 0x1000);
+    Display display;
+    if(display_init(&display, scale, vsync) != 0){
+        display_destroy(&display);
+        if(emulation.wav != NULL){
+            wav_close(emulation.wav);
+        }
+        cartridge_free(&cart);
+        exit(1);
+    }
 
     // // DEBUG Set PC to NESTEST start point
     // // cpu.pc = 0xc000;
 
     printf("PC: %x (%d)\n", cpu.pc, cpu.pc);
 
-    bool running = true;
-
-    // Count no. instructions executed
-    int loop = 1;
+    // One line per button change: frame it was read in, then ms until it was sampled and until that frame was done
+    if(latency_path != NULL){
+        emulation.latency.file = fopen(latency_path, "w");
+        if(emulation.latency.file == NULL){
+            printf("ERROR! Could not open latency log '%s'\n", latency_path);
+        } else{
+            fprintf(emulation.latency.file, "frame,sampled_ms,frame_ms\n");
+            emulation.latency.tick_ms = 1000.0 / SDL_GetPerformanceFrequency();
+        }
+    }
 
-    int cpu_cycles = 0;
-    int ppu_cycles = 0;
+    Sound sound;
+    if(audio_enabled && sound_init(&sound) == 0){
+        emulation.sound = &sound;
+    }
 
-    /*uint64_t start_time;
-    uint64_t end_time;
-    float elapsed_time;*/
-    Uint32 start_time;
-    Uint32 end_time;
+    frame_queue_init(&emulation.frames);
+    input_queue_init(&emulation.input);
+    atomic_init(&emulation.running, true);
 
-    Uint32 delta;
+    SDL_Thread* emulation_handle = SDL_CreateThread(emulation_thread, "emulation", &emulation);
+    if(emulation_handle == NULL){
+        printf("ERROR! Failed to start emulation thread: %s\n", SDL_GetError());
+        display_destroy(&display);
+        cartridge_free(&cart);
+        exit(1);
+    }
 
+    bool running = true;
+    SDL_Event event;
+    uint8_t buttons = 0;
+    bool fast_forward = false;
 
-    // Main execution loop
+    // Presentation loop: SDL events, uploads and (vsynced) presents. Never waits on emulation.
     while(running){
-        start_time = SDL_GetTicks();
-        delta = start_time - end_time;
+        uint8_t previous_buttons = buttons;
 
-        if(delta > 1000/60.0){
-            end_time = start_time;
-            // Handle input
-            if (SDL_PollEvent(&event) && event.type == SDL_QUIT){
-                
-                SDL_DestroyRenderer(renderer);
-                SDL_DestroyWindow(window);
-                break;
-            }
+        while(SDL_PollEvent(&event)){
+            if(event.type == SDL_QUIT){
+                running = false;
+            } else if(event.type == SDL_KEYDOWN){
+                // F1-F3 switch between the game and the debug views
+                switch(event.key.keysym.sym){
+                    case SDLK_F1: display_set_view(&display, VIEW_FRAME);           break;
+                    case SDLK_F2: display_set_view(&display, VIEW_PATTERN_TABLES);  break;
+                    case SDLK_F3: display_set_view(&display, VIEW_NAMETABLES);      break;
+                    case SDLK_F4: stats_overlay = !stats_overlay;                   break;
+#ifdef UNICOM_TIMELINE
+                    case SDLK_F5: timeline_set_recording(!timeline_recording());    break;
+#endif
+                }
+                buttons |= key_to_button(event.key.keysym.sym);
 
-            //printf("[%d] ", loop);
-            loop++;
-            
-            // Main CPU/PPU Execution
-            cpu_cycles = cpu_step(&cpu);
-            
-            ppu_cycles += cpu_cycles * 3;
-            while(ppu_cycles > 0){
-                ppu_step(&ppu, renderer);
-                ppu_cycles--;
+                // Hold tab to fast-forward
+                if(event.key.keysym.sym == SDLK_TAB && !fast_forward){
+                    fast_forward = true;
+                    Input_Event input = { INPUT_FAST_FORWARD, 0, 1, SDL_GetPerformanceCounter() };
+                    input_queue_push(&emulation.input, input);
+                }
+            } else if(event.type == SDL_KEYUP){
+                buttons &= ~key_to_button(event.key.keysym.sym);
+
+                if(event.key.keysym.sym == SDLK_TAB){
+                    fast_forward = false;
+                    Input_Event input = { INPUT_FAST_FORWARD, 0, 0, SDL_GetPerformanceCounter() };
+                    input_queue_push(&emulation.input, input);
+                }
             }
-            SDL_RenderPresent(renderer);
         }
 
-        
-        
+        if(buttons != previous_buttons){
+            Input_Event input = { INPUT_BUTTONS, 0, buttons, SDL_GetPerformanceCounter() };
+            input_queue_push(&emulation.input, input);
+        }
+
+        bool fresh = frame_queue_acquire(&emulation.frames);
+        if(fresh){
+            TIMELINE_INSTANT("acquire frame");
+        }
+
+        if(!fresh && !display.vsync){
+            // Without vsync to pace us, only present when there's something new
+            SDL_Delay(1);
+            continue;
+        }
+
+        // The debug views read PPU memory directly, so they are redrawn every present.
+        // (They race with the emulation thread, which is harmless for a debug view.)
+        double ms = 1000.0 / SDL_GetPerformanceFrequency();
+        if(fresh || display.view != VIEW_FRAME){
+            TIMELINE_BEGIN("upload");
+            display_upload(&display, frame_queue_front(&emulation.frames));
+            TIMELINE_END();
+            stats_upload(display.upload_last * ms);
+        }
+        display.graph_frames = 0;
+        if(stats_overlay && frame_stats != NULL){
+            fill_graph(&display);
+        }
+        TIMELINE_BEGIN("present");
+        display_present(&display);
+        TIMELINE_END();
+        stats_present(display.present_last * ms);
+        if(stats_dump_requested()){
+            stats_write_json(stats_path);
+        }
+
+        emulation.frames.presented++;
+        if(!fresh){
+            emulation.frames.duplicated++;
+        }
+    }
+
+    atomic_store(&emulation.running, false);
+    SDL_WaitThread(emulation_handle, NULL);
+
+    display_report(&display);
+    printf("Frames: %u produced, %u presented, %u dropped, %u duplicated\n",
+        atomic_load(&emulation.frames.produced), emulation.frames.presented,
+        atomic_load(&emulation.frames.dropped), emulation.frames.duplicated);
+    printf("PPU: %u frames rendered, %u skipped, %u reused; %u lines drawn, %u reused\n", ppu.frames_rendered,
+        ppu.frames_skipped, ppu.frames_reused, ppu.lines_rendered, ppu.lines_reused);
+    if(ppu.nametable_cache){
+        printf("Nametable cache: %u tiles drawn, %u lines drawn directly\n", ppu.cache_tiles_drawn, ppu.cache_fallback_lines);
+    }
+    if(atomic_load(&emulation.input.overflowed) > 0){
+        printf("Input: %u events lost to a full queue\n", atomic_load(&emulation.input.overflowed));
+    }
+    if(emulation.sound != NULL){
+        sound_report(&sound);
+    }
+    profile_finish(profile_top);
+    if(frame_stats != NULL){
+        stats_report();
+        stats_write_json(stats_path);
+        stats_stop();
+    }
+    Latency_Log* latency = &emulation.latency;
+    if(latency->file != NULL){
+        if(latency->count > 0){
+            printf("Input latency (%s polling): %u changes, sampled after %.2fms avg (%.2fms max), frame done after "
+                "%.2fms avg (%.2fms max)\n", emulation.early_poll ? "frame start" : "late", latency->count,
+                latency->sampled_total / latency->count, latency->sampled_max,
+                latency->frame_total / latency->count, latency->frame_max);
+        }
+        fclose(latency->file);
+    }
+
+    if(emulation.sound != NULL){
+        sound_destroy(&sound);
+    }
+#ifdef UNICOM_TIMELINE
+    // Once the audio thread is gone too
+    timeline_finish();
+#endif
+    if(emulation.movie != NULL){
+        movie_close(emulation.movie);
+    }
+    if(emulation.digest != NULL){
+        digest_log_close(emulation.digest);
+    }
+    if(emulation.wav != NULL){
+        wav_close(emulation.wav);
     }
+    display_destroy(&display);
+    cartridge_free(&cart);
 
     // print_disassembly(&cpu, false);
 
     // Print nestest results
-    // printf("NESTEST Results [0x02]: %.2X [0x03]: %.2X", cpu.memory[0x02], cpu.memory[0x03]);
+    // printf("NESTEST Results [0x02]: %.2X [0x03]: %.2X", cpu.ram[0x02], cpu.ram[0x03]);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,264 @@
+#include "cartridge.h"
+#include "system.h"
+
+/*  Mapper implementations. Details from the Nesdev Wiki (https://www.nesdev.org/wiki/Mapper).
+    Bus conflicts (UxROM, CNROM, AxROM) aren't emulated; games avoid relying on them.
+*/
+
+// ------------ NROM (0) ------------ //
+static void nrom_reset(Cartridge* cart){
+    // 16kB carts show the same bank at $8000 and $C000; cartridge_map_prg() wraps it for us
+    cartridge_map_prg(cart, 0x8000, 32, 0);
+    cartridge_map_chr(cart, 0x0000, 8, 0);
+}
+
+// ------------ MMC1 (1) ------------ //
+static void mmc1_update_banks(Cartridge* cart){
+    uint8_t control = cart->mmc1.control;
+
+    // Mirroring (bits 0-1): one-screen low, one-screen high, vertical, horizontal
+    static const Mirroring mirroring[4] = { MIRROR_SINGLE_LOW, MIRROR_SINGLE_HIGH, MIRROR_VERTICAL, MIRROR_HORIZONTAL };
+    cartridge_set_mirroring(cart, mirroring[control & 0x3]);
+
+    // PRG mode (bits 2-3): 32kB, or 16kB with $8000 (mode 2) or $C000 (mode 3) fixed
+    uint8_t prg_bank = cart->mmc1.prg_bank & 0x0F;
+    switch((control >> 2) & 0x3){
+        case 0:
+        case 1:
+            cartridge_map_prg(cart, 0x8000, 32, prg_bank >> 1);
+            break;
+        case 2:
+            cartridge_map_prg(cart, 0x8000, 16, 0);
+            cartridge_map_prg(cart, 0xC000, 16, prg_bank);
+            break;
+        case 3:
+            cartridge_map_prg(cart, 0x8000, 16, prg_bank);
+            cartridge_map_prg(cart, 0xC000, 16, -1);
+            break;
+    }
+
+    // CHR mode (bit 4): one 8kB bank, or two 4kB banks
+    if(control & 0x10){
+        cartridge_map_chr(cart, 0x0000, 4, cart->mmc1.chr_bank[0]);
+        cartridge_map_chr(cart, 0x1000, 4, cart->mmc1.chr_bank[1]);
+    } else{
+        cartridge_map_chr(cart, 0x0000, 8, cart->mmc1.chr_bank[0] >> 1);
+    }
+
+    // PRG bank bit 4 disables the work RAM (MMC1B and later)
+    cart->prg_pages[0] = (cart->mmc1.prg_bank & 0x10) ? NULL : cart->prg_ram;
+    cart->prg_ram_writable = !(cart->mmc1.prg_bank & 0x10);
+}
+
+static void mmc1_reset(Cartridge* cart){
+    cart->mmc1.shift = 0x10;
+    cart->mmc1.control = 0x0C; // PRG mode 3: last bank fixed at $C000
+    cart->mmc1.chr_bank[0] = 0;
+    cart->mmc1.chr_bank[1] = 0;
+    cart->mmc1.prg_bank = 0;
+    mmc1_update_banks(cart);
+}
+
+static void mmc1_cpu_write(Cartridge* cart, uint16_t addr, uint8_t data){
+    if(addr < 0x8000){
+        return;
+    }
+
+    // Writing with bit 7 set empties the serial port and goes back to PRG mode 3
+    if(data & 0x80){
+        cart->mmc1.shift = 0x10;
+        cart->mmc1.control |= 0x0C;
+        mmc1_update_banks(cart);
+        return;
+    }
+
+    // Registers are loaded one bit at a time, LSB first. The marker bit reaching bit 0 means this is the 5th write.
+    bool full = cart->mmc1.shift & 0x01;
+    cart->mmc1.shift = (cart->mmc1.shift >> 1) | ((data & 0x01) << 4);
+    if(!full){
+        return;
+    }
+
+    uint8_t value = cart->mmc1.shift;
+    switch((addr >> 13) & 0x3){
+        case 0: cart->mmc1.control = value;     break; // $8000-$9FFF
+        case 1: cart->mmc1.chr_bank[0] = value; break; // $A000-$BFFF
+        case 2: cart->mmc1.chr_bank[1] = value; break; // $C000-$DFFF
+        case 3: cart->mmc1.prg_bank = value;    break; // $E000-$FFFF
+    }
+    cart->mmc1.shift = 0x10;
+    mmc1_update_banks(cart);
+}
+
+// ------------ UxROM (2) ------------ //
+static void uxrom_reset(Cartridge* cart){
+    cart->bank = 0;
+    cartridge_map_prg(cart, 0x8000, 16, 0);
+    cartridge_map_prg(cart, 0xC000, 16, -1);
+    cartridge_map_chr(cart, 0x0000, 8, 0);
+}
+
+static void uxrom_cpu_write(Cartridge* cart, uint16_t addr, uint8_t data){
+    if(addr >= 0x8000 && cart->bank != data){
+        cart->bank = data;
+        cartridge_map_prg(cart, 0x8000, 16, data);
+    }
+}
+
+// ------------ CNROM (3) ------------ //
+static void cnrom_reset(Cartridge* cart){
+    cart->bank = 0;
+    cartridge_map_prg(cart, 0x8000, 32, 0);
+    cartridge_map_chr(cart, 0x0000, 8, 0);
+}
+
+static void cnrom_cpu_write(Cartridge* cart, uint16_t addr, uint8_t data){
+    if(addr >= 0x8000 && cart->bank != data){
+        cart->bank = data;
+        cartridge_map_chr(cart, 0x0000, 8, data);
+    }
+}
+
+// ------------ MMC3 (4) ------------ //
+static void mmc3_update_banks(Cartridge* cart){
+    uint8_t* banks = cart->mmc3.banks;
+
+    // Bit 6 of bank select swaps which of $8000/$C000 is R6 and which is fixed to the second last bank
+    if(cart->mmc3.bank_select & 0x40){
+        cartridge_map_prg(cart, 0x8000, 8, -2);
+        cartridge_map_prg(cart, 0xC000, 8, banks[6]);
+    } else{
+        cartridge_map_prg(cart, 0x8000, 8, banks[6]);
+        cartridge_map_prg(cart, 0xC000, 8, -2);
+    }
+    cartridge_map_prg(cart, 0xA000, 8, banks[7]);
+    cartridge_map_prg(cart, 0xE000, 8, -1);
+
+    // Bit 7 swaps the 2kB banks (R0, R1) and the 1kB banks (R2 - R5) between the two pattern tables
+    uint16_t big = (cart->mmc3.bank_select & 0x80) ? 0x1000 : 0x0000;
+    uint16_t small = big ^ 0x1000;
+    cartridge_map_chr(cart, big, 2, banks[0] >> 1);
+    cartridge_map_chr(cart, big + 0x0800, 2, banks[1] >> 1);
+    for(int i = 0; i < 4; i++){
+        cartridge_map_chr(cart, small + i * 0x0400, 1, banks[2 + i]);
+    }
+}
+
+static void mmc3_reset(Cartridge* cart){
+    cart->mmc3.bank_select = 0;
+    uint8_t banks[8] = { 0, 2, 4, 5, 6, 7, 0, 1 };
+    for(int i = 0; i < 8; i++){
+        cart->mmc3.banks[i] = banks[i];
+    }
+    cart->mmc3.irq_latch = 0;
+    cart->mmc3.irq_counter = 0;
+    cart->mmc3.irq_reload = false;
+    cart->mmc3.irq_enabled = false;
+    cart->mmc3.irq_pending = false;
+    mmc3_update_banks(cart);
+}
+
+static void mmc3_cpu_write(Cartridge* cart, uint16_t addr, uint8_t data){
+    if(addr < 0x8000){
+        return;
+    }
+
+    // Four pairs of registers, told apart by A0 (even/odd address)
+    bool odd = addr & 0x1;
+    switch(addr & 0xE000){
+        case 0x8000:
+            if(!odd){
+                cart->mmc3.bank_select = data;
+            } else{
+                cart->mmc3.banks[cart->mmc3.bank_select & 0x7] = data;
+            }
+            mmc3_update_banks(cart);
+            break;
+
+        case 0xA000:
+            if(!odd){
+                cartridge_set_mirroring(cart, (data & 0x01) ? MIRROR_HORIZONTAL : MIRROR_VERTICAL);
+            } else{
+                // PRG RAM protect: bit 7 enables the RAM, bit 6 makes it read only
+                cart->prg_pages[0] = (data & 0x80) ? cart->prg_ram : NULL;
+                cart->prg_ram_writable = (data & 0x80) && !(data & 0x40);
+            }
+            break;
+
+        case 0xC000:
+            if(!odd){
+                cart->mmc3.irq_latch = data;
+            } else{
+                // Reload from the latch on the next scanline
+                cart->mmc3.irq_counter = 0;
+                cart->mmc3.irq_reload = true;
+            }
+            break;
+
+        case 0xE000:
+            cart->mmc3.irq_enabled = odd;
+            if(!odd){
+                // Disabling also acknowledges any pending IRQ
+                cart->mmc3.irq_pending = false;
+            }
+            break;
+    }
+}
+
+static void mmc3_scanline(Cartridge* cart){
+    if(cart->mmc3.irq_counter == 0 || cart->mmc3.irq_reload){
+        cart->mmc3.irq_counter = cart->mmc3.irq_latch;
+        cart->mmc3.irq_reload = false;
+    } else{
+        cart->mmc3.irq_counter--;
+    }
+
+    if(cart->mmc3.irq_counter == 0 && cart->mmc3.irq_enabled){
+        cart->mmc3.irq_pending = true;
+    }
+}
+
+static bool mmc3_irq(Cartridge* cart){
+    return cart->mmc3.irq_pending;
+}
+
+// ------------ AxROM (7) ------------ //
+static void axrom_update_banks(Cartridge* cart){
+    cartridge_map_prg(cart, 0x8000, 32, cart->bank & 0x07);
+
+    // Bit 4 picks which 1kB of VRAM all four nametables use
+    cartridge_set_mirroring(cart, (cart->bank & 0x10) ? MIRROR_SINGLE_HIGH : MIRROR_SINGLE_LOW);
+}
+
+static void axrom_reset(Cartridge* cart){
+    cart->bank = 0;
+    axrom_update_banks(cart);
+    cartridge_map_chr(cart, 0x0000, 8, 0);
+}
+
+static void axrom_cpu_write(Cartridge* cart, uint16_t addr, uint8_t data){
+    if(addr >= 0x8000 && cart->bank != data){
+        cart->bank = data;
+        axrom_update_banks(cart);
+    }
+}
+
+
+// number, name, reset, cpu_read, cpu_write, ppu_read, ppu_write, scanline, irq
+static const Mapper mappers[] = {
+    { 0, "NROM",  nrom_reset,  NULL, NULL,            NULL, NULL, NULL,          NULL     },
+    { 1, "MMC1",  mmc1_reset,  NULL, mmc1_cpu_write,  NULL, NULL, NULL,          NULL     },
+    { 2, "UxROM", uxrom_reset, NULL, uxrom_cpu_write, NULL, NULL, NULL,          NULL     },
+    { 3, "CNROM", cnrom_reset, NULL, cnrom_cpu_write, NULL, NULL, NULL,          NULL     },
+    { 4, "MMC3",  mmc3_reset,  NULL, mmc3_cpu_write,  NULL, NULL, mmc3_scanline, mmc3_irq },
+    { 7, "AxROM", axrom_reset, NULL, axrom_cpu_write, NULL, NULL, NULL,          NULL     },
+};
+
+const Mapper* mapper_find(uint16_t number){
+    for(int i = 0; i < (int)(sizeof(mappers) / sizeof(mappers[0])); i++){
+        if(mappers[i].number == number){
+            return &mappers[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,186 @@
+#include "movie.h"
+#include "checksum.h"
+#include "save.h"
+#include "rom.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void put16(uint8_t* out, uint16_t value){
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void put32(uint8_t* out, uint32_t value){
+    put16(out, value);
+    put16(&out[2], value >> 16);
+}
+
+static uint16_t get16(const uint8_t* in){
+    return in[0] | in[1] << 8;
+}
+
+static uint32_t get32(const uint8_t* in){
+    return get16(in) | (uint32_t)get16(&in[2]) << 16;
+}
+
+// The movie belongs to the exact ROM file, header and all (the header decides the mapper and RAM)
+static void movie_hash_rom(Movie* movie, const Cartridge* cart){
+    crc32_init();
+    movie->rom_crc32 = crc32(0, cart->file, cart->file_size);
+
+    SHA1 sha;
+    sha1_init(&sha);
+    sha1_update(&sha, cart->file, cart->file_size);
+    sha1_final(&sha, movie->rom_sha1);
+}
+
+static void movie_header(const Movie* movie, uint8_t* header){
+    memcpy(&header[0], MOVIE_MAGIC, 4);
+    put32(&header[4], MOVIE_VERSION);
+    put32(&header[8], movie->frame_count);
+    put32(&header[12], movie->run_count);
+    put32(&header[16], movie->rom_crc32);
+    memcpy(&header[20], movie->rom_sha1, 20);
+    put32(&header[40], movie->prg_ram_size);
+}
+
+int movie_record(Movie* movie, const char* path, const Cartridge* cart){
+    memset(movie, 0, sizeof(*movie));
+    movie->file = fopen(path, "wb");
+    if(movie->file == NULL){
+        printf("ERROR! Couldn't create movie '%s'.\n", path);
+        return 1;
+    }
+    movie->recording = true;
+    movie_hash_rom(movie, cart);
+
+    // The counts are filled in by movie_close()
+    uint8_t header[MOVIE_HEADER_SIZE];
+    movie->prg_ram_size = cart->prg_ram ? cart->prg_ram_size : 0;
+    movie_header(movie, header);
+    fwrite(header, 1, sizeof(header), movie->file);
+    if(movie->prg_ram_size > 0){
+        fwrite(cart->prg_ram, 1, movie->prg_ram_size, movie->file);
+    }
+
+    printf("Recording movie to '%s'\n", path);
+    return 0;
+}
+
+static void movie_write_run(Movie* movie){
+    uint8_t data[MOVIE_RUN_SIZE];
+    put16(&data[0], movie->current.frames);
+    data[2] = movie->current.buttons[0];
+    data[3] = movie->current.buttons[1];
+    fwrite(data, 1, sizeof(data), movie->file);
+    movie->run_count++;
+}
+
+void movie_record_frame(Movie* movie, const uint8_t buttons[2]){
+    Movie_Run* run = &movie->current;
+    if(run->frames > 0 && (run->frames == MOVIE_RUN_MAX
+        || run->buttons[0] != buttons[0] || run->buttons[1] != buttons[1])){
+        movie_write_run(movie);
+        run->frames = 0;
+    }
+
+    run->buttons[0] = buttons[0];
+    run->buttons[1] = buttons[1];
+    run->frames++;
+    movie->frame_count++;
+}
+
+int movie_play(Movie* movie, const char* path, Cartridge* cart){
+    memset(movie, 0, sizeof(*movie));
+
+    size_t size;
+    uint8_t* data = rom_map_file(path, &size);
+    if(data == NULL){
+        printf("ERROR! Couldn't open movie '%s'.\n", path);
+        return 1;
+    }
+
+    if(size < MOVIE_HEADER_SIZE || memcmp(data, MOVIE_MAGIC, 4) != 0 || get32(&data[4]) != MOVIE_VERSION){
+        printf("ERROR! '%s' is not a movie (or is from another version).\n", path);
+        rom_unmap_file(data, size);
+        return 1;
+    }
+
+    movie->frame_count = get32(&data[8]);
+    movie->run_count = get32(&data[12]);
+    uint32_t prg_ram_size = movie->prg_ram_size = get32(&data[40]);
+    if(size < MOVIE_HEADER_SIZE + prg_ram_size + (size_t)movie->run_count * MOVIE_RUN_SIZE){
+        printf("ERROR! Movie '%s' is truncated.\n", path);
+        rom_unmap_file(data, size);
+        return 1;
+    }
+
+    movie_hash_rom(movie, cart);
+    if(memcmp(movie->rom_sha1, &data[20], 20) != 0){
+        printf("ERROR! Movie '%s' was recorded with a different ROM (CRC32 %.8X, this one is %.8X).\n", path,
+            get32(&data[16]), movie->rom_crc32);
+        rom_unmap_file(data, size);
+        return 1;
+    }
+    if(prg_ram_size != (cart->prg_ram ? cart->prg_ram_size : 0)){
+        printf("ERROR! Movie '%s' has %ukB of PRG RAM, the cartridge %ukB.\n", path, prg_ram_size / 1024,
+            cart->prg_ram_size / 1024);
+        rom_unmap_file(data, size);
+        return 1;
+    }
+
+    // Starting state: the RAM as it was when recording began, without touching the save
+    save_detach(cart);
+    if(prg_ram_size > 0){
+        memcpy(cart->prg_ram, &data[MOVIE_HEADER_SIZE], prg_ram_size);
+    }
+
+    movie->runs = malloc((movie->run_count + 1) * sizeof(Movie_Run));
+    const uint8_t* in = &data[MOVIE_HEADER_SIZE + prg_ram_size];
+    for(uint32_t i = 0; i < movie->run_count; i++){
+        movie->runs[i].frames = get16(&in[i * MOVIE_RUN_SIZE]);
+        movie->runs[i].buttons[0] = in[i * MOVIE_RUN_SIZE + 2];
+        movie->runs[i].buttons[1] = in[i * MOVIE_RUN_SIZE + 3];
+    }
+    rom_unmap_file(data, size);
+
+    printf("Playing movie '%s': %u frames (%.1f minutes)\n", path, movie->frame_count, movie->frame_count / 3600.0);
+    return 0;
+}
+
+void movie_buttons(Movie* movie, uint32_t frame, uint8_t buttons[2]){
+    while(movie->run + 1 < movie->run_count && frame >= movie->run_start + movie->runs[movie->run].frames){
+        movie->run_start += movie->runs[movie->run].frames;
+        movie->run++;
+    }
+
+    if(movie->run_count == 0){
+        buttons[0] = 0;
+        buttons[1] = 0;
+    } else{
+        buttons[0] = movie->runs[movie->run].buttons[0];
+        buttons[1] = movie->runs[movie->run].buttons[1];
+    }
+}
+
+void movie_close(Movie* movie){
+    if(movie->recording && movie->file != NULL){
+        if(movie->current.frames > 0){
+            movie_write_run(movie);
+        }
+
+        // Now the counts are known
+        uint8_t header[MOVIE_HEADER_SIZE];
+        movie_header(movie, header);
+        fseek(movie->file, 0, SEEK_SET);
+        fwrite(header, 1, sizeof(header), movie->file);
+        fclose(movie->file);
+
+        printf("Recorded %u frames (%u runs)\n", movie->frame_count, movie->run_count);
+    }
+
+    free(movie->runs);
+    movie->file = NULL;
+    movie->runs = NULL;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "cartridge.h"
+
+/*  Input movies. Emulation is deterministic: from power on, the same ROM, the same PRG RAM contents and the same
+    buttons at each poll give the same run down to the last cycle. So a movie only needs to hold those, and played
+    back headless it reproduces a whole session exactly, as fast as the host can run it.
+
+    Buttons are kept per frame: with late polling (see System.poll_input) the game sees one host sample per frame,
+    whichever read or strobe in the frame took it. Recording streams runs of identical frames to the file as they
+    end, so a crash loses at most the current run and the header's counts.
+
+    File layout (all integers little-endian):
+        Header      magic "UNCM", version (u32), frame count (u32), run count (u32),
+                    ROM crc32 (u32), ROM sha1 (20 bytes, of the whole .nes file), PRG RAM size (u32)
+        PRG RAM     its contents at power on (a battery save's), PRG RAM size bytes
+        Runs        MOVIE_RUN_SIZE bytes each: frames (u16), port 1 buttons, port 2 buttons (u8 each)
+*/
+
+#define MOVIE_MAGIC         "UNCM"
+#define MOVIE_VERSION       1
+#define MOVIE_HEADER_SIZE   44
+#define MOVIE_RUN_SIZE      4
+#define MOVIE_RUN_MAX       0xFFFF
+
+typedef struct Movie_Run{
+    uint16_t frames;
+    uint8_t buttons[2];
+} Movie_Run;
+
+typedef struct Movie{
+    FILE* file;                 // recording only
+    bool recording;
+
+    uint32_t rom_crc32;
+    uint8_t rom_sha1[20];
+
+    uint32_t prg_ram_size;
+    uint32_t frame_count;
+    uint32_t run_count;
+
+    // Recording: the run still being extended. Playback: every run, and where playback is up to in them.
+    Movie_Run current;
+    Movie_Run* runs;
+    uint32_t run;               // index of the run holding frame run_start
+    uint32_t run_start;
+} Movie;
+
+// Start recording a run from power on, with the cartridge as it is now. Returns 0 on success.
+int movie_record(Movie* movie, const char* path, const Cartridge* cart);
+
+// Recording: the buttons in force for the frame just run
+void movie_record_frame(Movie* movie, const uint8_t buttons[2]);
+
+// Load a movie for playback and put the cartridge into its starting state. The ROM must be the one it was
+// recorded with. A battery save is detached first, so playback never touches the .sav file. Returns 0 on success.
+int movie_play(Movie* movie, const char* path, Cartridge* cart);
+
+// Playback: the buttons for a frame. Frames must be asked for in order; past the end the last buttons hold.
+void movie_buttons(Movie* movie, uint32_t frame, uint8_t buttons[2]);
+
+// Finish a recording (writing out the header) or release a playback
+void movie_close(Movie* movie);
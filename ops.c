@@ -504,8 +504,10 @@ void RTI(CPU* cpu){
     // Pull status register
     cpu->p = stack_pull(cpu);
 
-    // Pull PC
-    cpu->pc = stack_pull(cpu) | (stack_pull(cpu) << 8);
+    // Pull PC (low byte first; kept as separate statements since C doesn't define the order operands are evaluated in)
+    uint8_t low = stack_pull(cpu);
+    uint8_t high = stack_pull(cpu);
+    cpu->pc = low | (high << 8);
 }
 
 /* ------------------------------------ Jumps and Calls ------------------------------------ */
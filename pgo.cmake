@@ -0,0 +1,126 @@
+#   Profile-guided optimisation pipeline. Builds a plain release (LTO) baseline, builds an instrumented copy, runs
+#   bench-e2e's gameplay workload on it to gather a profile, rebuilds the same tree optimised from that profile,
+#   then benchmarks the two builds against each other and reports the speedup.
+#
+#   Usage, from anywhere:
+#       cmake -DWORKLOAD="game.nes;game.ucm;other.nes" [-DFRAMES=N] [-DREPS=N] [-DBUILD_DIR=dir]
+#             [-DCONFIGURE_ARGS="-DCMAKE_C_COMPILER=clang"] -P pgo.cmake
+#
+#   WORKLOAD is bench-e2e's arguments: ROMs, each optionally followed by a movie to play on it. Games that spend
+#   their time the way real play does make the best profile: the CPU's dispatch switch, the ops.c handlers, the
+#   bus and the renderer are laid out and inlined for the paths they actually take.
+#
+#   The results are in BUILD_DIR (default build-pgo next to this file): release/ is the baseline and pgo/ the
+#   optimised build, each with every target. Both builds' bench-e2e results are kept as release.json and pgo.json.
+cmake_minimum_required(VERSION 3.19)
+
+if(NOT WORKLOAD)
+    message(FATAL_ERROR "No workload. Usage: cmake -DWORKLOAD=\"game.nes;game.ucm\" -P pgo.cmake")
+endif()
+if(NOT BUILD_DIR)
+    set(BUILD_DIR ${CMAKE_CURRENT_LIST_DIR}/build-pgo)
+endif()
+if(NOT REPS)
+    set(REPS 5)
+endif()
+get_filename_component(BUILD_DIR ${BUILD_DIR} ABSOLUTE)
+set(release_dir ${BUILD_DIR}/release)
+set(pgo_dir ${BUILD_DIR}/pgo)
+set(profile_dir ${pgo_dir}/pgo-data)
+
+# Relative ROM and movie paths are taken from where this was run
+set(workload_args "")
+foreach(path ${WORKLOAD})
+    get_filename_component(path ${path} ABSOLUTE)
+    list(APPEND workload_args ${path})
+endforeach()
+set(bench_args --instances 1)
+if(FRAMES)
+    list(APPEND bench_args --frames ${FRAMES})
+endif()
+
+function(step description)
+    message(STATUS "${description}")
+    execute_process(COMMAND ${ARGN} COMMAND_ERROR_IS_FATAL ANY)
+endfunction()
+
+function(configure dir pgo)
+    step("Configuring ${dir} (UNICOM_PGO=${pgo})" ${CMAKE_COMMAND} -S ${CMAKE_CURRENT_LIST_DIR} -B ${dir}
+        -DCMAKE_BUILD_TYPE=Release -DUNICOM_PGO=${pgo} -DUNICOM_PGO_DIR=${profile_dir} ${CONFIGURE_ARGS})
+endfunction()
+
+function(build dir)
+    step("Building ${dir} ${ARGN}" ${CMAKE_COMMAND} --build ${dir} --config Release ${ARGN})
+endfunction()
+
+# 1. The baseline: the ordinary release build
+configure(${release_dir} "")
+build(${release_dir})
+
+# 2. Instrumented build, run on the workload. Every bench-e2e instance adds its counts to the profile.
+file(REMOVE_RECURSE ${profile_dir})
+configure(${pgo_dir} GENERATE)
+build(${pgo_dir} --target bench-e2e)
+step("Gathering the profile" ${pgo_dir}/bench-e2e ${bench_args} --reps 1 ${workload_args})
+
+# Clang writes raw profiles, which have to be merged into one before they can be used
+file(GLOB raw_profiles ${profile_dir}/*.profraw)
+if(raw_profiles)
+    find_program(LLVM_PROFDATA NAMES llvm-profdata llvm-profdata-19 llvm-profdata-18 llvm-profdata-17
+        llvm-profdata-16 llvm-profdata-15 llvm-profdata-14)
+    if(NOT LLVM_PROFDATA)
+        message(FATAL_ERROR "Clang's profiles need llvm-profdata to merge them, and it wasn't found")
+    endif()
+    step("Merging the profile" ${LLVM_PROFDATA} merge -output=${profile_dir}/unicom.profdata ${raw_profiles})
+endif()
+
+# 3. The same tree again, optimised from the profile (the object paths have to match the instrumented build's)
+configure(${pgo_dir} USE)
+build(${pgo_dir})
+
+# 4. Baseline against profile-guided, on the same workload
+step("Benchmarking the release build" ${release_dir}/bench-e2e ${bench_args} --reps ${REPS} --label release
+    --json ${BUILD_DIR}/release.json ${workload_args})
+step("Benchmarking the profile-guided build" ${pgo_dir}/bench-e2e ${bench_args} --reps ${REPS} --label pgo
+    --json ${BUILD_DIR}/pgo.json --baseline ${BUILD_DIR}/release.json ${workload_args})
+
+# "123.456" to 12345
+function(hundredths number result)
+    string(REGEX MATCH "^([0-9]+)(\\.([0-9]*))?" match ${number})
+    string(SUBSTRING "${CMAKE_MATCH_3}00" 0 2 fraction)
+    string(REGEX REPLACE "^0+([0-9])" "\\1" value "${CMAKE_MATCH_1}${fraction}")
+    set(${result} ${value} PARENT_SCOPE)
+endfunction()
+
+# The speedup on each ROM, from the two sets of results
+file(READ ${BUILD_DIR}/release.json release_json)
+file(READ ${BUILD_DIR}/pgo.json pgo_json)
+string(JSON count LENGTH ${pgo_json} workloads)
+math(EXPR last "${count} - 1")
+message("")
+message("Profile-guided optimisation, single instance emulated frames per second:")
+foreach(i RANGE ${last})
+    string(JSON rom GET ${pgo_json} workloads ${i} rom)
+    string(JSON after GET ${pgo_json} workloads ${i} fps)
+    string(JSON before GET ${release_json} workloads ${i} fps)
+
+    # CMake's math() is integers only: work in hundredths of a frame and of a percent
+    hundredths(${after} after_hundredths)
+    hundredths(${before} before_hundredths)
+    math(EXPR change "(${after_hundredths} - ${before_hundredths}) * 10000 / ${before_hundredths}")
+    if(change LESS 0)
+        set(sign "-")
+        math(EXPR change "-(${change})")
+    else()
+        set(sign "+")
+    endif()
+    math(EXPR whole "${change} / 100")
+    math(EXPR fraction "${change} % 100")
+    if(fraction LESS 10)
+        set(fraction "0${fraction}")
+    endif()
+    math(EXPR before "${before_hundredths} / 100")
+    math(EXPR after "${after_hundredths} / 100")
+    get_filename_component(name ${rom} NAME)
+    message("    ${name}: ${before} -> ${after} fps (${sign}${whole}.${fraction}%)")
+endforeach()
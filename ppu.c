@@ -1,14 +1,24 @@
 #include <string.h>
-#include <SDL.h>
 
 #include "ppu.h"
 #include "system.h"
+#include "stats.h"
+#include "timeline.h"
 
-uint8_t framebuffer_nt[256 * 960 * 3];	//	3 bytes per pixel, RGB24 - Nametables
-uint8_t framebuffer[FRAME_WIDTH * FRAME_HEIGHT * 3];
+// All four nametables pre-rendered, 1 byte per pixel: palette RAM index (palette * 4 + pixel value)
+uint8_t framebuffer_nt[NAMETABLE_VIEW_WIDTH * NAMETABLE_VIEW_HEIGHT];
+uint8_t framebuffer[FRAME_WIDTH * FRAME_HEIGHT]; // 1 byte per pixel, NES colour index
 
 void ppu_init(PPU* ppu){
-    memset(ppu->memory, 0, sizeof(ppu->memory));
+    // Pattern tables read as blank until a cartridge maps its CHR in
+    static uint8_t no_chr[0x400];
+
+    memset(ppu->vram, 0, sizeof(ppu->vram));
+    memset(ppu->palette, 0, sizeof(ppu->palette));
+
+    for(int page = 0; page < 8; page++){
+        ppu->pages[page] = no_chr;
+    }
     memset(ppu->oam, 0, sizeof(ppu->oam));
 
     ppu->reg_ppuctrl = 0;
@@ -16,26 +26,97 @@ void ppu_init(PPU* ppu){
     ppu->reg_ppustatus = 0;
     ppu->reg_oamaddr = 0;
     //ppu->reg_oamdata = 0;
-    ppu->reg_ppuscroll = 0;
+    //ppu->reg_ppuscroll = 0;
     //ppu->reg_ppuaddr = 0;
     //ppu->reg_ppudata = 0;
     ppu->reg_oamdma = 0;
 
     ppu->ppu_cycles = 0;
     ppu->ppu_scanline = 0;
+    ppu->dots = 0;
 
     ppu->nmi_occurred = false;
 
-    ppu->ppu_addr = 0;
+    ppu->frame_complete = false;
+    ppu->frame_count = 0;
+    ppu->render_skip = false;
+    ppu->frames_rendered = 0;
+    ppu->frames_skipped = 0;
+
+    // Until the frontend swaps buffers, the previous frame is simply whatever is left in the only buffer
+    ppu->previous_framebuffer = framebuffer;
+
+    ppu->line_reuse = true;
+    ppu->frame_unchanged = false;
+    memset(ppu->nametable_row_stamp, 0, sizeof(ppu->nametable_row_stamp));
+    memset(ppu->pattern_stamp, 0, sizeof(ppu->pattern_stamp));
+    ppu->palette_stamp = 0;
+    memset(ppu->oam_line_stamp, 0, sizeof(ppu->oam_line_stamp));
+    memset(ppu->line_stamp, 0, sizeof(ppu->line_stamp));
+    memset(ppu->line_key, 0, sizeof(ppu->line_key));
+    memset(ppu->line_pending_copy, 0, sizeof(ppu->line_pending_copy));
+    ppu->frames_reused = 0;
+    ppu->lines_reused = 0;
+    ppu->lines_rendered = 0;
+
+    // The whole nametable cache starts out dirty
+    ppu->nametable_cache = false;
+    memset(framebuffer_nt, 0, sizeof(framebuffer_nt));
+    memset(ppu->nametable_cache_dirty, 0xFF, sizeof(ppu->nametable_cache_dirty));
+    memset(ppu->chr_tile_dirty, 0, sizeof(ppu->chr_tile_dirty));
+    ppu->nametable_cache_stale = true;
+    ppu->nametable_cache_pattern_table = 0;
+    ppu->frame_start_dots = 0;
+    ppu->cache_tiles_drawn = 0;
+    ppu->cache_fallback_lines = 0;
+
+    ppu_set_mirroring(ppu, MIRROR_HORIZONTAL);
+    ppu->framebuffer = framebuffer;
+    memset(framebuffer, 0, sizeof(framebuffer));
+
     //ppu->ppu_vblank = 0;
 
+    ppu->v = 0;
+    ppu->t = 0;
+    ppu->fine_x = 0;
+    ppu->w = false;
+    memset(ppu->line_scroll, 0, sizeof(ppu->line_scroll));
+
     ppu->ppu_read_buffer = 0;
+}
+
+// ------------ SCROLLING ------------ //
+// Move v one tile right, wrapping into the horizontally adjacent nametable
+static inline uint16_t ppu_increment_coarse_x(uint16_t v){
+    if((v & 0x001F) == 31){
+        return (v & ~0x001F) ^ 0x0400;
+    }
+    return v + 1;
+}
+
+// Move v one pixel down, wrapping into the vertically adjacent nametable after the last row of tiles
+static inline uint16_t ppu_increment_y(uint16_t v){
+    if((v & 0x7000) != 0x7000){
+        return v + 0x1000;
+    }
+
+    v &= ~0x7000;
+    switch(v & 0x03E0){
+        case 29 << 5:   return (v & ~0x03E0) ^ 0x0800;
+        case 31 << 5:   return v & ~0x03E0; // rows 30 and 31 are attribute data; wrap without switching nametable
+        default:        return v + 0x0020;
+    }
+}
+
+static inline void ppu_copy_horizontal(PPU* ppu){
+    ppu->v = (ppu->v & ~0x041F) | (ppu->t & 0x041F);
+}
 
-    ppu->ppu_flag_update = 0;
-    ppu->ppu_latch = 0;
+static inline void ppu_copy_vertical(PPU* ppu){
+    ppu->v = (ppu->v & ~0x7BE0) | (ppu->t & 0x7BE0);
 }
 
-void ppu_step(PPU* ppu, SDL_Renderer* renderer){
+void ppu_step(PPU* ppu){
     /* The following info borrowed (with love) from https://bugzmanov.github.io/nes_ebook/chapter_6_2.html 
     The NMI interrupt is tightly connected to PPU clock cycles:
 
@@ -51,51 +132,534 @@ void ppu_step(PPU* ppu, SDL_Renderer* renderer){
     */
 
     ppu->ppu_cycles++;
+    ppu->dots++;
 
     if(ppu->ppu_cycles >= 341){
         // move to next scanline after set num. cycles
         ppu->ppu_cycles -= 341;
         ppu->ppu_scanline++;
+
+        // 262 scanlines per frame (0 - 261)
+        if(ppu->ppu_scanline >= 262){
+            ppu->ppu_scanline = 0;
+        }
     }
 
+    // v only moves while the background or sprites are enabled
+    bool rendering = ppu->reg_ppumask & 0x18;
+
     if(ppu->ppu_scanline >= 0 && ppu->ppu_scanline <= 239){
         // Visible scanlines (0 - 239)
+        // The whole line is handled in one go once the PPU has finished fetching its visible pixels
+        if(ppu->ppu_cycles == 256){
+            ppu->line_scroll[ppu->ppu_scanline] = (Scroll){ ppu->v, ppu->fine_x };
+
+            if(ppu->render_skip){
+                // No pixels this frame, but games still poll sprite 0 hit/overflow
+                ppu_update_sprite_flags(ppu, ppu->ppu_scanline);
+            } else{
+                uint64_t start = (frame_stats != NULL) ? stats_ticks() : 0;
+                TIMELINE_BEGIN("render scanline");
+                ppu_render_scanline(ppu, ppu->ppu_scanline);
+                TIMELINE_END();
+                if(frame_stats != NULL){
+                    frame_stats->render_ticks += stats_ticks() - start;
+                }
+            }
+
+            if(rendering){
+                ppu->v = ppu_increment_y(ppu->v);
+            }
+        } else if(ppu->ppu_cycles == 257 && rendering){
+            // Back to the left edge for the next line. (The per-tile coarse X increments aren't emulated, as lines
+            // are drawn from line_scroll, so v's horizontal part simply stays at the left edge.)
+            ppu_copy_horizontal(ppu);
+
+        } else if(ppu->ppu_cycles == 260 && rendering){
+            // Sprite pattern fetches begin; MMC3 and friends clock their scanline counters here
+            cartridge_scanline(nes.cart);
+        }
 
     } else if(ppu->ppu_scanline == 241 && ppu->ppu_cycles == 1){
         // Enter vblank phase
         ppu_set_vblank();
-        //printf("vblank... trying to trigger NMI...");
-        // Signal CPU to perform an NMI when it can
-        //if(ppu_get_nmi()){ // read from PPUCTRL
-            printf("NMI NOW");
-            ppu->nmi_occurred = true;
+
+        // The visible part of the frame is finished; let the frontend present it
+        ppu->frame_complete = true;
+        ppu->frame_count++;
+        if(ppu->render_skip){
+            ppu->frames_skipped++;
+        } else{
+            ppu->frames_rendered++;
+            uint64_t start = (frame_stats != NULL) ? stats_ticks() : 0;
+            ppu_finish_frame(ppu);
+            if(frame_stats != NULL){
+                frame_stats->render_ticks += stats_ticks() - start;
+            }
+        }
+
+        // Signal CPU to perform an NMI when it can, if enabled in PPUCTRL
+        ppu->nmi_occurred = true;
+        if(ppu_get_nmi()){
             nes.cpu->nmi = true;
-        //}
-        
+        }
 
-    } else if(ppu->ppu_scanline >= 262 && ppu->ppu_cycles == 1){
+    } else if(ppu->ppu_scanline == 261){
         // Pre-render scanline (-1 or 261)
-        ppu_clear_vblank();
-        ppu->nmi_occurred = false;
-        nes.cpu->nmi = false;
-        ppu->ppu_scanline = 0;
+        if(ppu->ppu_cycles == 1){
+            ppu_clear_vblank();
+            ppu->reg_ppustatus &= 0x9F; // clear sprite 0 hit and sprite overflow
+            ppu->nmi_occurred = false;
+            ppu->frame_start_dots = ppu->dots;
+
+        } else if(ppu->ppu_cycles == 257 && rendering){
+            ppu_copy_horizontal(ppu);
 
+        } else if(ppu->ppu_cycles == 260 && rendering){
+            cartridge_scanline(nes.cart);
+
+        } else if(ppu->ppu_cycles == 304 && rendering){
+            // Real hardware copies on every dot from 280 to 304; only the last one matters
+            ppu_copy_vertical(ppu);
+        }
     }
 }
 
 
-void draw_pattern_table(SDL_Window* window, SDL_Renderer* renderer, uint16_t addr){
-    SDL_Color black = {0, 0, 0, 255};
-    SDL_Color red = {255, 0, 0, 255};
-    SDL_Color green = {0, 255, 0, 255};
-    SDL_Color blue = {0, 0, 255, 255};
+// Everything register-wise that a scanline's pixels depend on
+static uint64_t ppu_scanline_key(PPU* ppu, int scanline){
+    Scroll scroll = ppu->line_scroll[scanline];
+    return ppu->reg_ppuctrl | (ppu->reg_ppumask << 8) | ((uint64_t)scroll.v << 16) | ((uint64_t)scroll.fine_x << 32);
+}
 
-    SDL_Color* col[4] = {
-        &black,
-        &red,
-        &green,
-        &blue
-    };
+// True if nothing this scanline depends on has changed since it was last drawn
+static bool ppu_scanline_reusable(PPU* ppu, int scanline){
+    uint64_t drawn = ppu->line_stamp[scanline];
+
+    if(!ppu->line_reuse || ppu->line_key[scanline] != ppu_scanline_key(ppu, scanline)){
+        return false;
+    }
+
+    // The nametable row the line is drawn from, and the next nametable across if it's scrolled into view
+    Scroll scroll = ppu->line_scroll[scanline];
+    int nametable = (scroll.v >> 10) & 0x3;
+    int row = (scroll.v >> 5) & 0x1F;
+    bool straddles = (scroll.v & 0x1F) || scroll.fine_x;
+
+    if(row >= 30){
+        // Drawing attribute bytes as tiles, which the row stamps don't cover
+        return false;
+    }
+
+    return ppu->palette_stamp < drawn
+        && ppu->pattern_stamp[0] < drawn
+        && ppu->pattern_stamp[1] < drawn
+        && ppu->oam_line_stamp[scanline] < drawn
+        && ppu->nametable_row_stamp[nametable][row] < drawn
+        && (!straddles || ppu->nametable_row_stamp[nametable ^ 1][row] < drawn);
+}
+
+// Called at the end of each drawn frame: fill in reused lines, or flag the whole frame as unchanged
+void ppu_finish_frame(PPU* ppu){
+    ppu->frame_unchanged = true;
+    for(int y = 0; y < FRAME_HEIGHT; y++){
+        if(!ppu->line_pending_copy[y]){
+            ppu->frame_unchanged = false;
+            break;
+        }
+    }
+
+    if(ppu->frame_unchanged){
+        // Nothing to copy; the frontend keeps showing the previous frame
+        ppu->frames_reused++;
+    } else if(ppu->previous_framebuffer != ppu->framebuffer){
+        for(int y = 0; y < FRAME_HEIGHT; y++){
+            if(ppu->line_pending_copy[y]){
+                memcpy(&ppu->framebuffer[y * FRAME_WIDTH], &ppu->previous_framebuffer[y * FRAME_WIDTH], FRAME_WIDTH);
+            }
+        }
+    }
+
+    memset(ppu->line_pending_copy, 0, sizeof(ppu->line_pending_copy));
+}
+
+void ppu_set_framebuffer(PPU* ppu, uint8_t* framebuffer){
+    ppu->previous_framebuffer = ppu->framebuffer;
+    ppu->framebuffer = framebuffer;
+}
+
+const uint8_t* ppu_finished_frame(PPU* ppu){
+    return ppu->frame_unchanged ? ppu->previous_framebuffer : ppu->framebuffer;
+}
+
+void ppu_render_scanline(PPU* ppu, int scanline){
+    if(ppu_scanline_reusable(ppu, scanline)){
+        // Same pixels as last time, but the flags still have to be worked out
+        ppu_update_sprite_flags(ppu, scanline);
+        ppu->line_pending_copy[scanline] = true;
+        ppu->lines_reused++;
+        return;
+    }
+
+    ppu->line_stamp[scanline] = ppu->dots;
+    ppu->line_key[scanline] = ppu_scanline_key(ppu, scanline);
+    ppu->lines_rendered++;
+
+    uint8_t* line = &ppu->framebuffer[scanline * FRAME_WIDTH];
+
+    // Raw background pixel values (0 - 3) for this line, needed for sprite priority and sprite 0 hit
+    uint8_t bg_pixels[FRAME_WIDTH];
+
+    // Colour shown wherever nothing opaque is drawn
+    uint8_t backdrop = ppu_read(0x3F00) & 0x3F;
+
+    if(ppu->reg_ppumask & 0x08){
+        if(ppu_nametable_cache_usable(ppu, scanline)){
+            ppu_compose_background(ppu, scanline, line, bg_pixels);
+        } else{
+            ppu_render_background(ppu, scanline, line, bg_pixels);
+        }
+
+        // PPUMASK bit 1 clear hides the background in the left-most 8 pixels
+        if(!(ppu->reg_ppumask & 0x02)){
+            memset(bg_pixels, 0, 8);
+            memset(line, backdrop, 8);
+        }
+    } else{
+        memset(bg_pixels, 0, sizeof(bg_pixels));
+        memset(line, backdrop, FRAME_WIDTH);
+    }
+
+    if(ppu->reg_ppumask & 0x10){
+        ppu_render_sprites(ppu, scanline, line, bg_pixels);
+    }
+}
+
+int ppu_evaluate_sprites(PPU* ppu, int scanline, uint8_t* found){
+    uint8_t height = (ppu->reg_ppuctrl & 0x20) ? 16 : 8;
+    int count = 0;
+
+    for(int i = 0; i < 64; i++){
+        // Sprites are delayed by one line, so a Y of 0 is first drawn on scanline 1
+        int row = scanline - ppu->oam[i * 4] - 1;
+        if(row < 0 || row >= height){
+            continue;
+        }
+
+        // Only 8 sprites fit on a line. (The real overflow flag is buggy; this sets it on the 9th sprite.)
+        if(count == 8){
+            ppu->reg_ppustatus |= 0x20;
+            break;
+        }
+        found[count++] = i;
+    }
+
+    return count;
+}
+
+// Fetches one row of a sprite's pattern, accounting for vertical flip and 8x16 sprites
+static void ppu_fetch_sprite_row(PPU* ppu, const uint8_t* sprite, int scanline, uint8_t* row_low, uint8_t* row_high){
+    uint8_t height = (ppu->reg_ppuctrl & 0x20) ? 16 : 8;
+    uint8_t tile = sprite[1];
+    int row = scanline - sprite[0] - 1;
+
+    if(sprite[2] & 0x80){
+        // Flip vertically
+        row = height - 1 - row;
+    }
+
+    uint16_t addr;
+    if(height == 16){
+        // 8x16 sprites pick their pattern table from bit 0 of the tile index
+        addr = ((tile & 1) ? 0x1000 : 0) + (tile & 0xFE) * 16;
+        if(row >= 8){
+            addr += 16;
+            row -= 8;
+        }
+    } else{
+        addr = get_sprite_pattern_table_address(ppu) + tile * 16;
+    }
+
+    *row_low = ppu_read(addr + row);
+    *row_high = ppu_read(addr + row + 8);
+}
+
+// ------------ NAMETABLE CACHE ------------ //
+// Where in the 512x480 nametable space a scanline's background starts
+static void ppu_scroll_origin(PPU* ppu, int scanline, int* x, int* y){
+    Scroll scroll = ppu->line_scroll[scanline];
+
+    *x = ((scroll.v >> 10) & 1) * FRAME_WIDTH + (scroll.v & 0x1F) * 8 + scroll.fine_x;
+    *y = ((scroll.v >> 11) & 1) * FRAME_HEIGHT + ((scroll.v >> 5) & 0x1F) * 8 + (scroll.v >> 12);
+}
+
+static void ppu_mark_cache_tile(PPU* ppu, int nametable, int tile_x, int tile_y){
+    int row = (nametable >> 1) * 30 + tile_y;
+    int col = (nametable & 1) * 32 + tile_x;
+
+    ppu->nametable_cache_dirty[row] |= 1ULL << col;
+    ppu->nametable_cache_stale = true;
+}
+
+// Redraws one tile of framebuffer_nt. Rows/columns are counted in tiles across the whole 64x60 cache.
+static void ppu_draw_cache_tile(PPU* ppu, int row, int col){
+    uint16_t nametable = 0x2000 + ((row / 30) * 2 + col / 32) * 0x400;
+    int tile_x = col % 32;
+    int tile_y = row % 30;
+
+    uint8_t tile = ppu_read(nametable + tile_y * 32 + tile_x);
+    uint8_t attribute = ppu_read(nametable + 0x3C0 + (tile_y / 4) * 8 + tile_x / 4);
+    uint8_t palette = (attribute >> (((tile_y & 2) << 1) | (tile_x & 2))) & 0x3;
+    uint16_t addr = ppu->nametable_cache_pattern_table + tile * 16;
+
+    for(int pixel_y = 0; pixel_y < 8; pixel_y++){
+        uint8_t row_low = ppu_read(addr + pixel_y);
+        uint8_t row_high = ppu_read(addr + pixel_y + 8);
+        uint8_t* out = &framebuffer_nt[(row * 8 + pixel_y) * NAMETABLE_VIEW_WIDTH + col * 8];
+
+        for(int pixel_x = 0; pixel_x < 8; pixel_x++){
+            uint8_t value = ((row_high >> (7 - pixel_x)) & 1) << 1 | ((row_low >> (7 - pixel_x)) & 1);
+            out[pixel_x] = (palette << 2) | value;
+        }
+    }
+
+    ppu->cache_tiles_drawn++;
+}
+
+void ppu_update_nametable_cache(PPU* ppu){
+    uint16_t pattern_table = get_pattern_table_address(ppu);
+
+    if(pattern_table != ppu->nametable_cache_pattern_table){
+        // Every tile changes with the pattern table
+        memset(ppu->nametable_cache_dirty, 0xFF, sizeof(ppu->nametable_cache_dirty));
+        ppu->nametable_cache_pattern_table = pattern_table;
+    } else{
+        // Find every tile using a pattern that changed (4 words of chr_tile_dirty per pattern table)
+        uint64_t* chr_dirty = &ppu->chr_tile_dirty[(pattern_table >> 12) * 4];
+
+        if(chr_dirty[0] | chr_dirty[1] | chr_dirty[2] | chr_dirty[3]){
+            for(int nametable = 0; nametable < 4; nametable++){
+                for(int i = 0; i < 960; i++){
+                    uint8_t tile = ppu_read(0x2000 + nametable * 0x400 + i);
+                    if(chr_dirty[tile >> 6] & (1ULL << (tile & 63))){
+                        ppu_mark_cache_tile(ppu, nametable, i % 32, i / 32);
+                    }
+                }
+            }
+        }
+    }
+    memset(ppu->chr_tile_dirty, 0, sizeof(ppu->chr_tile_dirty));
+
+    for(int row = 0; row < 60; row++){
+        uint64_t dirty = ppu->nametable_cache_dirty[row];
+
+        while(dirty){
+            ppu_draw_cache_tile(ppu, row, __builtin_ctzll(dirty));
+            dirty &= dirty - 1; // clear lowest set bit
+        }
+        ppu->nametable_cache_dirty[row] = 0;
+    }
+
+    ppu->nametable_cache_stale = false;
+}
+
+bool ppu_nametable_cache_usable(PPU* ppu, int scanline){
+    if(!ppu->nametable_cache){
+        return false;
+    }
+
+    // Coarse Y of 30 or 31 draws attribute bytes as tiles, which the cache doesn't hold
+    if(((ppu->line_scroll[scanline].v >> 5) & 0x1F) >= 30){
+        ppu->cache_fallback_lines++;
+        return false;
+    }
+
+    // Pattern data or the pattern table changing mid-frame (e.g. CHR bank switching for a status bar) would mean
+    // redrawing much of the cache for a few lines' use, so draw the rest of such a frame directly instead
+    uint16_t pattern_table = get_pattern_table_address(ppu);
+    if(scanline > 0 && (pattern_table != ppu->nametable_cache_pattern_table
+        || ppu->pattern_stamp[pattern_table >> 12] > ppu->frame_start_dots)){
+        ppu->cache_fallback_lines++;
+        return false;
+    }
+
+    return true;
+}
+
+void ppu_compose_background(PPU* ppu, int scanline, uint8_t* line, uint8_t* bg_pixels){
+    if(ppu->nametable_cache_stale || ppu->nametable_cache_pattern_table != get_pattern_table_address(ppu)){
+        ppu_update_nametable_cache(ppu);
+    }
+
+    // The cache holds palette RAM indices, so palette changes never invalidate it. Pixel value 0 is the backdrop.
+    uint8_t backdrop = ppu_read(0x3F00) & 0x3F;
+    uint8_t colours[16];
+    for(int i = 0; i < 16; i++){
+        colours[i] = (i & 3) ? (ppu_read(0x3F00 + i) & 0x3F) : backdrop;
+    }
+
+    int origin_x, origin_y;
+    ppu_scroll_origin(ppu, scanline, &origin_x, &origin_y);
+
+    const uint8_t* src = &framebuffer_nt[(origin_y % NAMETABLE_VIEW_HEIGHT) * NAMETABLE_VIEW_WIDTH];
+
+    for(int x = 0; x < FRAME_WIDTH; x++){
+        uint8_t index = src[(origin_x + x) & (NAMETABLE_VIEW_WIDTH - 1)];
+
+        line[x] = colours[index];
+        bg_pixels[x] = index & 0x3;
+    }
+}
+
+void ppu_render_background(PPU* ppu, int scanline, uint8_t* line, uint8_t* bg_pixels){
+    uint8_t backdrop = ppu_read(0x3F00) & 0x3F;
+
+    uint16_t pattern_table = get_pattern_table_address(ppu);
+    Scroll scroll = ppu->line_scroll[scanline];
+    uint16_t v = scroll.v;
+    int fine_y = v >> 12;
+
+    // 33 tiles, as fine X scroll leaves part of one showing on each side
+    for(int n = 0; n < 33; n++){
+        uint8_t tile = ppu_read(0x2000 | (v & 0x0FFF));
+
+        // Each attribute byte covers a 4x4 block of tiles, with 2 bits of palette for each 2x2 quadrant
+        uint8_t attribute = ppu_read(0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+        uint8_t shift = ((v >> 4) & 0x4) | (v & 0x2);
+        uint8_t palette = (attribute >> shift) & 0x3;
+
+        uint8_t row_low = ppu_read(pattern_table + tile * 16 + fine_y);
+        uint8_t row_high = ppu_read(pattern_table + tile * 16 + fine_y + 8);
+
+        for(int pixel_x = 0; pixel_x < 8; pixel_x++){
+            int x = n * 8 + pixel_x - scroll.fine_x;
+            if(x < 0 || x >= FRAME_WIDTH){
+                continue;
+            }
+
+            // bit 7 of each row is the left-most pixel
+            uint8_t value = ((row_high >> (7 - pixel_x)) & 1) << 1 | ((row_low >> (7 - pixel_x)) & 1);
+
+            bg_pixels[x] = value;
+            line[x] = value ? (ppu_read(0x3F00 + palette * 4 + value) & 0x3F) : backdrop;
+        }
+
+        v = ppu_increment_coarse_x(v);
+    }
+}
+
+void ppu_render_sprites(PPU* ppu, int scanline, uint8_t* line, const uint8_t* bg_pixels){
+    // Marks pixels already claimed by a higher priority (lower index) sprite
+    bool claimed[FRAME_WIDTH];
+    memset(claimed, 0, sizeof(claimed));
+
+    uint8_t found[8];
+    int count = ppu_evaluate_sprites(ppu, scanline, found);
+
+    for(int n = 0; n < count; n++){
+        int i = found[n];
+        uint8_t* sprite = &ppu->oam[i * 4];
+
+        uint8_t attributes = sprite[2];
+        uint8_t sprite_x = sprite[3];
+
+        uint8_t row_low, row_high;
+        ppu_fetch_sprite_row(ppu, sprite, scanline, &row_low, &row_high);
+        uint16_t palette = 0x3F10 + (attributes & 0x3) * 4;
+
+        for(int pixel_x = 0; pixel_x < 8; pixel_x++){
+            int x = sprite_x + pixel_x;
+            if(x >= FRAME_WIDTH){
+                break;
+            }
+
+            // Flip horizontally
+            uint8_t bit = (attributes & 0x40) ? pixel_x : 7 - pixel_x;
+            uint8_t value = ((row_high >> bit) & 1) << 1 | ((row_low >> bit) & 1);
+
+            // PPUMASK bit 2 clear hides sprites in the left-most 8 pixels
+            if(value == 0 || claimed[x] || (x < 8 && !(ppu->reg_ppumask & 0x04))){
+                continue;
+            }
+            claimed[x] = true;
+
+            // Sprite 0 hit: an opaque sprite 0 pixel overlaps an opaque background pixel (never at x == 255)
+            if(i == 0 && bg_pixels[x] && x != 255){
+                ppu->reg_ppustatus |= 0x40;
+            }
+
+            // Bit 5 of the attributes puts the sprite behind opaque background
+            if(!((attributes & 0x20) && bg_pixels[x])){
+                line[x] = ppu_read(palette + value) & 0x3F;
+            }
+        }
+    }
+}
+
+uint8_t ppu_background_pixel(PPU* ppu, int x, int scanline){
+    uint16_t pattern_table = get_pattern_table_address(ppu);
+    Scroll scroll = ppu->line_scroll[scanline];
+
+    // Step v across to the tile under x, wrapping into the next nametable along if need be
+    int pixel = scroll.fine_x + x;
+    uint16_t v = scroll.v;
+    int coarse_x = (v & 0x1F) + pixel / 8;
+    if(coarse_x >= 32){
+        v ^= 0x0400;
+        coarse_x -= 32;
+    }
+    v = (v & ~0x001F) | coarse_x;
+
+    uint8_t tile = ppu_read(0x2000 | (v & 0x0FFF));
+    uint8_t row_low = ppu_read(pattern_table + tile * 16 + (v >> 12));
+    uint8_t row_high = ppu_read(pattern_table + tile * 16 + (v >> 12) + 8);
+    uint8_t bit = 7 - (pixel % 8);
+
+    return ((row_high >> bit) & 1) << 1 | ((row_low >> bit) & 1);
+}
+
+void ppu_update_sprite_flags(PPU* ppu, int scanline){
+    if(!(ppu->reg_ppumask & 0x10)){
+        return;
+    }
+
+    // Sprite overflow
+    uint8_t found[8];
+    int count = ppu_evaluate_sprites(ppu, scanline, found);
+
+    // Sprite 0 hit needs both layers on, and only the first hit in a frame matters
+    if(count == 0 || found[0] != 0 || !(ppu->reg_ppumask & 0x08) || (ppu->reg_ppustatus & 0x40)){
+        return;
+    }
+
+    // Only the 8 pixels sprite 0 covers are worth decoding
+    uint8_t* sprite = ppu->oam;
+    uint8_t row_low, row_high;
+    ppu_fetch_sprite_row(ppu, sprite, scanline, &row_low, &row_high);
+
+    for(int pixel_x = 0; pixel_x < 8; pixel_x++){
+        int x = sprite[3] + pixel_x;
+        if(x >= FRAME_WIDTH - 1){
+            break;
+        }
+
+        // Either layer being clipped on the left hides the hit there too
+        if(x < 8 && (ppu->reg_ppumask & 0x06) != 0x06){
+            continue;
+        }
+
+        uint8_t bit = (sprite[2] & 0x40) ? pixel_x : 7 - pixel_x;
+        if((((row_high >> bit) & 1) | ((row_low >> bit) & 1)) && ppu_background_pixel(ppu, x, scanline)){
+            ppu->reg_ppustatus |= 0x40;
+            return;
+        }
+    }
+}
+
+
+void draw_pattern_table(uint8_t* buffer, int pitch, uint16_t addr){
+    // Grey shades, as there is no sensible palette to pick for a raw pattern table
+    uint8_t colours[4] = { 0x0F, 0x00, 0x10, 0x30 };
 
     // Loop through each tile (visualised as 256 tiles, in a 16x16 grid)
     for(int tile_y = 0; tile_y < 16; tile_y++){
@@ -113,64 +677,217 @@ void draw_pattern_table(SDL_Window* window, SDL_Renderer* renderer, uint16_t add
                 uint8_t row_low = ppu_read(addr + pos + pixel_y);
                 uint8_t row_high = ppu_read(addr + pos + pixel_y + 8);
 
+                uint8_t* out = &buffer[(tile_y * 8 + pixel_y) * pitch + tile_x * 8];
+
                 for(int pixel_x = 0; pixel_x < 8; pixel_x++){
                     uint8_t pixel_val = (row_high & 1) << 1 | (row_low & 1);
-                    // TODO fetch proper colour from palette table
 
                     row_high >>= 1;
                     row_low >>= 1;
 
-                    // Actually draw the pixel now
-                    SDL_SetRenderDrawColor(renderer, col[pixel_val]->r, col[pixel_val]->g, col[pixel_val]->b, col[pixel_val]->a);
-
                     // So far we've technically been reading the tile pixel data from right-to-left, so reverse that
-                    uint8_t draw_x = tile_x * 8 + (7 - pixel_x);
-                    uint8_t draw_y = tile_y * 8 + pixel_y;
+                    out[7 - pixel_x] = colours[pixel_val];
+                }
+            }
 
-                    if(addr == 0x1000){ // draw the table at 0x1000 on the right
-                        SDL_RenderDrawPoint(renderer, draw_x + PATTERN_TABLE_WIDTH, draw_y);
-                    } else{
-                        SDL_RenderDrawPoint(renderer, draw_x, draw_y);
+
+        }
+    }
+}
+
+void draw_nametable(uint8_t* buffer, int pitch){
+    uint16_t pattern_table = get_pattern_table_address(nes.ppu);
+    uint8_t backdrop = ppu_read(0x3F00) & 0x3F;
+
+    // All four nametables, laid out as they are addressed: 0 1 on top, 2 3 below
+    for(int table = 0; table < 4; table++){
+        uint16_t nametable = 0x2000 + table * 0x400;
+        int origin_x = (table & 1) * FRAME_WIDTH;
+        int origin_y = (table >> 1) * FRAME_HEIGHT;
+
+        // Each nametable is 30 rows of 32 tiles
+        for(int tile_y = 0; tile_y < 30; tile_y++){
+            for(int tile_x = 0; tile_x < 32; tile_x++){
+                // Which tile of the pattern table does this link to, and with which palette?
+                uint8_t tile = ppu_read(nametable + tile_y * 32 + tile_x);
+                uint8_t attribute = ppu_read(nametable + 0x3C0 + (tile_y / 4) * 8 + tile_x / 4);
+                uint8_t shift = ((tile_y & 2) << 1) | (tile_x & 2);
+                uint8_t palette = (attribute >> shift) & 0x3;
+
+                // Within the tile, draw each pixel
+                for(int pixel_y = 0; pixel_y < 8; pixel_y++){
+                    uint8_t row_low = ppu_read(pattern_table + tile * 16 + pixel_y);
+                    uint8_t row_high = ppu_read(pattern_table + tile * 16 + pixel_y + 8);
+                    uint8_t* out = &buffer[(origin_y + tile_y * 8 + pixel_y) * pitch + origin_x + tile_x * 8];
+
+                    for(int pixel_x = 0; pixel_x < 8; pixel_x++){
+                        uint8_t value = ((row_high >> (7 - pixel_x)) & 1) << 1 | ((row_low >> (7 - pixel_x)) & 1);
+                        out[pixel_x] = value ? (ppu_read(0x3F00 + palette * 4 + value) & 0x3F) : backdrop;
                     }
                 }
             }
+        }
+    }
+}
 
 
+uint16_t get_pattern_table_address(PPU* ppu){
+    // read the pattern table address from PPUCTRL bit 4 (0 == 0x0000, 1 == 0x1000)
+    return (ppu->reg_ppuctrl & 0x10) ? 0x1000 : 0; 
+}
+
+uint16_t get_sprite_pattern_table_address(PPU* ppu){
+    // 8x8 sprites read their pattern table address from PPUCTRL bit 3 (0 == 0x0000, 1 == 0x1000)
+    return (ppu->reg_ppuctrl & 0x08) ? 0x1000 : 0;
+}
+
+// ------------ ADDRESS MAP ------------ //
+void ppu_set_mirroring(PPU* ppu, Mirroring mirroring){
+    // Which 1kB of VRAM each of the four nametables uses
+    static const uint8_t layouts[5][4] = {
+        {0, 0, 1, 1},   // horizontal
+        {0, 1, 0, 1},   // vertical
+        {0, 0, 0, 0},   // single screen, low
+        {1, 1, 1, 1},   // single screen, high
+        {0, 1, 2, 3}    // four screen
+    };
+
+    for(int nametable = 0; nametable < 4; nametable++){
+        uint8_t* page = &ppu->vram[layouts[mirroring][nametable] * 0x400];
+        ppu->pages[8 + nametable] = page;
+        ppu->pages[12 + nametable] = page; // $3000-$3EFF
+    }
+    ppu->mirroring = mirroring;
+
+    // Everything on screen may have changed
+    for(int nametable = 0; nametable < 4; nametable++){
+        for(int row = 0; row < 30; row++){
+            ppu->nametable_row_stamp[nametable][row] = ppu->dots;
         }
     }
+    memset(ppu->nametable_cache_dirty, 0xFF, sizeof(ppu->nametable_cache_dirty));
+    ppu->nametable_cache_stale = true;
+}
+
+void ppu_set_pattern_page(PPU* ppu, int page, uint8_t* memory){
+    if(ppu->pages[page] == memory){
+        return;
+    }
+    ppu->pages[page] = memory;
+
+    // Each 1kB page is 64 tiles, which is exactly one word of chr_tile_dirty
+    ppu->pattern_stamp[page >> 2] = ppu->dots;
+    ppu->chr_tile_dirty[page] = ~0ULL;
+    ppu->nametable_cache_stale = true;
 }
 
-void draw_nametable(SDL_Renderer* renderer){
-    SDL_Color black = {0, 0, 0, 255};
-    SDL_Color red = {255, 0, 0, 255};
-    SDL_Color green = {0, 255, 0, 255};
-    SDL_Color blue = {0, 0, 255, 255};
+uint8_t ppu_palette_index(uint16_t addr){
+    uint8_t index = addr & 0x1F;
 
-    SDL_Color* colour[4] = {
-        &black,
-        &red,
-        &green,
-        &blue
-    };
+    // The sprite palettes' entry 0 ($3F10/$3F14/$3F18/$3F1C) is the same byte as the background palettes' entry 0
+    if((index & 0x13) == 0x10){
+        index &= 0x0F;
+    }
+    return index;
+}
+
+// ------------ DIRTY TRACKING ------------ //
+void ppu_invalidate(PPU* ppu){
+    // No scanline key matches all ones, so every line is drawn afresh
+    memset(ppu->line_key, 0xFF, sizeof(ppu->line_key));
+    memset(ppu->line_pending_copy, 0, sizeof(ppu->line_pending_copy));
+
+    memset(ppu->nametable_cache_dirty, 0xFF, sizeof(ppu->nametable_cache_dirty));
+    memset(ppu->chr_tile_dirty, 0xFF, sizeof(ppu->chr_tile_dirty));
+    ppu->nametable_cache_stale = true;
+    ppu->frame_unchanged = false;
+}
+
+void ppu_mark_dirty(PPU* ppu, uint16_t addr){
+    addr &= 0x3FFF;
+
+    if(addr < 0x2000){
+        // Pattern tables
+        ppu->pattern_stamp[addr >> 12] = ppu->dots;
 
-    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, FRAME_WIDTH, FRAME_HEIGHT);
+        // 16 bytes per tile
+        ppu->chr_tile_dirty[addr >> 10] |= 1ULL << ((addr >> 4) & 63);
+        ppu->nametable_cache_stale = true;
 
-    // What is the current nametable?
+    } else if(addr < 0x3F00){
+        // Nametables (and their mirrors at 0x3000). Every nametable sharing the written page has changed.
+        uint8_t* written = ppu->pages[addr >> 10];
+        uint16_t offset = addr & 0x3FF;
 
-    // What is the current position in the name table? (It is 30 rows, 32 tiles on each row)
+        for(int nametable = 0; nametable < 4; nametable++){
+            if(ppu->pages[8 + nametable] != written){
+                continue;
+            }
 
-        // What tile of the pattern table does this link to?
+            if(offset < 0x3C0){
+                ppu->nametable_row_stamp[nametable][offset / 32] = ppu->dots;
+                ppu_mark_cache_tile(ppu, nametable, offset % 32, offset / 32);
+            } else{
+                // Each attribute byte covers a 4x4 block of tiles
+                int first_col = ((offset - 0x3C0) % 8) * 4;
+                int first_row = ((offset - 0x3C0) / 8) * 4;
+                for(int row = first_row; row < first_row + 4 && row < 30; row++){
+                    ppu->nametable_row_stamp[nametable][row] = ppu->dots;
+                    for(int col = first_col; col < first_col + 4; col++){
+                        ppu_mark_cache_tile(ppu, nametable, col, row);
+                    }
+                }
+            }
+        }
 
-            // Within the tile, draw each pixel
+    } else{
+        // Palette
+        ppu->palette_stamp = ppu->dots;
+    }
+}
 
-    SDL_UpdateTexture(texture, NULL, framebuffer, 256 * sizeof(unsigned char) * 3);
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
+// Stamps every line a sprite could currently cover (assuming the larger 8x16 size)
+static void ppu_mark_sprite_lines(PPU* ppu, uint8_t sprite){
+    int top = ppu->oam[sprite * 4] + 1;
+    for(int y = top; y < top + 16 && y < FRAME_HEIGHT; y++){
+        ppu->oam_line_stamp[y] = ppu->dots;
+    }
 }
 
+void ppu_write_oam(PPU* ppu, uint8_t index, uint8_t data){
+    if(ppu->oam[index] == data){
+        return;
+    }
 
-uint16_t get_pattern_table_address(PPU* ppu){
-    // read the pattern table address from PPUCTRL bit 4 (0 == 0x0000, 1 == 0x1000)
-    return (ppu->reg_ppuctrl & 0x10) ? 0x1000 : 0; 
+    // Both where the sprite was and where it is now need redrawing
+    ppu_mark_sprite_lines(ppu, index / 4);
+    ppu->oam[index] = data;
+    ppu_mark_sprite_lines(ppu, index / 4);
+}
+
+void ppu_write_oam_page(PPU* ppu, uint8_t start, const uint8_t* data){
+    // Games usually DMA from offset 0, and often the same data as last frame
+    uint8_t rotated[256];
+    if(start != 0){
+        memcpy(&rotated[start], data, 256 - start);
+        memcpy(rotated, &data[256 - start], start);
+        data = rotated;
+    } else if(memcmp(ppu->oam, data, 256) == 0){
+        return;
+    }
+
+    // Only sprites that actually changed need their lines redrawn
+    for(int sprite = 0; sprite < 64; sprite++){
+        uint8_t* old = &ppu->oam[sprite * 4];
+        const uint8_t* new = &data[sprite * 4];
+        if(memcmp(old, new, 4) == 0){
+            continue;
+        }
+
+        ppu_mark_sprite_lines(ppu, sprite);
+        memcpy(old, new, 4);
+        ppu_mark_sprite_lines(ppu, sprite);
+    }
 }
 
 // ------------ DATA READ/WRITE ------------ //
@@ -190,9 +907,8 @@ uint8_t ppu_read_register(uint16_t addr){
 uint8_t ppu_read_PPUSTATUS(){
     uint8_t data = nes.ppu->reg_ppustatus;
 
-    // reading this register resets the latch
-    nes.ppu->ppu_flag_update = 0;
-    nes.ppu->ppu_latch = 0;
+    // reading this register resets the write toggle
+    nes.ppu->w = false;
 
     // Also, clear the VBLANK flag (bit 7) in PPUSTATUS
     ppu_clear_vblank();
@@ -207,14 +923,19 @@ uint8_t ppu_read_OAMDATA(){
 
 uint8_t ppu_read_PPUDATA(){
     uint8_t data;
-    if(nes.ppu->ppu_addr <=0x3eff){
+    uint16_t addr = nes.ppu->v & 0x3FFF;
+    if(addr <= 0x3eff){
         // emulate buffered read
         data = nes.ppu->ppu_read_buffer;
-        nes.ppu->ppu_read_buffer = ppu_read(nes.ppu->ppu_addr);
+        nes.ppu->ppu_read_buffer = ppu_read(addr);
     } else{
-        // palette data isn't buffered
-        data = nes.ppu->ppu_read_buffer;
+        // palette data isn't buffered, but the buffer is filled with the nametable byte 'underneath' it
+        data = ppu_read(addr);
+        nes.ppu->ppu_read_buffer = ppu_read(addr - 0x1000);
     }
+
+    // Reads move the address on just like writes do
+    nes.ppu->v = (nes.ppu->v + ppu_get_vram_addr_increment()) & 0x7FFF;
     return data;
 }
 
@@ -227,7 +948,6 @@ void ppu_write_register(uint16_t addr, uint8_t data){
         case PPUSCROLL: ppu_write_PPUSCROLL(data);  break;
         case PPUADDR:   ppu_write_PPUADDR(data);    break;
         case PPUDATA:   ppu_write_PPUDATA(data);    break;
-        case OAMDMA:    ppu_write_OAMDMA(data);     break;
         default:
             printf("Error! Trying to write to PPU reg. %.4X\n", addr);
             break;
@@ -235,7 +955,15 @@ void ppu_write_register(uint16_t addr, uint8_t data){
 }
 
 void ppu_write_PPUCTRL(uint8_t data){
+    // Enabling NMIs while already in vblank fires one straight away
+    if(!(nes.ppu->reg_ppuctrl & 0x80) && (data & 0x80) && ppu_get_vblank()){
+        nes.cpu->nmi = true;
+    }
+
     nes.ppu->reg_ppuctrl = data;
+
+    // The base nametable bits are really the nametable bits of t
+    nes.ppu->t = (nes.ppu->t & ~0x0C00) | ((data & 0x03) << 10);
 }
 
 void ppu_write_PPUMASK(uint8_t data){
@@ -248,49 +976,69 @@ void ppu_write_OAMADDR(uint8_t data){
 
 void ppu_write_OAMDATA(uint8_t data){
     //nes.ppu->reg_oamdata = data;
-    nes.ppu->oam[nes.ppu->reg_oamaddr] = data;
+    ppu_write_oam(nes.ppu, nes.ppu->reg_oamaddr, data);
     nes.ppu->reg_oamaddr++;
     
 
 }
 
 void ppu_write_PPUSCROLL(uint8_t data){
-    nes.ppu->reg_ppuscroll = data;
+    // 2xwrite: X scroll, then Y scroll
+    if(!nes.ppu->w){
+        nes.ppu->t = (nes.ppu->t & ~0x001F) | (data >> 3);
+        nes.ppu->fine_x = data & 0x07;
+    } else{
+        nes.ppu->t = (nes.ppu->t & ~0x73E0) | ((data & 0x07) << 12) | ((data & 0xF8) << 2);
+    }
+    nes.ppu->w = !nes.ppu->w;
 }
 
 void ppu_write_PPUADDR(uint8_t data){
-    // 2xwrite
-    // Load data into a buffer, then on 2nd write copy combined data to the actual register
-    if(nes.ppu->ppu_flag_update == 1){
-        nes.ppu->ppu_addr = (uint16_t)nes.ppu->ppu_latch | data;
-        nes.ppu->ppu_latch = data; // write the new data to buf.; not really needed but oh well
-        nes.ppu->ppu_flag_update = 0;
+    // 2xwrite: high byte (top 6 bits only), then low byte. The address only takes effect on the 2nd write, when t is
+    // copied to v; this is also how games change scroll position mid-frame.
+    if(!nes.ppu->w){
+        nes.ppu->t = (nes.ppu->t & 0x00FF) | ((data & 0x3F) << 8);
     } else{
-        nes.ppu->ppu_latch = data;
-        nes.ppu->ppu_flag_update = 1;
+        nes.ppu->t = (nes.ppu->t & 0xFF00) | data;
+        nes.ppu->v = nes.ppu->t;
     }
+    nes.ppu->w = !nes.ppu->w;
 }
 
 void ppu_write_PPUDATA(uint8_t data){
     //nes.ppu->reg_ppudata = data;
-    // write data to address stored in ppu.ppu_addr
-    ppu_write(nes.ppu->ppu_addr, data);
+    // write data to address stored in v
+    ppu_write(nes.ppu->v, data);
 
     // increment address by 1 or 32
-    nes.ppu->ppu_addr += ppu_get_vram_addr_increment();
+    nes.ppu->v = (nes.ppu->v + ppu_get_vram_addr_increment()) & 0x7FFF;
 }
 
 void ppu_write_OAMDMA(uint8_t data){
-    // fill the entire OAM with data from 0x??00 to 0x??FF in CPU memory
-    uint16_t addr = (uint16_t)nes.ppu->reg_oamaddr << 8;
-
-    for (int i = 0; i < 0x100; i++)
-    {
-        nes.ppu->oam[i] = read((addr | i));
+    // fill the entire OAM with data from 0x??00 to 0x??FF in CPU memory, where ?? is the value written
+    nes.ppu->reg_oamdma = data;
+    TIMELINE_BEGIN("OAM DMA");
+
+    const uint8_t* page = read_page(data);
+    uint8_t buffer[256];
+    if(page == NULL){
+        // A page of registers; every read has to go through the bus for its side effects
+        uint16_t addr = (uint16_t)data << 8;
+        for(int i = 0; i < 0x100; i++){
+            buffer[i] = read(addr | i);
+        }
+        page = buffer;
     }
+
+    ppu_write_oam_page(nes.ppu, nes.ppu->reg_oamaddr, page);
+    TIMELINE_END();
+
+    // The CPU is halted while the DMA unit does 256 reads and 256 writes, plus one setup cycle (and one more to align
+    // on odd cycles, added by cpu_step())
+    nes.cpu->stall += 513;
 }
 
-uint8_t ppu_get_base_nametable_addr(){
+uint16_t ppu_get_base_nametable_addr(){
     uint8_t val = nes.ppu->reg_ppuctrl & 0x3;
     uint16_t addr;
     switch(val){
@@ -304,7 +1052,7 @@ uint8_t ppu_get_base_nametable_addr(){
 
 uint8_t ppu_get_vram_addr_increment(){
     // value in bit 2 of PPUCTRL reg determines value to increment vram
-    // address (ppu.ppu_addr) by after write (0 == 1, 1 == 32);
+    // address (ppu.v) by after write (0 == 1, 1 == 32);
     return (nes.ppu->reg_ppuctrl & 0x4) ? 32 : 1; 
 }
 
@@ -312,7 +1060,6 @@ uint8_t ppu_get_nmi(){
     // read bit 7 of PPUCTRL to determine if an NMI should be generated
     // at start of VBLANK
     uint8_t data = nes.ppu->reg_ppuctrl & 0x80;
-    printf("NMI Status: %d\n", data);
     return (data); 
 }
 
@@ -321,7 +1068,7 @@ uint8_t ppu_get_vblank(){
 }
 
 void ppu_set_vblank(){
-    nes.ppu->reg_ppustatus &= 0xFF; // 11111111
+    nes.ppu->reg_ppustatus |= 0x80; // 10000000
 }
 
 void ppu_clear_vblank(){
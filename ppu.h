@@ -1,7 +1,6 @@
 #pragma once
 
 #include <stdint.h>
-#include <SDL.h>
 #include <stdbool.h>
 
 /*  PPU Memory Map:
@@ -25,9 +24,34 @@
 #define PATTERN_TABLE_HEIGHT 128
 #define FRAME_WIDTH 256
 #define FRAME_HEIGHT 240
+#define NAMETABLE_VIEW_WIDTH  512
+#define NAMETABLE_VIEW_HEIGHT 480
+
+// Nametable arrangements, numbered as in bit 0 of iNES header flags 6
+typedef enum Mirroring {
+    MIRROR_HORIZONTAL,  // $2000 = $2400, $2800 = $2C00
+    MIRROR_VERTICAL,    // $2000 = $2800, $2400 = $2C00
+    MIRROR_SINGLE_LOW,  // all four use the first 1kB of VRAM
+    MIRROR_SINGLE_HIGH, // all four use the second 1kB of VRAM
+    MIRROR_FOUR_SCREEN  // four separate nametables (cartridge supplies the other 2kB)
+} Mirroring;
+
+// Scroll state a scanline is drawn from, in the same layout as the internal v register (see PPU.v)
+typedef struct Scroll{
+    uint16_t v;
+    uint8_t fine_x;
+} Scroll;
 
 typedef struct PPU{
-    uint8_t memory[0x4000]; // 16kB memory
+    /*  The address space is split into sixteen 1kB pages, each a pointer to where that page's memory really
+        lives, so reads/writes are just a shift, an index and a load. Pages 0-7 are the pattern tables (the
+        cartridge's CHR, mapped in by its mapper), 8-11 the four nametables and 12-15 the $3000-$3EFF mirror of
+        them. Mirroring or bank switching only swaps pointers. $3F00-$3FFF (palette) is the one special case.
+    */
+    uint8_t* pages[16];
+    uint8_t vram[0x1000];   // 2kB nametable RAM, plus 2kB more for four-screen cartridges
+    uint8_t palette[32];
+    Mirroring mirroring;
     uint8_t oam[256]; // 256 bytes Object Attribute Memory
 
     // Registers - any commented out are handled by other functions
@@ -35,7 +59,7 @@ typedef struct PPU{
     uint8_t reg_ppumask;
     uint8_t reg_ppustatus;
     uint8_t reg_oamaddr;
-    uint8_t reg_ppuscroll;
+    // uint8_t reg_ppuscroll;
     uint8_t reg_oamdma;
     // uint8_t reg_oamdata;
     // uint8_t reg_ppuaddr;
@@ -43,15 +67,76 @@ typedef struct PPU{
     
     int ppu_cycles;
     int ppu_scanline;
+    uint64_t dots; // PPU cycles since power on
 
     bool nmi_occurred;
 
-    uint16_t ppu_addr;
-    uint8_t ppu_read_buffer;
+    // Set upon entering vblank, once the last visible scanline has been drawn. Cleared by whoever consumes the frame.
+    bool frame_complete;
+    uint32_t frame_count;
+
+    // If set, the PPU keeps its timing and status flags (vblank, NMI, sprite 0 hit, overflow) but doesn't draw
+    // any pixels. Frontends set this per frame to skip frames.
+    bool render_skip;
+    uint32_t frames_rendered;
+    uint32_t frames_skipped;
+
+    // The last frame handed to the frontend, which reused scanlines are copied from. Use ppu_set_framebuffer()
+    // when swapping buffers so this stays correct.
+    uint8_t* previous_framebuffer;
+
+    /*  Dirty tracking. Every write that changes something visible is stamped with the dot it happened on, and
+        every drawn scanline remembers the dot it was drawn on and the registers it was drawn with. A line whose
+        inputs haven't changed since is reused from the previous frame instead of being drawn again. If no line
+        in a frame needed drawing, frame_unchanged is set and the frontend needn't upload it at all.
+    */
+    bool line_reuse;
+    bool frame_unchanged;
+
+    uint64_t nametable_row_stamp[4][30]; // per row of tiles; attribute writes stamp the rows they cover
+    uint64_t pattern_stamp[2];
+    uint64_t palette_stamp;
+    uint64_t oam_line_stamp[FRAME_HEIGHT];
+
+    uint64_t line_stamp[FRAME_HEIGHT];
+    uint64_t line_key[FRAME_HEIGHT];
+    bool line_pending_copy[FRAME_HEIGHT];
+
+    uint32_t frames_reused;
+    uint32_t lines_reused;
+    uint32_t lines_rendered;
+
+    /*  Nametable cache mode. All four nametables are kept drawn in framebuffer_nt (512x480, palette RAM indices),
+        and each scanline's background becomes a scroll-offset copy out of it. Only tiles whose nametable,
+        attribute or pattern bytes changed get redrawn.
+    */
+    bool nametable_cache;
+    bool nametable_cache_stale;                 // something below is marked dirty
+    uint64_t nametable_cache_dirty[60];         // one bit per tile, per row of tiles in the cache
+    uint64_t chr_tile_dirty[8];                 // one bit per pattern table tile (512)
+    uint16_t nametable_cache_pattern_table;     // the pattern table the cache was drawn from
+    uint64_t frame_start_dots;                  // dot the current frame started on
+    uint32_t cache_tiles_drawn;
+    uint32_t cache_fallback_lines;
+
+    // The frame currently being drawn, one NES colour index (0 - 63) per pixel. Converting to host colours is left to
+    // the frontend, so the PPU never touches SDL.
+    uint8_t* framebuffer;
+
+    /*  Internal scroll/address registers (see https://www.nesdev.org/wiki/PPU_scrolling). PPUSCROLL, PPUADDR
+        and PPUCTRL all write into t; v is the address PPUDATA uses and, while rendering, the position being drawn.
+        Both are 15 bits laid out as yyy NN YYYYY XXXXX (fine Y, nametable, coarse Y, coarse X).
+    */
+    uint16_t v;
+    uint16_t t;
+    uint8_t fine_x;
+    bool w;         // write toggle shared by PPUSCROLL and PPUADDR; false means the next write is the first
+
+    // Scroll state each visible scanline is drawn from, captured as the line is reached. Mid-frame scroll changes
+    // (status bars, split screens) just show up as different entries.
+    Scroll line_scroll[FRAME_HEIGHT];
 
-    // Intermediary storage (e.g. addr register buffer)
-    uint8_t ppu_flag_update; // if 1, signals its time to write address to ppu_addr
-    uint8_t ppu_latch;
+    uint8_t ppu_read_buffer;
 } PPU;
 
 // PPU register locations within CPU memory 0x2000 - 0x2007
@@ -68,7 +153,50 @@ typedef enum PPU_Reg {
 } PPU_Reg;
 
 void ppu_init(PPU* ppu);
-void ppu_step(PPU* ppu, SDL_Renderer* renderer);
+void ppu_step(PPU* ppu);
+void ppu_render_scanline(PPU* ppu, int scanline);
+void ppu_finish_frame(PPU* ppu);
+void ppu_render_background(PPU* ppu, int scanline, uint8_t* line, uint8_t* bg_pixels);
+void ppu_render_sprites(PPU* ppu, int scanline, uint8_t* line, const uint8_t* bg_pixels);
+
+// Nametable cache mode
+void ppu_update_nametable_cache(PPU* ppu);
+bool ppu_nametable_cache_usable(PPU* ppu, int scanline);
+void ppu_compose_background(PPU* ppu, int scanline, uint8_t* line, uint8_t* bg_pixels);
+
+// Point the four nametables at VRAM according to a mirroring arrangement
+void ppu_set_mirroring(PPU* ppu, Mirroring mirroring);
+
+// Point one 1kB page of pattern memory (0 - 7) somewhere else, e.g. for mapper CHR bank switching
+void ppu_set_pattern_page(PPU* ppu, int page, uint8_t* memory);
+
+// Palette RAM index (0 - 31) for an address in $3F00-$3FFF, resolving the $3F10/$3F14/$3F18/$3F1C aliases
+uint8_t ppu_palette_index(uint16_t addr);
+
+// Swap in a new buffer to draw into; the old one becomes the reference for reused scanlines
+void ppu_set_framebuffer(PPU* ppu, uint8_t* framebuffer);
+
+// The frame just finished, as it will be shown. An unchanged frame isn't drawn again; the previous one stays up.
+const uint8_t* ppu_finished_frame(PPU* ppu);
+
+// Record that a write to PPU memory changed the picture, for dirty tracking
+void ppu_mark_dirty(PPU* ppu, uint16_t addr);
+
+// Treat everything as changed, so nothing drawn before is reused (e.g. after memory is replaced by a state load)
+void ppu_invalidate(PPU* ppu);
+void ppu_write_oam(PPU* ppu, uint8_t index, uint8_t data);
+
+// Write all 256 bytes of OAM at once, the first going to index start and wrapping around (OAM DMA)
+void ppu_write_oam_page(PPU* ppu, uint8_t start, const uint8_t* data);
+
+// Finds the (up to 8) sprites on a scanline in OAM order, setting the overflow flag. Returns how many were found.
+int ppu_evaluate_sprites(PPU* ppu, int scanline, uint8_t* found);
+
+// Raw background pixel value (0 - 3) at a point on screen
+uint8_t ppu_background_pixel(PPU* ppu, int x, int scanline);
+
+// The part of ppu_render_scanline() that still has to happen when not drawing: sprite overflow and sprite 0 hit
+void ppu_update_sprite_flags(PPU* ppu, int scanline);
 
 uint8_t ppu_read_register(uint16_t addr);
 uint8_t ppu_read_PPUSTATUS();
@@ -88,13 +216,15 @@ void ppu_write_OAMDMA(uint8_t data);
 
 
 uint8_t ppu_get_vram_addr_increment();
-uint8_t ppu_get_base_nametable_addr();
+uint16_t ppu_get_base_nametable_addr();
 uint8_t ppu_get_nmi();
 uint8_t ppu_get_vblank();
 void ppu_set_vblank();
 void ppu_clear_vblank();
 
-void draw_pattern_table(SDL_Window* window, SDL_Renderer* renderer, uint16_t addr);
-void draw_nametable(SDL_Renderer* renderer);
+// Debug views. Both write NES colour indices into an indexed buffer of the given pitch (in pixels).
+void draw_pattern_table(uint8_t* buffer, int pitch, uint16_t addr);
+void draw_nametable(uint8_t* buffer, int pitch);
 uint16_t get_pattern_table_address(PPU* ppu);
+uint16_t get_sprite_pattern_table_address(PPU* ppu);
 
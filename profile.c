@@ -0,0 +1,310 @@
+#include "profile.h"
+#include "system.h"
+#include "cartridge.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Profile* profile = NULL;
+
+// Where an address is: CPU address below $8000, $8000 + PRG ROM offset above, so banks are told apart
+static uint32_t profile_location(uint16_t addr){
+    const uint8_t* page = (addr >= 0x8000) ? nes.cart->prg_pages[1 + (addr - 0x8000) / PRG_PAGE_SIZE] : NULL;
+    if(page == NULL){
+        return addr;
+    }
+    return 0x8000 + (page - nes.cart->prg_rom) + (addr & (PRG_PAGE_SIZE - 1));
+}
+
+static void profile_name(const Profile_Node* node, char* name, int size){
+    if(node->kind == PROFILE_ROOT){
+        snprintf(name, size, "main");
+    } else if(node->kind == PROFILE_NMI){
+        snprintf(name, size, "NMI");
+    } else if(node->kind == PROFILE_IRQ){
+        snprintf(name, size, "IRQ");
+    } else if(node->location >= 0x8000 && nes.cart->prg_rom_size > 0x8000){
+        snprintf(name, size, "%.2X:%.4X", (node->location - 0x8000) / PRG_PAGE_SIZE,
+            profile->addresses[node->location]);
+    } else{
+        snprintf(name, size, "%.4X", profile->addresses[node->location]);
+    }
+}
+
+int profile_start(const char* path){
+    Profile* p = calloc(1, sizeof(Profile));
+    if(p == NULL){
+        return 1;
+    }
+    p->path = path;
+    p->locations = 0x8000 + nes.cart->prg_rom_size;
+    p->cycles = calloc(p->locations, sizeof(uint64_t));
+    p->opcodes = calloc(p->locations, sizeof(uint8_t));
+    p->addresses = calloc(p->locations, sizeof(uint16_t));
+    p->nodes = calloc(PROFILE_MAX_NODES, sizeof(Profile_Node));
+    if(p->cycles == NULL || p->opcodes == NULL || p->addresses == NULL || p->nodes == NULL){
+        printf("ERROR! Not enough memory to profile.\n");
+        free(p->cycles);
+        free(p->opcodes);
+        free(p->addresses);
+        free(p->nodes);
+        free(p);
+        return 1;
+    }
+
+    // Whatever runs outside any subroutine
+    p->nodes[0] = (Profile_Node){ .kind = PROFILE_ROOT, .parent = -1, .child = -1, .sibling = -1 };
+    p->node_count = 1;
+    p->stack[0] = (Profile_Frame){ 0, 0xFF };
+    p->depth = 1;
+
+    profile = p;
+    return 0;
+}
+
+// Enter a subroutine from the current call path
+static void profile_call(Profile_Kind kind, uint32_t location, uint8_t s){
+    Profile* p = profile;
+    int32_t parent = p->stack[p->depth - 1].node;
+
+    int32_t node = p->nodes[parent].child;
+    while(node >= 0 && (p->nodes[node].location != location || p->nodes[node].kind != kind)){
+        node = p->nodes[node].sibling;
+    }
+    if(node < 0){
+        if(p->node_count == PROFILE_MAX_NODES){
+            // Out of room: the callee's cycles go to its caller
+            p->nodes_full = true;
+            node = parent;
+        } else{
+            node = p->node_count++;
+            p->nodes[node] = (Profile_Node){ .location = location, .kind = kind, .parent = parent, .child = -1,
+                .sibling = p->nodes[parent].child };
+            p->nodes[parent].child = node;
+        }
+    }
+    p->nodes[node].calls++;
+
+    if(p->depth < PROFILE_MAX_DEPTH){
+        p->stack[p->depth++] = (Profile_Frame){ node, s };
+        if(kind == PROFILE_NMI){
+            p->nmi_depth++;
+        }
+    }
+}
+
+// Leave every subroutine the stack pointer has risen back out of (RTS, RTI, or dropping the return address)
+static void profile_return(uint8_t s){
+    Profile* p = profile;
+    while(p->depth > 1 && s > p->stack[p->depth - 1].s){
+        p->depth--;
+        if(p->nodes[p->stack[p->depth].node].kind == PROFILE_NMI){
+            p->nmi_depth--;
+        }
+    }
+}
+
+// Cycles spent in the current subroutine
+static void profile_charge(int cycles){
+    Profile* p = profile;
+    p->nodes[p->stack[p->depth - 1].node].self += cycles;
+    p->total += cycles;
+    if(p->nmi_depth > 0){
+        p->frame_nmi += cycles;
+    }
+}
+
+void profile_interrupt(CPU* cpu, Profile_Kind kind, int cycles){
+    uint32_t location = profile_location(cpu->pc);
+    profile->addresses[location] = cpu->pc;
+    profile_call(kind, location, cpu->s);
+
+    // The interrupt sequence itself counts against the handler
+    profile_charge(cycles);
+}
+
+void profile_instruction(CPU* cpu, uint16_t pc, uint8_t opcode, int cycles){
+    uint32_t location = profile_location(pc);
+    profile->cycles[location] += cycles;
+    profile->opcodes[location] = opcode;
+    profile->addresses[location] = pc;
+    profile_charge(cycles);
+
+    if(opcode == 0x20){
+        // JSR: the call itself is the caller's, everything after is the callee's
+        uint32_t location = profile_location(cpu->pc);
+        profile->addresses[location] = cpu->pc;
+        profile_call(PROFILE_CALL, location, cpu->s);
+    } else{
+        profile_return(cpu->s);
+    }
+}
+
+void profile_end_frame(){
+    Profile* p = profile;
+    p->frames++;
+    if(p->frame_nmi > 0){
+        p->nmi_frames++;
+        p->nmi_total += p->frame_nmi;
+        if(p->frame_nmi > p->nmi_max){
+            p->nmi_max = p->frame_nmi;
+            p->nmi_max_frame = nes.ppu->frame_count;
+        }
+    }
+    p->frame_nmi = 0;
+}
+
+/* ------------------------------------ Report ------------------------------------ */
+
+// Per subroutine, summed over every path it was reached by
+typedef struct Profile_Routine{
+    uint32_t location;
+    Profile_Kind kind;
+    int32_t node;           // any one of its nodes, for the name
+    uint64_t self;
+    uint64_t total;         // not counted again for recursive calls
+    uint64_t calls;
+} Profile_Routine;
+
+static int compare_self(const void* a, const void* b){
+    uint64_t x = ((const Profile_Routine*)a)->self, y = ((const Profile_Routine*)b)->self;
+    return (x < y) - (x > y);
+}
+
+static int compare_total(const void* a, const void* b){
+    uint64_t x = ((const Profile_Routine*)a)->total, y = ((const Profile_Routine*)b)->total;
+    return (x < y) - (x > y);
+}
+
+static int compare_location(const void* a, const void* b){
+    uint64_t x = profile->cycles[*(const uint32_t*)a], y = profile->cycles[*(const uint32_t*)b];
+    return (x < y) - (x > y);
+}
+
+static bool same_routine(const Profile_Node* a, const Profile_Node* b){
+    return a->kind == b->kind && (a->kind != PROFILE_CALL || a->location == b->location);
+}
+
+// Folded stacks: the path to each node, then its exclusive cycles
+static void profile_write_folded(FILE* file){
+    Profile* p = profile;
+    int32_t path[PROFILE_MAX_DEPTH + 1];
+    for(int32_t i = 0; i < p->node_count; i++){
+        if(p->nodes[i].self == 0){
+            continue;
+        }
+        int depth = 0;
+        for(int32_t node = i; node >= 0 && depth <= PROFILE_MAX_DEPTH; node = p->nodes[node].parent){
+            path[depth++] = node;
+        }
+        for(int j = depth - 1; j >= 0; j--){
+            char name[16];
+            profile_name(&p->nodes[path[j]], name, sizeof(name));
+            fprintf(file, "%s%c", name, j > 0 ? ';' : ' ');
+        }
+        fprintf(file, "%llu\n", (unsigned long long)p->nodes[i].self);
+    }
+}
+
+void profile_finish(int top){
+    Profile* p = profile;
+    if(p == NULL){
+        return;
+    }
+
+    FILE* file = fopen(p->path, "w");
+    if(file == NULL){
+        printf("ERROR! Could not open profile '%s'\n", p->path);
+    } else{
+        profile_write_folded(file);
+        fclose(file);
+    }
+
+    // Children are always created after their parents, so a backwards pass totals every subtree
+    for(int32_t i = p->node_count - 1; i >= 0; i--){
+        p->nodes[i].total += p->nodes[i].self;
+        if(p->nodes[i].parent >= 0){
+            p->nodes[p->nodes[i].parent].total += p->nodes[i].total;
+        }
+    }
+
+    // Gather nodes into subroutines
+    Profile_Routine* routines = calloc(p->node_count, sizeof(Profile_Routine));
+    int routine_count = 0;
+    for(int32_t i = 0; i < p->node_count; i++){
+        const Profile_Node* node = &p->nodes[i];
+        int r = 0;
+        while(r < routine_count && !same_routine(&p->nodes[routines[r].node], node)){
+            r++;
+        }
+        if(r == routine_count){
+            routines[routine_count++] = (Profile_Routine){ node->location, node->kind, i, 0, 0, 0 };
+        }
+        routines[r].self += node->self;
+        routines[r].calls += node->calls;
+
+        // A recursive call's time is already inside the outer call's
+        bool recursive = false;
+        for(int32_t up = node->parent; up >= 0 && !recursive; up = p->nodes[up].parent){
+            recursive = same_routine(&p->nodes[up], node);
+        }
+        if(!recursive){
+            routines[r].total += node->total;
+        }
+    }
+
+    double per_frame = p->frames ? (double)p->total / p->frames : 0;
+    printf("Profile: %llu CPU cycles over %u frames (%.0f per frame), %d call paths%s; folded stacks in '%s'\n",
+        (unsigned long long)p->total, p->frames, per_frame, p->node_count,
+        p->nodes_full ? " (table full, later paths merged into their callers)" : "", p->path);
+    if(p->nmi_frames > 0){
+        printf("NMI handler: %.0f cycles per frame it ran in (%.1f%% of a frame), max %llu in frame %u; ran in %u of %u "
+            "frames\n", (double)p->nmi_total / p->nmi_frames, per_frame ? 100.0 * p->nmi_total / p->nmi_frames / per_frame : 0,
+            (unsigned long long)p->nmi_max, p->nmi_max_frame, p->nmi_frames, p->frames);
+    }
+
+    for(int table = 0; table < 2; table++){
+        qsort(routines, routine_count, sizeof(Profile_Routine), table == 0 ? compare_self : compare_total);
+        printf("\n%s\n  exclusive       %%    inclusive       %%      calls  cycles/frame  subroutine\n",
+            table == 0 ? "Subroutines by exclusive cycles:" : "Subroutines by inclusive cycles:");
+        for(int r = 0; r < routine_count && r < top; r++){
+            char name[16];
+            profile_name(&p->nodes[routines[r].node], name, sizeof(name));
+            printf("%11llu %6.2f%% %12llu %6.2f%% %10llu %13.0f  %s\n", (unsigned long long)routines[r].self,
+                100.0 * routines[r].self / p->total, (unsigned long long)routines[r].total,
+                100.0 * routines[r].total / p->total, (unsigned long long)routines[r].calls,
+                p->frames ? (double)(table == 0 ? routines[r].self : routines[r].total) / p->frames : 0, name);
+        }
+    }
+
+    // Hottest instructions
+    uint32_t hot_count = 0;
+    uint32_t* sort_locations = malloc(p->locations * sizeof(uint32_t));
+    for(uint32_t i = 0; i < p->locations; i++){
+        if(p->cycles[i] > 0){
+            sort_locations[hot_count++] = i;
+        }
+    }
+    qsort(sort_locations, hot_count, sizeof(uint32_t), compare_location);
+    printf("\nInstructions by cycles:\n     cycles       %%  address  instruction\n");
+    for(uint32_t i = 0; i < hot_count && i < (uint32_t)top; i++){
+        uint32_t location = sort_locations[i];
+        char bank[8] = "";
+        if(location >= 0x8000 && nes.cart->prg_rom_size > 0x8000){
+            snprintf(bank, sizeof(bank), "%.2X:", (location - 0x8000) / PRG_PAGE_SIZE);
+        }
+        printf("%11llu %6.2f%%  %3s%.4X  %s\n", (unsigned long long)p->cycles[location],
+            100.0 * p->cycles[location] / p->total, bank, p->addresses[location],
+            get_op_data(p->opcodes[location])->label);
+    }
+
+    free(sort_locations);
+    free(routines);
+    free(p->cycles);
+    free(p->opcodes);
+    free(p->addresses);
+    free(p->nodes);
+    free(p);
+    profile = NULL;
+}
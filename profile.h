@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+/*  Guest code profiler: where the 6502's cycles go, for tuning the games that run on this.
+
+    Only built in with -DUNICOM_PROFILER; otherwise cpu_step() has no hooks at all and --profile just says so.
+    When built in, each instruction's cycles (DMA stalls included) are counted against its address, and a shadow
+    call stack follows JSR, NMI and IRQ into subroutines and notices them returning by the stack pointer rising
+    back above where they started (so code that drops its return address and jumps out is handled too). From
+    that comes a call tree with the cycles spent in each subroutine itself, giving:
+
+    - a folded stack file, one line per call path with its exclusive cycles ("main;NMI;C123;C456 1234"), which
+      flamegraph.pl and speedscope read as is
+    - a text report: subroutines by exclusive and inclusive cycles, the hottest instructions, and how long the
+      NMI handler takes each frame
+
+    Code is named by CPU address, with the 8kB PRG ROM bank in front on games bigger than 32kB ("03:C123").
+*/
+
+#define PROFILE_MAX_NODES   65536   // call paths; past this, new paths are counted against their caller
+#define PROFILE_MAX_DEPTH   128     // every call takes at least 2 bytes of the 256 byte stack
+#define PROFILE_TOP         20      // lines per table in the report
+
+typedef enum Profile_Kind{
+    PROFILE_ROOT,       // not in any subroutine (the reset path and main loop)
+    PROFILE_CALL,
+    PROFILE_NMI,
+    PROFILE_IRQ
+} Profile_Kind;
+
+// One call path: a subroutine, reached through its parent's path
+typedef struct Profile_Node{
+    uint32_t location;      // entry point (see profile_location())
+    Profile_Kind kind;
+    int32_t parent;
+    int32_t child;          // first callee, then through their siblings
+    int32_t sibling;
+    uint64_t self;          // cycles in the subroutine itself
+    uint64_t total;         // ...and in its callees (filled in by the report)
+    uint64_t calls;
+} Profile_Node;
+
+typedef struct Profile_Frame{
+    int32_t node;
+    uint8_t s;              // stack pointer inside the subroutine, just after its return address was pushed
+} Profile_Frame;
+
+typedef struct Profile{
+    const char* path;
+
+    // Per instruction: cycles, and the opcode and CPU address found there. Locations are CPU addresses below
+    // $8000, and $8000 + the offset into PRG ROM above.
+    uint32_t locations;
+    uint64_t* cycles;
+    uint8_t* opcodes;
+    uint16_t* addresses;
+
+    Profile_Node* nodes;
+    int32_t node_count;
+    bool nodes_full;
+
+    Profile_Frame stack[PROFILE_MAX_DEPTH];
+    int depth;
+    int nmi_depth;          // NMI frames on the stack
+
+    uint64_t total;
+    uint32_t frames;
+
+    // NMI handler cycles per frame
+    uint64_t frame_nmi;
+    uint64_t nmi_total;
+    uint64_t nmi_max;
+    uint32_t nmi_max_frame;
+    uint32_t nmi_frames;    // frames the handler ran in at all
+} Profile;
+
+// The running profile, or NULL
+extern Profile* profile;
+
+// Start profiling into the given folded stack file. Returns 0 on success.
+int profile_start(const char* path);
+
+// Write the folded stacks and print the top `top` of each table, then stop
+void profile_finish(int top);
+
+// Hooks, for cpu_step() and the frame loop
+void profile_interrupt(CPU* cpu, Profile_Kind kind, int cycles);
+void profile_instruction(CPU* cpu, uint16_t pc, uint8_t opcode, int cycles);
+void profile_end_frame();
@@ -0,0 +1,144 @@
+#include <string.h>
+
+#include "queue.h"
+
+/* ---------------------------------- Frame queue ---------------------------------- */
+void frame_queue_init(Frame_Queue* queue){
+    memset(queue->buffers, 0, sizeof(queue->buffers));
+
+    queue->back = 0;
+    atomic_init(&queue->middle, 1);
+    queue->front = 2;
+
+    atomic_init(&queue->produced, 0);
+    atomic_init(&queue->dropped, 0);
+    queue->presented = 0;
+    queue->duplicated = 0;
+}
+
+uint8_t* frame_queue_back(Frame_Queue* queue){
+    return queue->buffers[queue->back];
+}
+
+uint8_t* frame_queue_publish(Frame_Queue* queue){
+    // Release: the frame's pixels must be visible before the consumer can see the index
+    uint8_t previous = atomic_exchange_explicit(&queue->middle, queue->back | FRAME_QUEUE_FRESH, memory_order_acq_rel);
+
+    if(previous & FRAME_QUEUE_FRESH){
+        // The consumer never picked this one up
+        atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&queue->produced, 1, memory_order_relaxed);
+
+    queue->back = previous & 0x3;
+    return queue->buffers[queue->back];
+}
+
+bool frame_queue_acquire(Frame_Queue* queue){
+    if(!(atomic_load_explicit(&queue->middle, memory_order_relaxed) & FRAME_QUEUE_FRESH)){
+        // Nothing new since last time
+        return false;
+    }
+
+    // Only the consumer clears the fresh bit, so it can't disappear between the load and the exchange
+    uint8_t previous = atomic_exchange_explicit(&queue->middle, queue->front, memory_order_acq_rel);
+    queue->front = previous & 0x3;
+    return true;
+}
+
+const uint8_t* frame_queue_front(Frame_Queue* queue){
+    return queue->buffers[queue->front];
+}
+
+/* ---------------------------------- Input queue ---------------------------------- */
+void input_queue_init(Input_Queue* queue){
+    memset(queue->events, 0, sizeof(queue->events));
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->overflowed, 0);
+}
+
+bool input_queue_push(Input_Queue* queue, Input_Event event){
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if(head - tail == INPUT_QUEUE_SIZE){
+        atomic_fetch_add_explicit(&queue->overflowed, 1, memory_order_relaxed);
+        return false;
+    }
+
+    queue->events[head & (INPUT_QUEUE_SIZE - 1)] = event;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool input_queue_pop(Input_Queue* queue, Input_Event* event){
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if(tail == head){
+        return false;
+    }
+
+    *event = queue->events[tail & (INPUT_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/* ---------------------------------- Sample queue ---------------------------------- */
+void sample_queue_init(Sample_Queue* queue){
+    memset(queue->samples, 0, sizeof(queue->samples));
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->overruns, 0);
+    atomic_init(&queue->underruns, 0);
+    atomic_init(&queue->dropped, 0);
+    atomic_init(&queue->missing, 0);
+}
+
+int sample_queue_push(Sample_Queue* queue, const int16_t* samples, int count){
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    uint32_t space = SAMPLE_QUEUE_SIZE - (head - tail);
+    if((uint32_t)count > space){
+        atomic_fetch_add_explicit(&queue->overruns, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&queue->dropped, count - space, memory_order_relaxed);
+        count = space;
+    }
+
+    // In at most two pieces, either side of the wrap
+    uint32_t start = head & (SAMPLE_QUEUE_SIZE - 1);
+    uint32_t first = (count < (int)(SAMPLE_QUEUE_SIZE - start)) ? (uint32_t)count : SAMPLE_QUEUE_SIZE - start;
+    memcpy(&queue->samples[start], samples, first * sizeof(int16_t));
+    memcpy(queue->samples, &samples[first], (count - first) * sizeof(int16_t));
+
+    atomic_store_explicit(&queue->head, head + count, memory_order_release);
+    return count;
+}
+
+int sample_queue_pop(Sample_Queue* queue, int16_t* samples, int count){
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    uint32_t available = head - tail;
+    if((uint32_t)count > available){
+        atomic_fetch_add_explicit(&queue->underruns, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&queue->missing, count - available, memory_order_relaxed);
+        count = available;
+    }
+
+    uint32_t start = tail & (SAMPLE_QUEUE_SIZE - 1);
+    uint32_t first = (count < (int)(SAMPLE_QUEUE_SIZE - start)) ? (uint32_t)count : SAMPLE_QUEUE_SIZE - start;
+    memcpy(samples, &queue->samples[start], first * sizeof(int16_t));
+    memcpy(&samples[first], queue->samples, (count - first) * sizeof(int16_t));
+
+    atomic_store_explicit(&queue->tail, tail + count, memory_order_release);
+    return count;
+}
+
+uint32_t sample_queue_fill(Sample_Queue* queue){
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    return head - tail;
+}
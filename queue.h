@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "ppu.h"
+
+/*  Lock-free channels between the emulation thread and the presentation/audio threads. All are single-producer
+    single-consumer, so plain atomic loads/stores/exchanges are enough; neither side ever blocks the other.
+*/
+
+/* ---------------------------------- Frame queue ---------------------------------- */
+// Set on the shared slot when it holds a frame the consumer hasn't picked up yet
+#define FRAME_QUEUE_FRESH 0x4
+
+// Triple buffer: the producer always owns one buffer (back), the consumer owns another (front) and the
+// third is swapped between them through an atomic slot. The consumer always sees the newest completed frame.
+typedef struct Frame_Queue{
+    uint8_t buffers[3][FRAME_WIDTH * FRAME_HEIGHT];
+
+    uint8_t back;   // producer only
+    uint8_t front;  // consumer only
+    _Atomic uint8_t middle; // buffer index | FRAME_QUEUE_FRESH
+
+    // Producer-side counts
+    _Atomic uint32_t produced;
+    _Atomic uint32_t dropped;       // frames overwritten before they were ever shown
+
+    // Consumer-side counts, kept up to date by whoever presents
+    uint32_t presented;
+    uint32_t duplicated;            // presents that had to show the previous frame again
+} Frame_Queue;
+
+void frame_queue_init(Frame_Queue* queue);
+
+// Producer: the buffer to draw the next frame into
+uint8_t* frame_queue_back(Frame_Queue* queue);
+
+// Producer: hand the finished back buffer over. Returns the buffer to draw the following frame into.
+uint8_t* frame_queue_publish(Frame_Queue* queue);
+
+// Consumer: swap in the newest frame if there is one. Returns true if front changed.
+bool frame_queue_acquire(Frame_Queue* queue);
+
+// Consumer: the frame to show
+const uint8_t* frame_queue_front(Frame_Queue* queue);
+
+/* ---------------------------------- Input queue ---------------------------------- */
+#define INPUT_QUEUE_SIZE 64 // must be a power of 2
+
+typedef enum Input_Type {
+    INPUT_BUTTONS,      // new controller state; value holds the buttons bitmask
+    INPUT_FAST_FORWARD  // value is 1 while fast-forward is held
+} Input_Type;
+
+typedef struct Input_Event{
+    uint8_t type;
+    uint8_t port;
+    uint8_t value;
+    uint64_t timestamp; // host time the event was read, in SDL performance counter ticks
+} Input_Event;
+
+// Ring buffer of input events from the presentation thread back to the emulation thread
+typedef struct Input_Queue{
+    Input_Event events[INPUT_QUEUE_SIZE];
+    _Atomic uint32_t head; // next slot to write; producer only
+    _Atomic uint32_t tail; // next slot to read; consumer only
+    _Atomic uint32_t overflowed;
+} Input_Queue;
+
+void input_queue_init(Input_Queue* queue);
+
+// Returns false (and drops the event) if the queue is full
+bool input_queue_push(Input_Queue* queue, Input_Event event);
+bool input_queue_pop(Input_Queue* queue, Input_Event* event);
+
+/* ---------------------------------- Sample queue ---------------------------------- */
+#define SAMPLE_QUEUE_SIZE 4096 // must be a power of 2; ~85ms at 48kHz
+
+// Ring buffer of audio samples from the emulation thread to the audio device's callback
+typedef struct Sample_Queue{
+    int16_t samples[SAMPLE_QUEUE_SIZE];
+    _Atomic uint32_t head; // next slot to write; producer only
+    _Atomic uint32_t tail; // next slot to read; consumer only
+
+    _Atomic uint32_t overruns;      // pushes that didn't fit (whole or in part)
+    _Atomic uint32_t underruns;     // pops that came up short
+    _Atomic uint32_t dropped;       // samples lost to overruns
+    _Atomic uint32_t missing;       // samples the consumer wanted but didn't get
+} Sample_Queue;
+
+void sample_queue_init(Sample_Queue* queue);
+
+// Producer: add as many samples as fit. Returns the number added.
+int sample_queue_push(Sample_Queue* queue, const int16_t* samples, int count);
+
+// Consumer: take up to count samples. Returns the number taken.
+int sample_queue_pop(Sample_Queue* queue, int16_t* samples, int count);
+
+// Samples currently waiting (either side)
+uint32_t sample_queue_fill(Sample_Queue* queue);
@@ -1,4 +1,18 @@
 #include "rom.h"
+#include "save.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 /*
 typedef struct ROM{
@@ -18,42 +32,249 @@ typedef struct ROM{
         PlayChoice PROM, if present (16 bytes Data, 16 bytes CounterOut) (this is often missing, see PC10 ROM-Images for details)
 
     Some ROM-Images additionally contain a 128-byte (or sometimes 127-byte) title at the end of the file. 
+
+    NES 2.0 (https://www.nesdev.org/wiki/NES_2.0) keeps the same layout but uses the rest of the header for bigger
+    sizes, submappers, RAM sizes and region. It is marked by bits 2-3 of flags 7 being 10.
+
+    The file is mapped into memory read-only and the cartridge's PRG/CHR ROM banks point straight into the mapping,
+    so nothing is copied, loading is just page faults, and every instance running the same ROM shares its pages.
 */
-int load_rom(char* path, CPU* cpu, PPU* ppu){
-    FILE* rom = fopen(path, "rb");
-    int prg_size;
+// NES 2.0 ROM size: a 12 bit count of units, or if the top nibble is all 1s, 2^E * (MM * 2 + 1) bytes. Exponents
+// past 32 would overflow, and no file is that big anyway, so they come back as UINT64_MAX.
+static uint64_t rom_nes2_size(uint8_t lsb, uint8_t msb, uint32_t unit){
+    if(msb == 0x0F){
+        if((lsb >> 2) > 32){
+            return UINT64_MAX;
+        }
+        return ((uint64_t)1 << (lsb >> 2)) * ((lsb & 0x3) * 2 + 1);
+    }
+    return (((uint64_t)msb << 8) | lsb) * unit;
+}
 
-    if(rom != NULL){
+// NES 2.0 RAM size: a shift count, 64 << n bytes, with 0 meaning none
+static uint32_t rom_nes2_ram_size(uint8_t shift){
+    return shift ? (64u << shift) : 0;
+}
 
-        // skip into header and read PRG-ROM size.
-        fseek(rom, 4, SEEK_SET);
-        fread(&prg_size, 1, 1, rom);
+int rom_parse_header(const uint8_t* data, size_t size, Rom_Header* header){
+    if(size < ROM_HEADER_SIZE || memcmp(data, "NES\x1A", 4) != 0){
+        return 1;
+    }
 
-        // skip rest of header
-        fseek(rom, 16, SEEK_SET);
+    memset(header, 0, sizeof(*header));
+    uint8_t flags6 = data[6];
+    uint8_t flags7 = data[7];
 
-        // read PRG ROM into cartridge memory space
-        fread(&cpu->memory[0x8000], 1, 16384 * prg_size, rom);
+    // Flags 6: bit 0 is the mirroring arrangement, bit 1 battery, bit 2 trainer, bit 3 four-screen VRAM
+    header->mirroring = (flags6 & 0x08) ? MIRROR_FOUR_SCREEN : (Mirroring)(flags6 & 0x01);
+    header->battery = flags6 & 0x02;
+    header->trainer = flags6 & 0x04;
+    header->nes2 = (flags7 & 0x0C) == 0x08;
 
-        // Read CHR ROM into PPU memory
-        // NROM has an 8KiB CHR ROM, which sits straight after the PRG ROM in iNES.
-        // 16KiB == 16384 == 0x4000. We've already read 0x4000 + 16 == 0x4010 bytes (PRG ROM + 16 byte Header)
-        fseek(rom, 0x4010, SEEK_SET);
-        fread(ppu->memory, 1, 0x2000, rom);
+    uint64_t prg_rom_size, chr_rom_size;
+    if(header->nes2){
+        header->mapper = (flags6 >> 4) | (flags7 & 0xF0) | ((data[8] & 0x0F) << 8);
+        header->submapper = data[8] >> 4;
 
-        // mirror ROM if it won't fill memory
-        if(prg_size < 2){
-            fseek(rom, 16, SEEK_SET);
-            fread(&cpu->memory[0xC000], 1, 16384 * prg_size, rom);
+        prg_rom_size = rom_nes2_size(data[4], data[9] & 0x0F, 0x4000);
+        chr_rom_size = rom_nes2_size(data[5], data[9] >> 4, 0x2000);
+        header->prg_ram_size = rom_nes2_ram_size(data[10] & 0x0F);
+        header->prg_nvram_size = rom_nes2_ram_size(data[10] >> 4);
+        header->chr_ram_size = rom_nes2_ram_size(data[11] & 0x0F);
+        header->region = (Region)(data[12] & 0x3);
+    } else{
+        // Old dumping tools wrote their name over bytes 7-15 (e.g. "DiskDude!"), so only trust flags 7 if the
+        // padding at the end of the header is clean
+        bool clean = (data[12] | data[13] | data[14] | data[15]) == 0;
+        header->mapper = (flags6 >> 4) | (clean ? (flags7 & 0xF0) : 0);
+
+        prg_rom_size = data[4] * 0x4000;
+        chr_rom_size = data[5] * 0x2000;
+
+        // PRG RAM in 8kB units, where 0 means 8kB for compatibility. iNES can't say which part is battery backed.
+        uint32_t prg_ram_size = (clean && data[8]) ? data[8] * 0x2000 : 0x2000;
+        if(header->battery){
+            header->prg_nvram_size = prg_ram_size;
+        } else{
+            header->prg_ram_size = prg_ram_size;
         }
+        header->chr_ram_size = chr_rom_size ? 0 : 0x2000;
+        header->region = (clean && (data[9] & 0x01)) ? REGION_PAL : REGION_NTSC;
+    }
+
+    // ROM is only ever mapped in whole pages, so sizes the exponent form allows that aren't made of them can't
+    // be used (and anything past 4GB can't be in the file)
+    if(prg_rom_size == 0 || prg_rom_size > UINT32_MAX || prg_rom_size % PRG_PAGE_SIZE != 0
+        || chr_rom_size > UINT32_MAX || chr_rom_size % CHR_PAGE_SIZE != 0){
+        return 1;
+    }
+
+    header->prg_rom_offset = ROM_HEADER_SIZE + (header->trainer ? ROM_TRAINER_SIZE : 0);
+    uint64_t chr_rom_offset = header->prg_rom_offset + prg_rom_size;
+
+    // The file must actually contain everything the header promises
+    if(chr_rom_offset + chr_rom_size > size){
+        return 1;
+    }
+
+    header->prg_rom_size = (uint32_t)prg_rom_size;
+    header->chr_rom_size = (uint32_t)chr_rom_size;
+    header->chr_rom_offset = (uint32_t)chr_rom_offset;
+    return 0;
+}
+
+const char* rom_region_name(Region region){
+    switch(region){
+        case REGION_NTSC:   return "NTSC";
+        case REGION_PAL:    return "PAL";
+        case REGION_MULTI:  return "NTSC/PAL";
+        case REGION_DENDY:  return "Dendy";
+    }
+    return "?";
+}
+
+uint8_t* rom_map_file(const char* path, size_t* size){
+#ifdef _WIN32
+    // No mmap; read the file into memory instead
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = (length > 0) ? malloc(length) : NULL;
+    if(data != NULL && fread(data, 1, length, file) != (size_t)length){
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    *size = (size_t)length;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0){
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if(data == MAP_FAILED){
+        return NULL;
+    }
+
+    *size = info.st_size;
+    return data;
+#endif
+}
+
+void rom_unmap_file(uint8_t* data, size_t size){
+#ifdef _WIN32
+    (void)size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+// Load a ROM using the given header, or the file's own if it's NULL
+static int rom_load(char* path, const Rom_Header* known, Cartridge* cart){
+    size_t size;
+    uint8_t* data = rom_map_file(path, &size);
+    Rom_Header header;
+
+    if(data == NULL){
+        // ROM not found or other error
+        return 1;
+    }
+
+    if(known == NULL && rom_parse_header(data, size, &header) != 0){
+        printf("ERROR! '%s' is not an iNES ROM, or is shorter than its header says.\n", path);
+        rom_unmap_file(data, size);
+        return 1;
+    }
+
+    // A header from elsewhere still has to fit the file as it is now, in whole pages
+    if(known != NULL){
+        header = *known;
+        if(header.prg_rom_size == 0 || header.prg_rom_size % PRG_PAGE_SIZE != 0
+            || header.chr_rom_size % CHR_PAGE_SIZE != 0
+            || (uint64_t)header.chr_rom_offset + header.chr_rom_size > size){
+            printf("ERROR! '%s' doesn't match the header it was given.\n", path);
+            rom_unmap_file(data, size);
+            return 1;
+        }
+    }
+
+    cart->mapper = mapper_find(header.mapper);
+    if(cart->mapper == NULL){
+        printf("ERROR! Mapper %d is not supported.\n", header.mapper);
+        rom_unmap_file(data, size);
+        return 1;
+    }
+
+    cart->file = data;
+    cart->file_size = size;
+    cart->mirroring = header.mirroring;
+    cart->battery = header.battery;
+    cart->region = header.region;
+
+    // ROM is used in place. It is mapped read-only, so the pointers only lose their const for the bank tables' sake.
+    cart->prg_rom = &data[header.prg_rom_offset];
+    cart->prg_rom_size = header.prg_rom_size;
+
+    cart->chr_ram = (header.chr_rom_size == 0);
+    if(cart->chr_ram){
+        // No CHR ROM means the cartridge has CHR RAM instead. It's mapped in whole pages, so less than one (the
+        // smallest NES 2.0 sizes) gets a whole one.
+        cart->chr_size = header.chr_ram_size ? header.chr_ram_size : 0x2000;
+        if(cart->chr_size < CHR_PAGE_SIZE){
+            cart->chr_size = CHR_PAGE_SIZE;
+        }
+        cart->chr = calloc(1, cart->chr_size);
+    } else{
+        cart->chr = &data[header.chr_rom_offset];
+        cart->chr_size = header.chr_rom_size;
+    }
+
+    // $6000-$7FFF is a single page, so NES 2.0's smaller sizes (e.g. MMC6's 1kB) get a whole one; only the size
+    // the header gives goes in the save file
+    cart->save_size = header.prg_ram_size + header.prg_nvram_size;
+    cart->prg_ram_size = cart->save_size;
+    if(cart->prg_ram_size != 0 && cart->prg_ram_size < PRG_PAGE_SIZE){
+        cart->prg_ram_size = PRG_PAGE_SIZE;
+    }
+    cart->save_path = NULL;
+    if(!cart->battery || save_open(cart, path) != 0){
+        cart->prg_ram = cart->prg_ram_size ? calloc(1, cart->prg_ram_size) : NULL;
+    }
+
+    // The trainer belongs at $7000-$71FF
+    if(header.trainer && cart->prg_ram_size >= 0x1200){
+        memcpy(&cart->prg_ram[0x1000], &data[ROM_HEADER_SIZE], ROM_TRAINER_SIZE);
+    }
+
+    printf("Mapper %d (%s), PRG ROM %ukB, CHR %s %ukB, PRG RAM %ukB%s, %s%s\n", header.mapper, cart->mapper->name,
+        cart->prg_rom_size / 1024, cart->chr_ram ? "RAM" : "ROM", cart->chr_size / 1024, cart->save_size / 1024,
+        cart->battery ? " (battery)" : "", rom_region_name(header.region), header.nes2 ? ", NES 2.0" : "");
+
+    cartridge_reset(cart);
+    return 0;
+}
+
+int load_rom(char* path, Cartridge* cart){
+    return rom_load(path, NULL, cart);
+}
 
-        printf("PRG Size: %d\n", prg_size);
-        fclose(rom);
-        return 0;
-    } 
-    
-    // ROM not found or other error
-    return 1;
-    
-    
-}
\ No newline at end of file
+int load_rom_header(char* path, const Rom_Header* header, Cartridge* cart){
+    return rom_load(path, header, cart);
+}
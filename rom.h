@@ -2,7 +2,47 @@
 
 #include <stdint.h>
 #include <stdio.h>
-#include "cpu.h"
-#include "ppu.h"
+#include <stddef.h>
+#include <stdbool.h>
+#include "cartridge.h"
 
-int load_rom(char* path, CPU* cpu, PPU* ppu);
\ No newline at end of file
+#define ROM_HEADER_SIZE  16
+#define ROM_TRAINER_SIZE 512
+
+// Everything the iNES/NES 2.0 header says about a cartridge. Sizes are in bytes.
+typedef struct Rom_Header{
+    bool nes2;
+    uint16_t mapper;
+    uint8_t submapper;      // NES 2.0 only
+    Mirroring mirroring;
+    bool battery;           // PRG RAM (or NVRAM) is battery backed
+    bool trainer;           // 512 bytes for $7000-$71FF sit between the header and PRG ROM
+    Region region;
+
+    uint32_t prg_rom_size;
+    uint32_t chr_rom_size;  // 0 means the cartridge uses CHR RAM
+    uint32_t prg_ram_size;  // volatile work RAM
+    uint32_t prg_nvram_size;// battery backed work RAM
+    uint32_t chr_ram_size;
+
+    // Where the PRG and CHR ROM start within the file
+    uint32_t prg_rom_offset;
+    uint32_t chr_rom_offset;
+} Rom_Header;
+
+// Parse the header at the start of a ROM image, checking the image is big enough for what it describes and that
+// its ROM comes in whole pages. Returns 0 on success, 1 if it isn't a (complete, usable) iNES ROM.
+int rom_parse_header(const uint8_t* data, size_t size, Rom_Header* header);
+
+const char* rom_region_name(Region region);
+
+// Map a whole file into memory read-only (read into memory where there is no mmap). Returns NULL on failure.
+uint8_t* rom_map_file(const char* path, size_t* size);
+void rom_unmap_file(uint8_t* data, size_t size);
+
+// Load an iNES ROM into a cartridge and reset it. Needs nes.ppu set, as the mapper maps CHR into the PPU.
+int load_rom(char* path, Cartridge* cart);
+
+// As load_rom(), with the header already known (e.g. from a ROM index) rather than read from the file. It must
+// still fit the file.
+int load_rom_header(char* path, const Rom_Header* header, Cartridge* cart);
\ No newline at end of file
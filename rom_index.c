@@ -0,0 +1,452 @@
+#include "rom_index.h"
+#include "rom.h"
+#include "checksum.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// Paths found by the directory scan, and what the workers made of each
+typedef struct Index_Job{
+    char** paths;
+    Rom_Index_Entry* entries;
+    bool* indexed;
+    int count;
+    int capacity;
+
+    atomic_int next;                // next path for a worker to pick up
+    atomic_uint_fast64_t bytes_hashed;
+} Index_Job;
+
+static bool rom_index_is_rom(const char* name){
+    size_t length = strlen(name);
+    if(length < 4){
+        return false;
+    }
+
+    const char* extension = &name[length - 4];
+    return extension[0] == '.' && tolower(extension[1]) == 'n' && tolower(extension[2]) == 'e'
+        && tolower(extension[3]) == 's';
+}
+
+// Collect every ROM under a directory, recursively
+static void rom_index_scan(Index_Job* job, const char* dir){
+    DIR* handle = opendir(dir);
+    if(handle == NULL){
+        printf("ERROR! Couldn't open directory '%s'.\n", dir);
+        return;
+    }
+
+    struct dirent* item;
+    while((item = readdir(handle)) != NULL){
+        if(strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0){
+            continue;
+        }
+
+        size_t length = strlen(dir) + strlen(item->d_name) + 2;
+        char* path = malloc(length);
+        snprintf(path, length, "%s/%s", dir, item->d_name);
+
+        // Symlinks to files are followed, but not symlinks to directories, which could lead back up the tree forever
+        struct stat info;
+        bool linked_dir = false;
+#ifdef _WIN32
+        int status = stat(path, &info);
+#else
+        int status = lstat(path, &info);
+        if(status == 0 && S_ISLNK(info.st_mode)){
+            status = stat(path, &info);
+            linked_dir = status == 0 && S_ISDIR(info.st_mode);
+        }
+#endif
+        if(status != 0 || linked_dir){
+            free(path);
+        } else if(S_ISDIR(info.st_mode)){
+            rom_index_scan(job, path);
+            free(path);
+        } else if(S_ISREG(info.st_mode) && rom_index_is_rom(item->d_name)){
+            if(job->count == job->capacity){
+                job->capacity = job->capacity ? job->capacity * 2 : 256;
+                job->paths = realloc(job->paths, job->capacity * sizeof(char*));
+            }
+            job->paths[job->count++] = path;
+        } else{
+            free(path);
+        }
+    }
+
+    closedir(handle);
+}
+
+static bool rom_index_file(const char* path, Rom_Index_Entry* entry, uint64_t* bytes_hashed){
+    struct stat info;
+    if(stat(path, &info) != 0){
+        return false;
+    }
+
+    size_t size;
+    uint8_t* data = rom_map_file(path, &size);
+    if(data == NULL){
+        return false;
+    }
+
+    Rom_Header header;
+    if(rom_parse_header(data, size, &header) != 0){
+        rom_unmap_file(data, size);
+        return false;
+    }
+
+    const uint8_t* prg = &data[header.prg_rom_offset];
+    const uint8_t* chr = &data[header.chr_rom_offset];
+
+    entry->prg_crc32 = crc32(0, prg, header.prg_rom_size);
+    entry->chr_crc32 = crc32(0, chr, header.chr_rom_size);
+    entry->crc32 = crc32(entry->prg_crc32, chr, header.chr_rom_size);
+
+    SHA1 sha;
+    sha1_init(&sha);
+    sha1_update(&sha, prg, header.prg_rom_size);
+    sha1_update(&sha, chr, header.chr_rom_size);
+    sha1_final(&sha, entry->sha1);
+
+    entry->prg_rom_size = header.prg_rom_size;
+    entry->chr_rom_size = header.chr_rom_size;
+    entry->prg_ram_size = header.prg_ram_size + header.prg_nvram_size;
+    entry->mapper = header.mapper;
+    entry->submapper = header.submapper;
+    entry->region = header.region;
+    entry->mirroring = header.mirroring;
+    entry->flags = (header.battery ? ROM_INDEX_BATTERY : 0) | (header.trainer ? ROM_INDEX_TRAINER : 0)
+        | (header.nes2 ? ROM_INDEX_NES2 : 0);
+    entry->chr_ram_size = header.chr_ram_size;
+    entry->file_size = size;
+    entry->file_mtime = info.st_mtime;
+    entry->path = path;
+
+    *bytes_hashed += header.prg_rom_size + header.chr_rom_size;
+    rom_unmap_file(data, size);
+    return true;
+}
+
+static void rom_index_work(Index_Job* job){
+    uint64_t bytes_hashed = 0;
+
+    // Files are handed out one at a time, so a few huge ROMs can't leave the other threads idle
+    int i;
+    while((i = atomic_fetch_add(&job->next, 1)) < job->count){
+        job->indexed[i] = rom_index_file(job->paths[i], &job->entries[i], &bytes_hashed);
+    }
+
+    atomic_fetch_add(&job->bytes_hashed, bytes_hashed);
+}
+
+#ifdef _WIN32
+typedef HANDLE Index_Thread;
+
+static DWORD WINAPI rom_index_worker(LPVOID job){
+    rom_index_work((Index_Job*)job);
+    return 0;
+}
+
+static bool rom_index_thread_start(Index_Thread* thread, Index_Job* job){
+    *thread = CreateThread(NULL, 0, rom_index_worker, job, 0, NULL);
+    return *thread != NULL;
+}
+
+static void rom_index_thread_join(Index_Thread thread){
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+typedef pthread_t Index_Thread;
+
+static void* rom_index_worker(void* job){
+    rom_index_work((Index_Job*)job);
+    return NULL;
+}
+
+static bool rom_index_thread_start(Index_Thread* thread, Index_Job* job){
+    return pthread_create(thread, NULL, rom_index_worker, job) == 0;
+}
+
+static void rom_index_thread_join(Index_Thread thread){
+    pthread_join(thread, NULL);
+}
+#endif
+
+static int rom_index_compare_path(const void* a, const void* b){
+    return strcmp(((const Rom_Index_Entry*)a)->path, ((const Rom_Index_Entry*)b)->path);
+}
+
+static void put16(uint8_t* out, uint16_t value){
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void put32(uint8_t* out, uint32_t value){
+    put16(out, value);
+    put16(&out[2], value >> 16);
+}
+
+static void put64(uint8_t* out, uint64_t value){
+    put32(out, value);
+    put32(&out[4], value >> 32);
+}
+
+static uint16_t get16(const uint8_t* in){
+    return in[0] | in[1] << 8;
+}
+
+static uint32_t get32(const uint8_t* in){
+    return get16(in) | (uint32_t)get16(&in[2]) << 16;
+}
+
+static uint64_t get64(const uint8_t* in){
+    return get32(in) | (uint64_t)get32(&in[4]) << 32;
+}
+
+static int rom_index_write(const char* out_path, const Rom_Index_Entry* entries, uint32_t count){
+    uint32_t strings_size = 0;
+    for(uint32_t i = 0; i < count; i++){
+        strings_size += strlen(entries[i].path) + 1;
+    }
+
+    size_t size = ROM_INDEX_HEADER_SIZE + count * ROM_INDEX_RECORD_SIZE + strings_size;
+    uint8_t* buffer = calloc(1, size);
+
+    memcpy(buffer, ROM_INDEX_MAGIC, 4);
+    put32(&buffer[4], ROM_INDEX_VERSION);
+    put32(&buffer[8], count);
+    put32(&buffer[12], strings_size);
+
+    uint8_t* record = &buffer[ROM_INDEX_HEADER_SIZE];
+    char* strings = (char*)&buffer[ROM_INDEX_HEADER_SIZE + count * ROM_INDEX_RECORD_SIZE];
+    uint32_t string_offset = 0;
+
+    for(uint32_t i = 0; i < count; i++, record += ROM_INDEX_RECORD_SIZE){
+        const Rom_Index_Entry* entry = &entries[i];
+        uint16_t path_length = strlen(entry->path);
+
+        put32(&record[0], entry->crc32);
+        put32(&record[4], entry->prg_crc32);
+        put32(&record[8], entry->chr_crc32);
+        memcpy(&record[12], entry->sha1, 20);
+        put32(&record[32], entry->prg_rom_size);
+        put32(&record[36], entry->chr_rom_size);
+        put32(&record[40], entry->prg_ram_size);
+        put16(&record[44], entry->mapper);
+        record[46] = entry->submapper;
+        record[47] = entry->region;
+        record[48] = entry->mirroring;
+        record[49] = entry->flags;
+        put32(&record[50], string_offset);
+        put16(&record[54], path_length);
+        put32(&record[56], entry->chr_ram_size);
+        put32(&record[60], entry->file_size);
+        put64(&record[64], entry->file_mtime);
+
+        memcpy(&strings[string_offset], entry->path, path_length + 1);
+        string_offset += path_length + 1;
+    }
+
+    FILE* file = fopen(out_path, "wb");
+    bool written = file != NULL && fwrite(buffer, 1, size, file) == size;
+    if(file != NULL){
+        written = (fclose(file) == 0) && written;
+    }
+    free(buffer);
+
+    if(!written){
+        printf("ERROR! Couldn't write index '%s'.\n", out_path);
+        return 1;
+    }
+    return 0;
+}
+
+int rom_index_build(const char* dir, const char* out_path, int threads){
+    Index_Job job = { 0 };
+    double start = stats_seconds();
+
+    rom_index_scan(&job, dir);
+    job.entries = calloc(job.count ? job.count : 1, sizeof(Rom_Index_Entry));
+    job.indexed = calloc(job.count ? job.count : 1, sizeof(bool));
+    atomic_init(&job.next, 0);
+    atomic_init(&job.bytes_hashed, 0);
+
+    // The CRC tables are shared, so build them before anyone uses them
+    crc32_init();
+
+    if(threads < 1){
+        threads = 1;
+    }
+    if(threads > job.count){
+        threads = job.count ? job.count : 1;
+    }
+
+    // This thread is one of the workers, so start one fewer. Any that fail to start just leave more for the rest.
+    Index_Thread* workers = calloc(threads, sizeof(Index_Thread));
+    int started = 0;
+    for(int i = 1; i < threads; i++){
+        if(rom_index_thread_start(&workers[started], &job)){
+            started++;
+        } else{
+            printf("ERROR! Failed to start an indexing thread.\n");
+        }
+    }
+    rom_index_work(&job);
+    for(int i = 0; i < started; i++){
+        rom_index_thread_join(workers[i]);
+    }
+    free(workers);
+    threads = started + 1;
+
+    // Keep the ROMs that parsed, in path order so lookups can binary search
+    uint32_t count = 0;
+    for(int i = 0; i < job.count; i++){
+        if(job.indexed[i]){
+            job.entries[count++] = job.entries[i];
+        } else{
+            printf("Skipped '%s' (not a valid iNES ROM)\n", job.paths[i]);
+        }
+    }
+    qsort(job.entries, count, sizeof(Rom_Index_Entry), rom_index_compare_path);
+
+    int status = rom_index_write(out_path, job.entries, count);
+
+    double seconds = stats_seconds() - start;
+    uint64_t bytes_hashed = atomic_load(&job.bytes_hashed);
+    printf("Indexed %u of %d ROMs into '%s' in %.2fs on %d threads (%.1f MB hashed, %.1f MB/s)\n", count, job.count,
+        out_path, seconds, threads, bytes_hashed / 1e6, seconds > 0 ? bytes_hashed / 1e6 / seconds : 0.0);
+
+    for(int i = 0; i < job.count; i++){
+        free(job.paths[i]);
+    }
+    free(job.paths);
+    free(job.entries);
+    free(job.indexed);
+    return status;
+}
+
+int rom_index_load(const char* path, Rom_Index* index){
+    memset(index, 0, sizeof(*index));
+
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        return 1;
+    }
+
+    uint8_t header[ROM_INDEX_HEADER_SIZE];
+    if(fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, ROM_INDEX_MAGIC, 4) != 0
+        || get32(&header[4]) != ROM_INDEX_VERSION){
+        printf("ERROR! '%s' is not a ROM index.\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    uint32_t count = get32(&header[8]);
+    uint32_t strings_size = get32(&header[12]);
+    uint8_t* records = malloc((size_t)count * ROM_INDEX_RECORD_SIZE + 1);
+    index->strings = malloc(strings_size + 1);
+    index->entries = calloc(count ? count : 1, sizeof(Rom_Index_Entry));
+
+    bool ok = fread(records, ROM_INDEX_RECORD_SIZE, count, file) == count
+        && fread(index->strings, 1, strings_size, file) == strings_size;
+    fclose(file);
+
+    for(uint32_t i = 0; ok && i < count; i++){
+        const uint8_t* record = &records[i * ROM_INDEX_RECORD_SIZE];
+        Rom_Index_Entry* entry = &index->entries[i];
+
+        entry->crc32 = get32(&record[0]);
+        entry->prg_crc32 = get32(&record[4]);
+        entry->chr_crc32 = get32(&record[8]);
+        memcpy(entry->sha1, &record[12], 20);
+        entry->prg_rom_size = get32(&record[32]);
+        entry->chr_rom_size = get32(&record[36]);
+        entry->prg_ram_size = get32(&record[40]);
+        entry->mapper = get16(&record[44]);
+        entry->submapper = record[46];
+        entry->region = record[47];
+        entry->mirroring = record[48];
+        entry->flags = record[49];
+        entry->chr_ram_size = get32(&record[56]);
+        entry->file_size = get32(&record[60]);
+        entry->file_mtime = get64(&record[64]);
+
+        uint32_t offset = get32(&record[50]);
+        uint16_t length = get16(&record[54]);
+        ok = (uint64_t)offset + length < strings_size && index->strings[offset + length] == '\0';
+        entry->path = &index->strings[offset];
+    }
+    free(records);
+
+    if(!ok){
+        printf("ERROR! ROM index '%s' is damaged.\n", path);
+        rom_index_free(index);
+        return 1;
+    }
+
+    index->count = count;
+    return 0;
+}
+
+void rom_index_free(Rom_Index* index){
+    free(index->entries);
+    free(index->strings);
+    memset(index, 0, sizeof(*index));
+}
+
+const Rom_Index_Entry* rom_index_find_path(const Rom_Index* index, const char* path){
+    Rom_Index_Entry key = { .path = path };
+    return bsearch(&key, index->entries, index->count, sizeof(Rom_Index_Entry), rom_index_compare_path);
+}
+
+bool rom_index_current(const Rom_Index_Entry* entry){
+    struct stat info;
+    return stat(entry->path, &info) == 0 && (uint64_t)info.st_size == entry->file_size
+        && (uint64_t)info.st_mtime == entry->file_mtime;
+}
+
+void rom_index_header(const Rom_Index_Entry* entry, Rom_Header* header){
+    memset(header, 0, sizeof(*header));
+    header->nes2 = entry->flags & ROM_INDEX_NES2;
+    header->mapper = entry->mapper;
+    header->submapper = entry->submapper;
+    header->mirroring = (Mirroring)entry->mirroring;
+    header->battery = entry->flags & ROM_INDEX_BATTERY;
+    header->trainer = entry->flags & ROM_INDEX_TRAINER;
+    header->region = (Region)entry->region;
+
+    header->prg_rom_size = entry->prg_rom_size;
+    header->chr_rom_size = entry->chr_rom_size;
+    // The index keeps work RAM and battery-backed RAM as one size, which is all a cartridge needs
+    if(header->battery){
+        header->prg_nvram_size = entry->prg_ram_size;
+    } else{
+        header->prg_ram_size = entry->prg_ram_size;
+    }
+    header->chr_ram_size = entry->chr_ram_size;
+
+    header->prg_rom_offset = ROM_HEADER_SIZE + (header->trainer ? ROM_TRAINER_SIZE : 0);
+    header->chr_rom_offset = header->prg_rom_offset + header->prg_rom_size;
+}
+
+const Rom_Index_Entry* rom_index_find_crc32(const Rom_Index* index, uint32_t crc32){
+    for(uint32_t i = 0; i < index->count; i++){
+        if(index->entries[i].crc32 == crc32){
+            return &index->entries[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rom.h"
+
+/*  ROM library index. `unicom --index <dir>` scans a directory tree on every core, parses each ROM's header with
+    rom_parse_header() and hashes its PRG/CHR, then writes everything to one compact file. Anything that needs a
+    ROM's mapper, region or hashes can then look them up without opening or hashing the ROM itself.
+    `unicom {rom} --rom-index <file>` finds the ROM by its path as indexed, or by its CRC32 in place of the path,
+    and loads it with the indexed settings instead of its header. An entry whose file has changed size or
+    modification time since is stale, and that ROM is loaded from its own header as usual. Paths are stored as the
+    scan found them, so relative ones only match from the directory the index was built in.
+
+    File layout (all integers little-endian):
+        Header      magic "UNCI", version (u32), entry count (u32), string table size (u32)
+        Entries     ROM_INDEX_RECORD_SIZE bytes each, sorted by path:
+                        crc32, prg_crc32, chr_crc32 (u32 each), sha1 (20 bytes),
+                        prg_rom_size, chr_rom_size, prg_ram_size (u32 each),
+                        mapper (u16), submapper, region, mirroring, flags (u8 each),
+                        path offset into the string table (u32), path length (u16),
+                        chr_ram_size (u32), file size (u32), file modification time (u64, seconds)
+        Strings     NUL-terminated paths
+*/
+
+#define ROM_INDEX_MAGIC         "UNCI"
+#define ROM_INDEX_VERSION       2
+#define ROM_INDEX_HEADER_SIZE   16
+#define ROM_INDEX_RECORD_SIZE   72
+
+// Rom_Index_Entry.flags
+#define ROM_INDEX_BATTERY   0x01
+#define ROM_INDEX_TRAINER   0x02
+#define ROM_INDEX_NES2      0x04
+
+typedef struct Rom_Index_Entry{
+    uint32_t crc32;         // PRG + CHR, header excluded (as used by No-Intro and friends)
+    uint32_t prg_crc32;
+    uint32_t chr_crc32;
+    uint8_t sha1[20];       // PRG + CHR
+    uint32_t prg_rom_size;
+    uint32_t chr_rom_size;
+    uint32_t prg_ram_size;  // work RAM and battery-backed RAM together
+    uint16_t mapper;
+    uint8_t submapper;
+    uint8_t region;         // Region
+    uint8_t mirroring;      // Mirroring
+    uint8_t flags;
+    uint32_t chr_ram_size;
+    uint32_t file_size;     // what the file was when indexed, to tell if it has changed since
+    uint64_t file_mtime;
+    const char* path;
+} Rom_Index_Entry;
+
+typedef struct Rom_Index{
+    uint32_t count;
+    Rom_Index_Entry* entries;
+    char* strings;
+} Rom_Index;
+
+// Index every .nes file under dir into out_path using the given number of threads, this one included. Symlinks
+// to directories aren't followed. Returns 0 on success.
+int rom_index_build(const char* dir, const char* out_path, int threads);
+
+// Read an index written by rom_index_build(). Returns 0 on success.
+int rom_index_load(const char* path, Rom_Index* index);
+void rom_index_free(Rom_Index* index);
+
+// Look up a ROM by its path as it was indexed (binary search), or by CRC32. NULL if not found.
+const Rom_Index_Entry* rom_index_find_path(const Rom_Index* index, const char* path);
+const Rom_Index_Entry* rom_index_find_crc32(const Rom_Index* index, uint32_t crc32);
+
+// True if the entry's file still has the size and modification time it was indexed with
+bool rom_index_current(const Rom_Index_Entry* entry);
+
+// The header an entry was indexed from, for load_rom_header()
+void rom_index_header(const Rom_Index_Entry* entry, Rom_Header* header);
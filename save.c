@@ -0,0 +1,183 @@
+#include "save.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// The ROM's path with its extension swapped for a new one
+static char* save_path_with_extension(const char* rom_path, const char* extension){
+    const char* name = rom_path;
+    for(const char* c = rom_path; *c; c++){
+        if(*c == '/' || *c == '\\'){
+            name = c + 1;
+        }
+    }
+
+    const char* dot = strrchr(name, '.');
+    size_t stem = dot ? (size_t)(dot - rom_path) : strlen(rom_path);
+
+    char* path = malloc(stem + strlen(extension) + 1);
+    memcpy(path, rom_path, stem);
+    strcpy(&path[stem], extension);
+    return path;
+}
+
+#ifndef _WIN32
+// Bytes of address space PRG RAM takes up: all of it, in whole pages of memory
+static size_t save_mapping_size(const Cartridge* cart){
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (cart->prg_ram_size + page - 1) / page * page;
+}
+#endif
+
+int save_open(Cartridge* cart, const char* rom_path){
+    size_t size = cart->save_size;
+    if(size == 0){
+        return 1;
+    }
+
+    char* path = save_path_with_extension(rom_path, ".sav");
+
+#ifdef _WIN32
+    // No mmap; load whatever is there and write it all back in save_close()
+    uint8_t* ram = calloc(1, cart->prg_ram_size);
+    FILE* file = fopen(path, "rb");
+    if(file != NULL){
+        fread(ram, 1, size, file);
+        fclose(file);
+    }
+#else
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0){
+        printf("ERROR! Couldn't open save file '%s'.\n", path);
+        free(path);
+        return 1;
+    }
+
+    // A new (or short) save starts out as zeroed RAM
+    struct stat info;
+    if(fstat(fd, &info) != 0 || ((size_t)info.st_size < size && ftruncate(fd, size) != 0)){
+        printf("ERROR! Couldn't size save file '%s'.\n", path);
+        close(fd);
+        free(path);
+        return 1;
+    }
+
+    // PRG RAM can be bigger than the save (a whole page for 1kB of MMC6 NVRAM), so reserve all of it as plain
+    // memory and map the file over the start. Past the end of the file, but within its last page of memory,
+    // accesses are fine and never reach the disk.
+    size_t mapping_size = save_mapping_size(cart);
+    uint8_t* ram = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ram != MAP_FAILED && mmap(ram, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED){
+        munmap(ram, mapping_size);
+        ram = MAP_FAILED;
+    }
+    close(fd); // the mapping keeps the file open
+    if(ram == MAP_FAILED){
+        printf("ERROR! Couldn't map save file '%s'.\n", path);
+        free(path);
+        return 1;
+    }
+#endif
+
+    cart->prg_ram = ram;
+    cart->save_path = path;
+    cart->save_frames = 0;
+
+    printf("Battery save: '%s'\n", path);
+    return 0;
+}
+
+void save_sync(Cartridge* cart){
+    if(cart->save_path == NULL || ++cart->save_frames < SAVE_SYNC_INTERVAL){
+        return;
+    }
+    cart->save_frames = 0;
+
+#ifndef _WIN32
+    // Only queues the dirty pages for writing; never blocks the emulation thread on the disk
+    msync(cart->prg_ram, cart->save_size, MS_ASYNC);
+#endif
+}
+
+void save_detach(Cartridge* cart){
+    if(cart->save_path == NULL){
+        return;
+    }
+
+#ifndef _WIN32
+    // Anything already written to the mapping stays in the file; from here on nothing is
+    uint8_t* ram = malloc(cart->prg_ram_size);
+    memcpy(ram, cart->prg_ram, cart->prg_ram_size);
+    munmap(cart->prg_ram, save_mapping_size(cart));
+    if(cart->prg_pages[0] == cart->prg_ram){
+        cart->prg_pages[0] = ram;
+    }
+    cart->prg_ram = ram;
+#endif
+
+    free(cart->save_path);
+    cart->save_path = NULL;
+}
+
+int save_close(Cartridge* cart){
+    if(cart->save_path == NULL){
+        return 0;
+    }
+
+    // The save file is written in place as the game runs. For the final copy, write a whole new file and rename
+    // it over the old one, so whatever happens the save on disk is either entirely old or entirely new.
+    char* temp_path = malloc(strlen(cart->save_path) + 5);
+    sprintf(temp_path, "%s.tmp", cart->save_path);
+
+    int status = 1;
+    FILE* file = fopen(temp_path, "wb");
+    if(file != NULL){
+        bool written = fwrite(cart->prg_ram, 1, cart->save_size, file) == cart->save_size && fflush(file) == 0;
+#ifdef _WIN32
+        written = written && _commit(_fileno(file)) == 0;
+#else
+        written = written && fsync(fileno(file)) == 0;
+#endif
+        fclose(file);
+
+#ifdef _WIN32
+        // rename() won't replace an existing file here
+        if(written){
+            remove(cart->save_path);
+        }
+#endif
+        if(written && rename(temp_path, cart->save_path) == 0){
+            status = 0;
+        } else{
+            remove(temp_path);
+        }
+    }
+
+    if(status != 0){
+        printf("ERROR! Couldn't write save file '%s'.\n", cart->save_path);
+    }
+
+#ifdef _WIN32
+    free(cart->prg_ram);
+#else
+    // Even if the final write failed, the mapped file holds everything up to now
+    munmap(cart->prg_ram, save_mapping_size(cart));
+#endif
+    cart->prg_ram = NULL;
+    cart->prg_pages[0] = NULL;
+
+    free(temp_path);
+    free(cart->save_path);
+    cart->save_path = NULL;
+    return status;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include "cartridge.h"
+
+/*  Battery-backed PRG RAM, kept in a .sav file next to the ROM. The file is mapped straight in as the cartridge's
+    PRG RAM, so the game's own writes are the save and nothing extra happens on the CPU's write path. The kernel is
+    asked to write changes back every so often, and on exit the file is replaced atomically.
+*/
+
+// Frames between asynchronous write-backs of the save file
+#define SAVE_SYNC_INTERVAL 60
+
+// Map (creating if need be) the save file for a ROM as the cartridge's PRG RAM. cart->prg_ram_size and save_size
+// must be set; the file holds save_size bytes, and any RAM past them is plain memory. Returns 0 on success, 1 if
+// the cartridge should fall back to plain RAM.
+int save_open(Cartridge* cart, const char* rom_path);
+
+// Call once per frame; schedules a write-back every SAVE_SYNC_INTERVAL frames without waiting for the disk
+void save_sync(Cartridge* cart);
+
+// Write the save out atomically (temporary file, fsync, rename) and release it. Returns 0 on success.
+int save_close(Cartridge* cart);
+// Carry on with a private copy of PRG RAM and leave the save file as it is. Used for movie playback, which sets up
+// its own starting RAM.
+void save_detach(Cartridge* cart);
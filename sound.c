@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "sound.h"
+#include "audio.h"
+#include "timeline.h"
+
+// SDL's audio thread: play whatever the emulation has queued, holding the last sample if it's behind
+static void sound_callback(void* data, Uint8* stream, int length){
+    Sound* sound = (Sound*)data;
+    int16_t* out = (int16_t*)stream;
+    int count = length / sizeof(int16_t);
+    TIMELINE_THREAD("audio");
+    TIMELINE_BEGIN("audio callback");
+
+    int got = sample_queue_pop(&sound->queue, out, count);
+    if(got > 0){
+        sound->last = out[got - 1];
+    }
+    for(int i = got; i < count; i++){
+        out[i] = sound->last;
+    }
+    TIMELINE_END();
+}
+
+int sound_init(Sound* sound){
+    memset(sound, 0, sizeof(Sound));
+    sample_queue_init(&sound->queue);
+    sound->fill = SOUND_TARGET_FILL;
+    sound->ratio = 1;
+    sound->ratio_min = 1;
+    sound->ratio_max = 1;
+    sound->latency_min = UINT32_MAX;
+
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO) != 0){
+        printf("ERROR! Failed to initialise SDL audio: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    SDL_AudioSpec want = { 0 };
+    want.freq = AUDIO_SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = SOUND_DEVICE_SAMPLES;
+    want.callback = sound_callback;
+    want.userdata = sound;
+
+    SDL_AudioSpec have;
+    sound->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if(sound->device == 0){
+        printf("ERROR! Failed to open audio device: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    // Paused until there's something to play
+    return 0;
+}
+
+double sound_push(Sound* sound, const int16_t* samples, int count){
+    sample_queue_push(&sound->queue, samples, count);
+
+    uint32_t fill = sample_queue_fill(&sound->queue);
+    sound->latency_total += fill;
+    sound->latency_count++;
+    if(fill < sound->latency_min){
+        sound->latency_min = fill;
+    }
+    if(fill > sound->latency_max){
+        sound->latency_max = fill;
+    }
+
+    if(!sound->playing){
+        if(fill < SOUND_TARGET_FILL){
+            return 1;
+        }
+        SDL_PauseAudioDevice(sound->device, 0);
+        sound->playing = true;
+    }
+
+    // Fuller than the target: make fewer samples per frame, emptier: more
+    sound->fill += SOUND_FILL_SMOOTHING * (fill - sound->fill);
+    double error = (SOUND_TARGET_FILL - sound->fill) / SOUND_TARGET_FILL;
+    if(error > 1){
+        error = 1;
+    } else if(error < -1){
+        error = -1;
+    }
+
+    sound->integral += SOUND_INTEGRAL_GAIN * SOUND_MAX_ADJUST * error;
+    if(sound->integral > SOUND_MAX_ADJUST){
+        sound->integral = SOUND_MAX_ADJUST;
+    } else if(sound->integral < -SOUND_MAX_ADJUST){
+        sound->integral = -SOUND_MAX_ADJUST;
+    }
+
+    double adjust = SOUND_MAX_ADJUST * error + sound->integral;
+    if(adjust > SOUND_MAX_ADJUST){
+        adjust = SOUND_MAX_ADJUST;
+    } else if(adjust < -SOUND_MAX_ADJUST){
+        adjust = -SOUND_MAX_ADJUST;
+    }
+    sound->ratio = 1 + adjust;
+
+    if(sound->ratio < sound->ratio_min){
+        sound->ratio_min = sound->ratio;
+    }
+    if(sound->ratio > sound->ratio_max){
+        sound->ratio_max = sound->ratio;
+    }
+    return sound->ratio;
+}
+
+void sound_report(Sound* sound){
+    if(sound->latency_count == 0){
+        return;
+    }
+
+    double ms = 1000.0 / AUDIO_SAMPLE_RATE;
+    double device = SOUND_DEVICE_SAMPLES * ms;
+
+    printf("Audio: %u underruns (%u samples), %u overruns (%u samples dropped)\n",
+        atomic_load(&sound->queue.underruns), atomic_load(&sound->queue.missing),
+        atomic_load(&sound->queue.overruns), atomic_load(&sound->queue.dropped));
+    printf("  Latency: avg %.1f ms, min %.1f ms, max %.1f ms queued, plus %.1f ms in the device\n",
+        (double)sound->latency_total / sound->latency_count * ms, sound->latency_min * ms, sound->latency_max * ms,
+        device);
+    printf("  Rate control: ratio %.4f - %.4f\n", sound->ratio_min, sound->ratio_max);
+}
+
+void sound_destroy(Sound* sound){
+    if(sound->device != 0){
+        SDL_CloseAudioDevice(sound->device);
+        sound->device = 0;
+    }
+}
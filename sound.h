@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL.h>
+#include "queue.h"
+
+/*  Live audio output through SDL. The emulation thread pushes each frame's samples into a lock-free ring, and
+    the device's callback drains it on SDL's audio thread; neither ever waits for the other.
+
+    The emulation thread is paced by the host's clock and the device by its own, and the NES doesn't run at
+    exactly 60Hz anyway, so left alone the ring would slowly fill up or run dry. Instead, every frame the
+    resampling ratio is nudged (by at most SOUND_MAX_ADJUST either way, far too little to hear as pitch) in
+    proportion to how far the ring is from SOUND_TARGET_FILL. Audio then follows the device's clock without
+    the emulation ever stalling on it. A small integral term takes out the steady offset (the NES's 60.1Hz
+    against the host's 60Hz) so the ring really does settle at the target rather than somewhere below it.
+*/
+
+#define SOUND_DEVICE_SAMPLES    512     // samples per callback (~11ms)
+#define SOUND_TARGET_FILL       1600    // samples the rate control aims to keep queued (~33ms, two frames)
+#define SOUND_MAX_ADJUST        0.005   // ±0.5%
+#define SOUND_FILL_SMOOTHING    0.05    // weight of each new fill reading; the callback makes it jumpy
+#define SOUND_INTEGRAL_GAIN     0.01    // share of the proportional adjustment accumulated per frame
+
+typedef struct Sound{
+    SDL_AudioDeviceID device;
+    Sample_Queue queue;
+
+    // Callback only: the last sample played, held through underruns so a gap doesn't also click
+    int16_t last;
+
+    // Rate control (emulation thread only). The device is started once the ring first reaches its target.
+    bool playing;
+    double fill;            // smoothed ring fill, in samples
+    double integral;
+    double ratio;
+    double ratio_min;
+    double ratio_max;
+
+    // Queued latency, sampled after each push (emulation thread only)
+    uint64_t latency_total;
+    uint32_t latency_count;
+    uint32_t latency_min;
+    uint32_t latency_max;
+} Sound;
+
+// Open the default audio device at AUDIO_SAMPLE_RATE, mono. Returns 0 on success.
+int sound_init(Sound* sound);
+
+// Emulation thread: queue a frame's samples. Returns the resampling ratio to make the next frame with.
+double sound_push(Sound* sound, const int16_t* samples, int count);
+
+// Print under/overrun counts, latency and how far the rate control had to go
+void sound_report(Sound* sound);
+
+void sound_destroy(Sound* sound);
@@ -0,0 +1,215 @@
+#include "state.h"
+#include "system.h"
+#include "checksum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#define STATE_NULL      0xFFFFFFFF
+#define STATE_UNKNOWN   0xFFFFFFFE
+
+uint32_t state_pointer_offset(const uint8_t* pointer){
+    const Cartridge* cart = nes.cart;
+    if(pointer == NULL){
+        return STATE_NULL;
+    } else if(cart->prg_rom != NULL && pointer >= cart->prg_rom && pointer < cart->prg_rom + cart->prg_rom_size){
+        return 0x10000000 | (pointer - cart->prg_rom);
+    } else if(cart->prg_ram != NULL && pointer >= cart->prg_ram && pointer < cart->prg_ram + cart->prg_ram_size){
+        return 0x20000000 | (pointer - cart->prg_ram);
+    } else if(cart->chr != NULL && pointer >= cart->chr && pointer < cart->chr + cart->chr_size){
+        return 0x30000000 | (pointer - cart->chr);
+    } else if(pointer >= nes.ppu->vram && pointer < nes.ppu->vram + sizeof(nes.ppu->vram)){
+        return 0x40000000 | (pointer - nes.ppu->vram);
+    }
+    return STATE_UNKNOWN;
+}
+
+uint8_t* state_offset_pointer(uint32_t offset){
+    uint32_t within = offset & 0x0FFFFFFF;
+    switch(offset >> 28){
+        case 0x1: return &nes.cart->prg_rom[within];
+        case 0x2: return &nes.cart->prg_ram[within];
+        case 0x3: return &nes.cart->chr[within];
+        case 0x4: return &nes.ppu->vram[within];
+        default:  return NULL;
+    }
+}
+
+// One walk over every field serves for sizing, saving and loading
+typedef struct State_Buffer{
+    uint8_t* data;      // NULL when only measuring
+    size_t position;
+    bool load;
+} State_Buffer;
+
+static void state_bytes(State_Buffer* buffer, void* field, size_t size){
+    if(buffer->data != NULL){
+        if(buffer->load){
+            memcpy(field, &buffer->data[buffer->position], size);
+        } else{
+            memcpy(&buffer->data[buffer->position], field, size);
+        }
+    }
+    buffer->position += size;
+}
+
+#define STATE_FIELD(buffer, field) state_bytes(buffer, &(field), sizeof(field))
+
+static void state_pages(State_Buffer* buffer, uint8_t** pages, int count){
+    uint32_t offsets[16];
+    for(int i = 0; i < count; i++){
+        offsets[i] = state_pointer_offset(pages[i]);
+    }
+    state_bytes(buffer, offsets, count * sizeof(uint32_t));
+    if(buffer->load){
+        for(int i = 0; i < count; i++){
+            pages[i] = state_offset_pointer(offsets[i]);
+        }
+    }
+}
+
+static void state_walk(State_Buffer* buffer){
+    CPU* cpu = nes.cpu;
+    PPU* ppu = nes.ppu;
+    APU* apu = nes.apu;
+    Cartridge* cart = nes.cart;
+
+    STATE_FIELD(buffer, nes.cycles);
+    STATE_FIELD(buffer, nes.buttons);
+    STATE_FIELD(buffer, nes.controllers);
+    STATE_FIELD(buffer, nes.input_polled);
+
+    STATE_FIELD(buffer, cpu->ram);
+    STATE_FIELD(buffer, cpu->a);
+    STATE_FIELD(buffer, cpu->x);
+    STATE_FIELD(buffer, cpu->y);
+    STATE_FIELD(buffer, cpu->pc);
+    STATE_FIELD(buffer, cpu->s);
+    STATE_FIELD(buffer, cpu->p);
+    STATE_FIELD(buffer, cpu->cycles);
+    STATE_FIELD(buffer, cpu->stall);
+    STATE_FIELD(buffer, cpu->nmi);
+    STATE_FIELD(buffer, cpu->irq);
+
+    STATE_FIELD(buffer, ppu->vram);
+    STATE_FIELD(buffer, ppu->palette);
+    STATE_FIELD(buffer, ppu->mirroring);
+    STATE_FIELD(buffer, ppu->oam);
+    STATE_FIELD(buffer, ppu->reg_ppuctrl);
+    STATE_FIELD(buffer, ppu->reg_ppumask);
+    STATE_FIELD(buffer, ppu->reg_ppustatus);
+    STATE_FIELD(buffer, ppu->reg_oamaddr);
+    STATE_FIELD(buffer, ppu->reg_oamdma);
+    STATE_FIELD(buffer, ppu->ppu_cycles);
+    STATE_FIELD(buffer, ppu->ppu_scanline);
+    STATE_FIELD(buffer, ppu->dots);
+    STATE_FIELD(buffer, ppu->nmi_occurred);
+    STATE_FIELD(buffer, ppu->frame_count);
+    STATE_FIELD(buffer, ppu->v);
+    STATE_FIELD(buffer, ppu->t);
+    STATE_FIELD(buffer, ppu->fine_x);
+    STATE_FIELD(buffer, ppu->w);
+    STATE_FIELD(buffer, ppu->ppu_read_buffer);
+    state_pages(buffer, ppu->pages, 16);
+
+    // The APU has no pointers; everything before the mixer output is channel and frame counter state
+    state_bytes(buffer, apu, offsetof(APU, output));
+    STATE_FIELD(buffer, apu->output);
+
+    if(cart->prg_ram != NULL){
+        state_bytes(buffer, cart->prg_ram, cart->prg_ram_size);
+    }
+    if(cart->chr_ram){
+        state_bytes(buffer, cart->chr, cart->chr_size);
+    }
+    state_pages(buffer, cart->prg_pages, 5);
+    STATE_FIELD(buffer, cart->prg_ram_writable);
+    STATE_FIELD(buffer, cart->mmc3);   // the mapper register union (MMC3's is the largest)
+}
+
+size_t state_size(){
+    State_Buffer buffer = { NULL, 0, false };
+    state_walk(&buffer);
+    return buffer.position;
+}
+
+void state_save(uint8_t* data){
+    State_Buffer buffer = { data, 0, false };
+    state_walk(&buffer);
+}
+
+void state_load(const uint8_t* data){
+    State_Buffer buffer = { (uint8_t*)data, 0, true };
+    state_walk(&buffer);
+
+    // Nothing drawn or synthesized before belongs to this state
+    ppu_invalidate(nes.ppu);
+    audio_init(&nes.apu->audio, APU_CPU_FREQUENCY);
+    nes.apu->audio.base_cycle = nes.cycles;
+}
+
+static void put32(uint8_t* out, uint32_t value){
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+static uint32_t get32(const uint8_t* in){
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+int state_save_file(const char* path){
+    size_t size = state_size();
+    uint8_t* data = malloc(STATE_HEADER_SIZE + size);
+    memcpy(data, STATE_MAGIC, 4);
+    put32(&data[4], STATE_VERSION);
+    put32(&data[8], crc32(0, nes.cart->file, nes.cart->file_size));
+    put32(&data[12], size);
+    state_save(&data[STATE_HEADER_SIZE]);
+
+    int status = 1;
+    FILE* file = fopen(path, "wb");
+    if(file != NULL){
+        status = fwrite(data, 1, STATE_HEADER_SIZE + size, file) != STATE_HEADER_SIZE + size;
+        status |= fclose(file) != 0;
+    }
+    if(status != 0){
+        printf("ERROR! Couldn't write state '%s'.\n", path);
+    }
+
+    free(data);
+    return status;
+}
+
+int state_load_file(const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        printf("ERROR! Couldn't open state '%s'.\n", path);
+        return 1;
+    }
+
+    size_t size = state_size();
+    uint8_t header[STATE_HEADER_SIZE];
+    uint8_t* data = malloc(size);
+    int status = 0;
+    if(fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, STATE_MAGIC, 4) != 0
+        || get32(&header[4]) != STATE_VERSION || get32(&header[12]) != size){
+        printf("ERROR! '%s' is not a state for this version.\n", path);
+        status = 1;
+    } else if(get32(&header[8]) != crc32(0, nes.cart->file, nes.cart->file_size)){
+        printf("ERROR! State '%s' is for a different ROM.\n", path);
+        status = 1;
+    } else if(fread(data, 1, size, file) != size){
+        printf("ERROR! State '%s' is truncated.\n", path);
+        status = 1;
+    } else{
+        state_load(data);
+    }
+
+    fclose(file);
+    free(data);
+    return status;
+}
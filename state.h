@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*  Savestates: everything the emulation's future depends on (CPU, PPU, APU, controllers, cartridge RAM, banks
+    and mapper registers), for checkpointing a run and picking it up again, possibly in another process. Caches
+    (scanline reuse, the nametable cache) aren't saved; loading a state invalidates them. Neither is audio
+    output: the pipeline restarts from silence.
+
+    Fields are stored as the host lays them out, so states only move between builds of the same version on the
+    same kind of machine. Pointers are stored as offsets into the memory they point at.
+
+    File layout: magic "UNCS", version (u32), ROM crc32 (u32), data size (u32), then the data.
+*/
+
+#define STATE_MAGIC         "UNCS"
+#define STATE_VERSION       1
+#define STATE_HEADER_SIZE   16
+
+// Where a pointer into ROM, cartridge RAM or VRAM points, as a tagged offset that means the same thing in any
+// process. NULL and unknown pointers get their own values.
+uint32_t state_pointer_offset(const uint8_t* pointer);
+uint8_t* state_offset_pointer(uint32_t offset);
+
+// Size of the machine's state (without the header)
+size_t state_size();
+
+// Copy the machine's state out to / in from a buffer of state_size() bytes
+void state_save(uint8_t* data);
+void state_load(const uint8_t* data);
+
+// Returns 0 on success. A state for a different ROM or version is refused.
+int state_save_file(const char* path);
+int state_load_file(const char* path);
@@ -0,0 +1,283 @@
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+Stats* frame_stats = NULL;
+
+static volatile sig_atomic_t dump_requested = 0;
+
+static const char* series_names[STATS_SERIES] = {
+    "cpu_ms", "ppu_ms", "render_ms", "audio_ms", "frontend_ms", "sleep_ms", "frame_ms",
+    "upload_ms", "present_ms", "present_interval_ms",
+    "instructions", "dots", "nmis"
+};
+
+double stats_seconds(){
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+uint64_t stats_clock_ticks(){
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+int stats_start(){
+    frame_stats = calloc(1, sizeof(Stats));
+    if(frame_stats == NULL){
+        return 1;
+    }
+    frame_stats->origin_ticks = stats_ticks();
+    frame_stats->origin_seconds = stats_seconds();
+    return 0;
+}
+
+void stats_stop(){
+    free(frame_stats);
+    frame_stats = NULL;
+}
+
+double stats_ms(uint64_t ticks){
+    double seconds = stats_seconds() - frame_stats->origin_seconds;
+    uint64_t elapsed = stats_ticks() - frame_stats->origin_ticks;
+    return (elapsed > 0) ? ticks * seconds * 1000 / elapsed : 0;
+}
+
+static void stats_record(Stats_Series_Id id, double value){
+    Stats_Series* series = &frame_stats->series[id];
+    series->window[series->count % STATS_WINDOW] = value;
+    series->count++;
+    series->total += value;
+    if(value > series->max){
+        series->max = value;
+    }
+
+    // Times are bucketed in us, counts as they are. Bucket n > 0 holds up to 2^(n/2).
+    double unit = (id < STATS_INSTRUCTIONS) ? value * 1000 : value;
+    int bucket = (unit > 1) ? (int)ceil(2 * log2(unit)) : 0;
+    series->histogram[(bucket < STATS_BUCKETS) ? bucket : STATS_BUCKETS - 1]++;
+}
+
+void stats_frame_start(uint64_t dots){
+    Stats* stats = frame_stats;
+    if(stats == NULL){
+        return;
+    }
+    stats->frame_start = stats_ticks();
+    stats->dots_start = dots;
+    stats->render_ticks = 0;
+    stats->audio_ticks = 0;
+    stats->cpu_sampled = 0;
+    stats->ppu_sampled = 0;
+    stats->instructions = 0;
+    stats->nmis = 0;
+}
+
+void stats_frame_emulated(){
+    if(frame_stats != NULL){
+        frame_stats->emulated = stats_ticks();
+    }
+}
+
+void stats_frame_sleep(){
+    if(frame_stats != NULL){
+        frame_stats->sleep_start = stats_ticks();
+    }
+}
+
+void stats_frame_end(uint64_t dots){
+    Stats* stats = frame_stats;
+    if(stats == NULL){
+        return;
+    }
+    uint64_t now = stats_ticks();
+
+    // Emulation less the exactly timed parts is CPU and PPU, split as the samples were
+    int64_t rest = (int64_t)(stats->emulated - stats->frame_start - stats->render_ticks - stats->audio_ticks);
+    if(rest < 0){
+        rest = 0;
+    }
+    uint64_t sampled = stats->cpu_sampled + stats->ppu_sampled;
+    double cpu_share = (sampled > 0) ? (double)stats->cpu_sampled / sampled : 0.5;
+
+    double cpu = stats_ms(rest) * cpu_share;
+    stats_record(STATS_CPU, cpu);
+    stats_record(STATS_PPU, stats_ms(rest) - cpu);
+    stats_record(STATS_RENDER, stats_ms(stats->render_ticks));
+    stats_record(STATS_AUDIO, stats_ms(stats->audio_ticks));
+    stats_record(STATS_FRONTEND, stats_ms(stats->sleep_start - stats->emulated));
+    stats_record(STATS_SLEEP, stats_ms(now - stats->sleep_start));
+    stats_record(STATS_FRAME, stats_ms(now - stats->frame_start));
+
+    stats_record(STATS_INSTRUCTIONS, stats->instructions);
+    stats_record(STATS_DOTS, dots - stats->dots_start);
+    stats_record(STATS_NMIS, stats->nmis);
+}
+
+void stats_upload(double ms){
+    if(frame_stats != NULL){
+        stats_record(STATS_UPLOAD, ms);
+    }
+}
+
+void stats_present(double ms){
+    Stats* stats = frame_stats;
+    if(stats == NULL){
+        return;
+    }
+    uint64_t now = stats_ticks();
+    stats_record(STATS_PRESENT, ms);
+    if(stats->last_present != 0){
+        stats_record(STATS_INTERVAL, stats_ms(now - stats->last_present));
+    }
+    stats->last_present = now;
+}
+
+int stats_recent(Stats_Series_Id id, float* values, int count){
+    const Stats_Series* series = &frame_stats->series[id];
+    int available = (series->count < STATS_WINDOW) ? series->count : STATS_WINDOW;
+    if(count > available){
+        count = available;
+    }
+    for(int i = 0; i < count; i++){
+        values[i] = series->window[(series->count - 1 - i) % STATS_WINDOW];
+    }
+    return count;
+}
+
+/* ------------------------------------ Reports ------------------------------------ */
+
+typedef struct Stats_Summary{
+    uint64_t count;
+    double mean, max;
+    double p50, p99, window_max;    // over the rolling window
+} Stats_Summary;
+
+static int compare_float(const void* a, const void* b){
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+static Stats_Summary stats_summarise(const Stats_Series* series){
+    Stats_Summary summary = { series->count, 0, series->max, 0, 0, 0 };
+    int n = (series->count < STATS_WINDOW) ? series->count : STATS_WINDOW;
+    if(n == 0){
+        return summary;
+    }
+    summary.mean = series->total / series->count;
+
+    // Nearest rank
+    float sorted[STATS_WINDOW];
+    memcpy(sorted, series->window, n * sizeof(float));
+    qsort(sorted, n, sizeof(float), compare_float);
+    summary.p50 = sorted[(int)ceil(0.50 * n) - 1];
+    summary.p99 = sorted[(int)ceil(0.99 * n) - 1];
+    summary.window_max = sorted[n - 1];
+    return summary;
+}
+
+static double stats_elapsed(){
+    return stats_seconds() - frame_stats->origin_seconds;
+}
+
+int stats_write_json(const char* path){
+    if(frame_stats == NULL || path == NULL){
+        return 1;
+    }
+    FILE* file = fopen(path, "w");
+    if(file == NULL){
+        printf("ERROR! Could not open '%s' for frame stats\n", path);
+        return 1;
+    }
+
+    const Stats_Series* series = frame_stats->series;
+    double seconds = stats_elapsed();
+    fprintf(file, "{\n  \"seconds\": %.3f,\n  \"frames\": %llu,\n  \"presents\": %llu,\n", seconds,
+        (unsigned long long)series[STATS_FRAME].count, (unsigned long long)series[STATS_PRESENT].count);
+    fprintf(file, "  \"instructions_per_second\": %.0f,\n  \"dots_per_second\": %.0f,\n  \"nmis_per_frame\": %.3f,\n",
+        series[STATS_INSTRUCTIONS].total / seconds, series[STATS_DOTS].total / seconds,
+        series[STATS_NMIS].count ? series[STATS_NMIS].total / series[STATS_NMIS].count : 0);
+    fprintf(file, "  \"window_frames\": %d,\n  \"series\": {\n", STATS_WINDOW);
+
+    for(int id = 0; id < STATS_SERIES; id++){
+        Stats_Summary s = stats_summarise(&series[id]);
+        fprintf(file, "    \"%s\": {\"count\": %llu, \"mean\": %.4f, \"max\": %.4f, \"p50\": %.4f, \"p99\": %.4f, "
+            "\"window_max\": %.4f, \"histogram\": [", series_names[id], (unsigned long long)s.count, s.mean, s.max,
+            s.p50, s.p99, s.window_max);
+
+        // Only the buckets in use, each as [upper bound, count]; times are in us here
+        bool first = true;
+        for(int bucket = 0; bucket < STATS_BUCKETS; bucket++){
+            if(series[id].histogram[bucket] > 0){
+                fprintf(file, "%s[%.1f, %u]", first ? "" : ", ", pow(2, bucket / 2.0), series[id].histogram[bucket]);
+                first = false;
+            }
+        }
+        fprintf(file, "]}%s\n", (id + 1 < STATS_SERIES) ? "," : "");
+    }
+
+    fprintf(file, "  }\n}\n");
+    fclose(file);
+    return 0;
+}
+
+void stats_report(){
+    if(frame_stats == NULL){
+        return;
+    }
+    const Stats_Series* series = frame_stats->series;
+    double seconds = stats_elapsed();
+    printf("Frame timing over %.1fs: %.2fM instructions/s, %.2fM PPU dots/s, %.2f NMIs per frame\n", seconds,
+        series[STATS_INSTRUCTIONS].total / seconds / 1e6, series[STATS_DOTS].total / seconds / 1e6,
+        series[STATS_NMIS].count ? series[STATS_NMIS].total / series[STATS_NMIS].count : 0);
+    printf("  %-20s %9s %9s %9s %9s (last %d: p50, p99)\n", "", "mean", "max", "p50", "p99", STATS_WINDOW);
+    for(int id = 0; id < STATS_INSTRUCTIONS; id++){
+        Stats_Summary s = stats_summarise(&series[id]);
+        if(s.count > 0){
+            printf("  %-20s %9.3f %9.3f %9.3f %9.3f\n", series_names[id], s.mean, s.max, s.p50, s.p99);
+        }
+    }
+}
+
+static void stats_signal(int signal){
+    (void)signal;
+    dump_requested = 1;
+}
+
+void stats_install_signal(){
+#ifdef SIGUSR1
+    signal(SIGUSR1, stats_signal);
+#endif
+}
+
+bool stats_dump_requested(){
+    if(!dump_requested){
+        return false;
+    }
+    dump_requested = 0;
+    return true;
+}
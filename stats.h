@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*  Host-side frame timing: where each frame's wall time goes, kept cheap enough to leave on in normal use.
+
+    The emulation thread's frame is split into CPU, PPU, render (drawing scanlines), audio (the APU's frame
+    end and its samples' trip to the device), frontend (the rest of the loop) and sleep. The presentation
+    thread adds texture upload, present and the interval between presents. Alongside are per-frame counts of
+    CPU instructions (interrupts included), PPU dots and NMIs.
+
+    Everything is timed with stats_ticks(): rdtsc where there is one, otherwise the OS's monotonic clock,
+    converted to time against that clock at report time. Most of it is a few stamps per frame. CPU and PPU
+    run interleaved a few cycles at a time, which is too fine to stamp exactly, so every STATS_SAMPLE-th
+    instruction is timed and the frame's emulation time (less render and audio, which are timed exactly) is
+    split between them in the proportion those samples show.
+
+    Each series keeps its last STATS_WINDOW frames for rolling percentiles (p50/p99/max), plus whole-run
+    totals, maximum and a histogram in half-octave buckets. All of it is written as JSON at exit and whenever
+    the process gets SIGUSR1, and main.c can draw the emulation phases as a frame time graph over the picture.
+
+    Each thread only writes its own series; a report taken mid-run may mix frames from the two.
+*/
+
+#define STATS_WINDOW    600     // frames in the rolling window (10s)
+#define STATS_SAMPLE    16      // one instruction in this many has its CPU/PPU split timed
+#define STATS_BUCKETS   48      // half-octave histogram buckets, from 1us up
+
+typedef enum Stats_Series_Id{
+    // Emulation thread, ms per emulated frame
+    STATS_CPU,
+    STATS_PPU,
+    STATS_RENDER,
+    STATS_AUDIO,
+    STATS_FRONTEND,
+    STATS_SLEEP,
+    STATS_FRAME,        // the whole frame, sleep included
+
+    // Presentation thread, ms per present
+    STATS_UPLOAD,
+    STATS_PRESENT,
+    STATS_INTERVAL,     // since the previous present
+
+    // Emulation thread, counts per emulated frame
+    STATS_INSTRUCTIONS,
+    STATS_DOTS,
+    STATS_NMIS,
+
+    STATS_SERIES
+} Stats_Series_Id;
+
+typedef struct Stats_Series{
+    float window[STATS_WINDOW];
+    uint64_t count;
+    double total;
+    double max;
+    uint32_t histogram[STATS_BUCKETS];
+} Stats_Series;
+
+typedef struct Stats{
+    // Tick clock calibration: ticks and seconds when collection started
+    uint64_t origin_ticks;
+    double origin_seconds;
+
+    // Emulation thread: the frame in progress. The core adds to the counters directly (see system.c, ppu.c).
+    uint64_t frame_start;
+    uint64_t emulated;          // when system_run_frame() returned
+    uint64_t sleep_start;
+    uint64_t render_ticks;
+    uint64_t audio_ticks;
+    uint64_t cpu_sampled;       // CPU and PPU ticks of the sampled instructions
+    uint64_t ppu_sampled;
+    uint32_t instructions;
+    uint32_t nmis;
+    uint64_t dots_start;
+
+    // Presentation thread
+    uint64_t last_present;
+
+    Stats_Series series[STATS_SERIES];
+} Stats;
+
+// The running collection, or NULL
+extern Stats* frame_stats;
+
+// The OS's monotonic clock, in seconds and in its own ticks (for hosts without rdtsc)
+double stats_seconds();
+uint64_t stats_clock_ticks();
+
+static inline uint64_t stats_ticks(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return stats_clock_ticks();
+#endif
+}
+
+// Start collecting. Returns 0 on success.
+int stats_start();
+void stats_stop();
+
+// Emulation thread, in order each frame: before system_run_frame(), after it, before sleeping, after sleeping.
+// These (and the presentation ones) do nothing unless collecting.
+void stats_frame_start(uint64_t dots);
+void stats_frame_emulated();
+void stats_frame_sleep();
+void stats_frame_end(uint64_t dots);
+
+// Presentation thread: after each texture upload, and after each present (durations in ms)
+void stats_upload(double ms);
+void stats_present(double ms);
+
+// Ticks to ms, against the calibration so far
+double stats_ms(uint64_t ticks);
+
+// Newest-first values of a series for a graph; returns how many were written
+int stats_recent(Stats_Series_Id id, float* values, int count);
+
+// Write everything as JSON (nothing if path is NULL) / print a summary table
+int stats_write_json(const char* path);
+void stats_report();
+
+// Ask for a JSON dump from a signal handler (SIGUSR1); the main loop picks it up
+void stats_install_signal();
+bool stats_dump_requested();
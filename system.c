@@ -1,14 +1,117 @@
 #include "system.h"
 #include "cpu.h"
 #include "ppu.h"
+#include "profile.h"
+#include "stats.h"
+#include "timeline.h"
 
-void system_init(CPU* cpu, PPU* ppu){
+void system_init(CPU* cpu, PPU* ppu, APU* apu, Cartridge* cart){
     nes.cpu = cpu;
     nes.ppu = ppu;
+    nes.apu = apu;
+    nes.cart = cart;
+    nes.cycles = 0;
+
+    nes.buttons[0] = 0;
+    nes.buttons[1] = 0;
+    controller_init(&nes.controllers[0]);
+    controller_init(&nes.controllers[1]);
+    nes.poll_input = NULL;
+    nes.input_polled = false;
+}
+
+// Sample host input on the game's first look at the controllers this frame
+static void system_poll_input(){
+    if(!nes.input_polled){
+        nes.input_polled = true;
+        if(nes.poll_input != NULL){
+            nes.poll_input();
+        }
+    }
+}
+
+int system_tick(){
+    // IRQ is level triggered; the CPU takes it whenever the line is low and interrupts are enabled
+    nes.cpu->irq = cartridge_irq(nes.cart) || apu_irq(nes.apu);
+
+    // Frame timing (see stats.h): count every step, and time the CPU and PPU halves of every STATS_SAMPLE-th
+    Stats* stats = frame_stats;
+    uint64_t start = 0;
+    if(stats != NULL){
+        stats->nmis += nes.cpu->nmi;
+        if(++stats->instructions % STATS_SAMPLE == 0){
+            start = stats_ticks();
+        }
+    }
+
+    int cpu_cycles = cpu_step(nes.cpu);
+    nes.cycles += cpu_cycles;
+
+    // The APU otherwise only runs when its registers are accessed
+    if(nes.cycles >= nes.apu->next_event){
+        apu_run(nes.apu, nes.cycles);
+    }
+
+    uint64_t cpu_end = 0, render = 0;
+    if(start != 0){
+        cpu_end = stats_ticks();
+        render = stats->render_ticks;
+    }
+
+    for(int i = 0; i < cpu_cycles * 3; i++){
+        ppu_step(nes.ppu);
+    }
+
+    if(start != 0){
+        // Scanlines drawn in the meantime are timed on their own
+        uint64_t end = stats_ticks();
+        stats->cpu_sampled += cpu_end - start;
+        stats->ppu_sampled += end - cpu_end - (stats->render_ticks - render);
+    }
+
+    return cpu_cycles;
 }
 
-void system_tick(){
+void system_begin_frame(){
+    nes.ppu->frame_complete = false;
+    nes.input_polled = false;
 
+    // Whoever wanted last frame's samples has had them
+    nes.apu->audio.output_count = 0;
+}
+
+void system_end_frame(){
+    // Bring the APU up to the end of the frame and turn the frame's audio into samples
+    uint64_t start = (frame_stats != NULL) ? stats_ticks() : 0;
+    TIMELINE_BEGIN("APU frame end");
+    apu_end_frame(nes.apu, nes.cycles);
+    TIMELINE_END();
+    if(frame_stats != NULL){
+        frame_stats->audio_ticks += stats_ticks() - start;
+    }
+
+#ifdef UNICOM_PROFILER
+    if(profile != NULL){
+        profile_end_frame();
+    }
+#endif
+}
+
+void system_run_frame(){
+    system_begin_frame();
+    while(!nes.ppu->frame_complete){
+#ifdef UNICOM_TIMELINE
+        // A scanline's worth of steps per zone
+        TIMELINE_BEGIN("CPU/PPU");
+        for(int scanline = nes.ppu->ppu_scanline; !nes.ppu->frame_complete && nes.ppu->ppu_scanline == scanline;){
+            system_tick();
+        }
+        TIMELINE_END();
+#else
+        system_tick();
+#endif
+    }
+    system_end_frame();
 }
 
 uint8_t read(uint16_t addr){
@@ -17,7 +120,7 @@ uint8_t read(uint16_t addr){
     if(addr >= 0x0000 && addr <= 0x1FFF){
         // Main memory
         // Values are read/written up to 0x07FF, then mirrored through to 0x1FFF
-        data = nes.cpu->memory[addr % 0x0800];
+        data = nes.cpu->ram[addr % 0x0800];
 
     } else if(addr >= 0x2000 && addr <= 0x3FFF){
         // PPU registers
@@ -25,10 +128,31 @@ uint8_t read(uint16_t addr){
 
         data = ppu_read_register(addr);
 
-    } else if(addr >= 0x4020 && addr <= 0xFFFF){
-        // Cartridge space
-        // This is wrong; CPU currently contains entire addressable memory range (should only have 2KiB). For now read from it anyway:
-        data = nes.cpu->memory[addr];
+    } else if(addr == 0x4015){
+        // APU status
+        data = apu_read_status();
+
+    } else if(addr == 0x4016 || addr == 0x4017){
+        // Controllers 1 and 2
+        system_poll_input();
+        data = controller_read(&nes.controllers[addr & 1], nes.buttons[addr & 1]);
+
+    } else if(addr >= 0x6000){
+        // Cartridge PRG RAM/ROM, through whichever banks are currently mapped in
+        uint8_t* page = nes.cart->prg_pages[(addr - 0x6000) >> 13];
+        if(page != NULL){
+            data = page[addr & (PRG_PAGE_SIZE - 1)];
+        }
+
+    } else if(addr >= 0x4020){
+        // Cartridge expansion area
+        if(nes.cart->mapper->cpu_read){
+            data = nes.cart->mapper->cpu_read(nes.cart, addr);
+        }
+
+    } else if(addr >= 0x4000 && addr <= 0x401F){
+        // Write-only APU/DMA registers and the disabled test registers: nothing drives the bus (open bus isn't
+        // modelled, so it reads as 0)
 
     } else{
         // Invalid address
@@ -42,7 +166,7 @@ void write(uint16_t addr, uint8_t data){
     if(addr >= 0x0000 && addr <= 0x1FFF){
         // Main memory
         // Values are read/written up to 0x07FF, then mirrored through to 0x1FFF
-        nes.cpu->memory[addr % 0x0800] = data;
+        nes.cpu->ram[addr % 0x0800] = data;
 
     } else if(addr >= 0x2000 && addr <= 0x3FFF){
         // PPU registers
@@ -51,12 +175,31 @@ void write(uint16_t addr, uint8_t data){
         ppu_write_register(addr, data);
 
     } else if(addr == 0x4014){
-        // PPU OAM DMA register
-        ppu_write_register(addr, data);
-    } else if(addr >= 0x4020 && addr <= 0xFFFF){
-        // Cartridge space
-        // This is wrong; CPU currently contains entire addressable memory range (should only have 2KiB). For now write to it anyway:
-        nes.cpu->memory[addr] = data;
+        // PPU OAM DMA register. (Not via ppu_write_register(), which would mirror it onto 0x2004)
+        ppu_write_OAMDMA(data);
+
+    } else if(addr == 0x4016){
+        // Controller strobe, which goes to both ports. Either edge counts as a poll, so the buttons are never
+        // latched from a previous frame's sample.
+        system_poll_input();
+        controller_write(&nes.controllers[0], data, nes.buttons[0]);
+        controller_write(&nes.controllers[1], data, nes.buttons[1]);
+
+    } else if((addr >= 0x4000 && addr <= 0x4013) || addr == 0x4015 || addr == 0x4017){
+        // APU registers
+        apu_write_register(addr, data);
+
+    } else if(addr >= 0x6000 && addr <= 0x7FFF){
+        // Cartridge PRG RAM
+        if(nes.cart->prg_pages[0] != NULL && nes.cart->prg_ram_writable){
+            nes.cart->prg_pages[0][addr & (PRG_PAGE_SIZE - 1)] = data;
+        }
+
+    } else if(addr >= 0x4020){
+        // Cartridge space; PRG ROM can't be written, so these are all mapper registers
+        if(nes.cart->mapper->cpu_write){
+            nes.cart->mapper->cpu_write(nes.cart, addr, data);
+        }
 
     } else{
         // Invalid address
@@ -65,10 +208,56 @@ void write(uint16_t addr, uint8_t data){
 
 }
 
+const uint8_t* read_page(uint8_t page){
+    if(page < 0x20){
+        // Main memory, mirrored every 0x0800
+        return &nes.cpu->ram[(page << 8) & 0x07FF];
+    } else if(page >= 0x60){
+        // Cartridge RAM/ROM
+        uint8_t* prg_page = nes.cart->prg_pages[(page - 0x60) >> 5];
+        if(prg_page != NULL){
+            return &prg_page[(page << 8) & (PRG_PAGE_SIZE - 1)];
+        }
+    }
+
+    // PPU and APU/IO registers, the expansion area, or open bus
+    return NULL;
+}
+
 uint8_t ppu_read(uint16_t addr){
-    return nes.ppu->memory[addr];
+    addr &= 0x3FFF;
+
+    if(addr >= 0x3F00){
+        return nes.ppu->palette[ppu_palette_index(addr)];
+    }
+    if(addr < 0x2000 && nes.cart->mapper->ppu_read){
+        nes.cart->mapper->ppu_read(nes.cart, addr);
+    }
+    return nes.ppu->pages[addr >> 10][addr & 0x3FF];
 }
 
 void ppu_write(uint16_t addr, uint8_t data){
-    
+    addr &= 0x3FFF;
+
+    uint8_t* cell;
+    if(addr >= 0x3F00){
+        cell = &nes.ppu->palette[ppu_palette_index(addr)];
+    } else if(addr < 0x2000){
+        if(nes.cart->mapper->ppu_write){
+            nes.cart->mapper->ppu_write(nes.cart, addr, data);
+        }
+        if(!nes.cart->chr_ram){
+            // CHR ROM
+            return;
+        }
+        cell = &nes.ppu->pages[addr >> 10][addr & 0x3FF];
+    } else{
+        cell = &nes.ppu->pages[addr >> 10][addr & 0x3FF];
+    }
+
+    // Only real changes count as dirty; plenty of games rewrite the same data every frame
+    if(*cell != data){
+        *cell = data;
+        ppu_mark_dirty(nes.ppu, addr);
+    }
 }
\ No newline at end of file
@@ -3,24 +3,58 @@
 #include <stdint.h>
 #include "cpu.h"
 #include "ppu.h"
+#include "apu.h"
+#include "controller.h"
+#include "cartridge.h"
 
 // A system containing all necessary components (CPU, PPU, etc)
 typedef struct System{
     CPU* cpu;
     PPU* ppu;
+    APU* apu;
+    Cartridge* cart;
+
+    // CPU cycles since power on; the APU runs (lazily) up to this
+    uint64_t cycles;
+
+    // Host controller state for each port, as of the last poll
+    // (bit 0 A, 1 B, 2 Select, 3 Start, 4 Up, 5 Down, 6 Left, 7 Right)
+    uint8_t buttons[2];
+    Controller controllers[2];
+
+    // Brings buttons[] up to date. Called the first time each frame the game strobes or reads a controller rather
+    // than at the start of the frame, so input is as fresh as it can be when the game looks at it. May be NULL.
+    void (*poll_input)();
+    bool input_polled;  // this frame
 } System;
 
 // Informs compiler of global 'nes' variable; defined in main.c
 extern System nes;
 
-void system_init(CPU* cpu, PPU* ppu);
-void system_tick();
+void system_init(CPU* cpu, PPU* ppu, APU* apu, Cartridge* cart);
+
+// Execute a single CPU instruction, then catch the PPU up by 3 dots per CPU cycle (and the APU if it has an event
+// due). Returns the CPU cycles taken.
+int system_tick();
+
+// Run until the PPU has finished drawing a frame (i.e. it has entered vblank). The APU's samples for the frame are
+// left in nes.apu->audio.output.
+void system_run_frame();
+
+// system_run_frame() in pieces, for callers that step instruction by instruction: begin, then system_tick() until
+// nes.ppu->frame_complete, then end
+void system_begin_frame();
+void system_end_frame();
 uint8_t read(uint16_t addr);
 void write(uint16_t addr, uint8_t data);
 
+// Direct pointer to a 256 byte CPU page ($XX00-$XXFF), or NULL if reading it has side effects (I/O registers)
+const uint8_t* read_page(uint8_t page);
+
 uint8_t cpu_read(uint16_t addr);
 void cpu_write(uint16_t addr, uint8_t data);
 void NMI();
+void IRQ();
 
 uint8_t ppu_read(uint16_t addr);
 void ppu_write(uint16_t addr, uint8_t data);
\ No newline at end of file
@@ -0,0 +1,179 @@
+/*  ROM loading tests: NES 2.0 headers whose sizes don't fit the emulator's pages. PRG RAM and CHR RAM smaller than
+    a page must still be whole pages of memory (with only the header's size in the .sav), and ROM sizes the
+    exponent form can express but that can't be used or can't exist must be refused.
+
+    Built as the test-rom target and run by ctest:
+        cmake -S . -B build && cmake --build build && ctest --test-dir build
+    Usage:
+        test-rom {scratch_directory}
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "system.h"
+#include "cartridge.h"
+#include "rom.h"
+
+System nes;
+
+static int failures = 0;
+
+#define CHECK(condition) do{ \
+        if(!(condition)){ \
+            printf("FAILED: %s (line %d)\n", #condition, __LINE__); \
+            failures++; \
+        } \
+    } while(0)
+
+// A NES 2.0 header with the given PRG/CHR size bytes (LSB, then the MSB nibbles) and RAM shift counts
+static void test_header(uint8_t* header, uint16_t mapper, uint8_t submapper, bool battery, uint8_t prg_lsb,
+    uint8_t chr_lsb, uint8_t size_msb, uint8_t prg_ram, uint8_t chr_ram){
+    memset(header, 0, ROM_HEADER_SIZE);
+    memcpy(header, "NES\x1A", 4);
+    header[4] = prg_lsb;
+    header[5] = chr_lsb;
+    header[6] = (mapper & 0x0F) << 4 | (battery ? 0x02 : 0);
+    header[7] = (mapper & 0xF0) | 0x08;
+    header[8] = submapper << 4 | mapper >> 8;
+    header[9] = size_msb;
+    header[10] = prg_ram;
+    header[11] = chr_ram;
+}
+
+static void test_write_rom(const char* path, const uint8_t* header, uint32_t prg_size, uint32_t chr_size){
+    FILE* file = fopen(path, "wb");
+    if(file == NULL){
+        printf("Couldn't create '%s'\n", path);
+        exit(2);
+    }
+    fwrite(header, 1, ROM_HEADER_SIZE, file);
+    uint8_t* rom = calloc(1, prg_size + chr_size);
+    // Reset vector at $8000, with an endless JMP there
+    rom[0] = 0x4C;
+    rom[2] = 0x80;
+    rom[prg_size - 3] = 0x80;
+    fwrite(rom, 1, prg_size + chr_size, file);
+    free(rom);
+    fclose(file);
+}
+
+static long test_file_size(const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+static int test_load(const char* path, Cartridge* cart){
+    static CPU cpu;
+    static PPU ppu;
+    static APU apu;
+    cpu_init(&cpu);
+    ppu_init(&ppu);
+    apu_init(&apu);
+    memset(cart, 0, sizeof(*cart));
+    system_init(&cpu, &ppu, &apu, cart);
+    return load_rom((char*)path, cart);
+}
+
+// MMC6: mapper 4, submapper 1, with 1kB of battery-backed PRG RAM (64 << 4)
+static void test_small_prg_ram(const char* dir){
+    char rom_path[4096], save_path[4096];
+    snprintf(rom_path, sizeof(rom_path), "%s/mmc6.nes", dir);
+    snprintf(save_path, sizeof(save_path), "%s/mmc6.sav", dir);
+    remove(save_path);
+
+    uint8_t header[ROM_HEADER_SIZE];
+    test_header(header, 4, 1, true, 2, 1, 0x00, 0x40, 0x00);
+    test_write_rom(rom_path, header, 0x8000, 0x2000);
+
+    Cartridge cart;
+    CHECK(test_load(rom_path, &cart) == 0);
+    CHECK(cart.save_size == 0x400);
+    CHECK(cart.prg_ram_size == PRG_PAGE_SIZE);
+
+    // The whole page is usable, from the CPU and from OAM DMA
+    for(uint32_t addr = 0x6000; addr < 0x8000; addr++){
+        write(addr, addr * 7);
+    }
+    bool same = true;
+    for(uint32_t addr = 0x6000; addr < 0x8000; addr++){
+        same = same && read(addr) == (uint8_t)(addr * 7);
+    }
+    CHECK(same);
+    const uint8_t* page = read_page(0x7F);
+    CHECK(page != NULL && page[0xFF] == (uint8_t)(0x7FFF * 7));
+    cartridge_free(&cart);
+
+    // Only the header's 1kB is saved, and it comes back on the next load
+    CHECK(test_file_size(save_path) == 0x400);
+    CHECK(test_load(rom_path, &cart) == 0);
+    same = true;
+    for(uint32_t addr = 0x6000; addr < 0x6400; addr++){
+        same = same && read(addr) == (uint8_t)(addr * 7);
+    }
+    CHECK(same);
+    cartridge_free(&cart);
+}
+
+// 128 bytes of CHR RAM (64 << 1) on NROM
+static void test_small_chr_ram(const char* dir){
+    char rom_path[4096];
+    snprintf(rom_path, sizeof(rom_path), "%s/chr_ram.nes", dir);
+
+    uint8_t header[ROM_HEADER_SIZE];
+    test_header(header, 0, 0, false, 2, 0, 0x00, 0x00, 0x01);
+    test_write_rom(rom_path, header, 0x8000, 0);
+
+    Cartridge cart;
+    CHECK(test_load(rom_path, &cart) == 0);
+    CHECK(cart.chr_ram && cart.chr_size == CHR_PAGE_SIZE);
+    cartridge_free(&cart);
+}
+
+static void test_rom_sizes(){
+    uint8_t image[ROM_HEADER_SIZE + 0x8000 + 0x2000] = { 0 };
+    Rom_Header header;
+
+    // 32kB PRG, 8kB CHR in the plain form
+    test_header(image, 0, 0, false, 2, 1, 0x00, 0x00, 0x00);
+    CHECK(rom_parse_header(image, sizeof(image), &header) == 0);
+
+    // 2^63 bytes each of PRG and CHR (exponent form): the sum wraps around to nothing
+    test_header(image, 0, 0, false, 63 << 2, 63 << 2, 0xFF, 0x00, 0x00);
+    CHECK(rom_parse_header(image, sizeof(image), &header) != 0);
+
+    // 2^32 bytes of PRG: doesn't fit 32 bits
+    test_header(image, 0, 0, false, 32 << 2, 0, 0x0F, 0x00, 0x00);
+    CHECK(rom_parse_header(image, sizeof(image), &header) != 0);
+
+    // 2^12 * 3 = 12kB of PRG: not whole 8kB pages
+    test_header(image, 0, 0, false, 12 << 2 | 1, 0, 0x0F, 0x00, 0x00);
+    CHECK(rom_parse_header(image, sizeof(image), &header) != 0);
+
+    // 2^9 = 512 bytes of CHR ROM: not whole 1kB pages
+    test_header(image, 0, 0, false, 2, 9 << 2, 0xF0, 0x00, 0x00);
+    CHECK(rom_parse_header(image, sizeof(image), &header) != 0);
+
+    // 2^13 = 8kB of PRG in the exponent form is fine
+    test_header(image, 0, 0, false, 13 << 2, 1, 0x0F, 0x00, 0x00);
+    CHECK(rom_parse_header(image, sizeof(image), &header) == 0 && header.prg_rom_size == 0x2000);
+}
+
+int main(int argc, char** argv){
+    if(argc < 2){
+        printf("Usage: test-rom {scratch_directory}\n");
+        return 2;
+    }
+
+    test_rom_sizes();
+    test_small_prg_ram(argv[1]);
+    test_small_chr_ram(argv[1]);
+
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
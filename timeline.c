@@ -0,0 +1,196 @@
+#include "timeline.h"
+
+#ifdef UNICOM_TIMELINE
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+typedef struct Timeline_Event{
+    uint64_t ticks;
+    const char* name;
+    char phase;         // 'B'egin, 'E'nd or 'i'nstant, as in the trace format
+} Timeline_Event;
+
+typedef struct Timeline_Buffer{
+    const char* name;
+    Timeline_Event* events;
+    _Atomic uint32_t count;     // written by the owner only
+    uint32_t dropped;
+
+    // Zones open on this thread, and which of them were recorded (so their ends are too)
+    int depth;
+    uint64_t recorded;
+} Timeline_Buffer;
+
+static Timeline_Buffer buffers[TIMELINE_THREADS];
+static _Atomic int buffer_count = 0;
+static _Thread_local Timeline_Buffer* local = NULL;
+static _Thread_local bool unbuffered = false;    // more threads than buffers
+
+static atomic_bool recording = false;
+static const char* timeline_path = NULL;
+static uint64_t origin_ticks;
+static double origin_seconds;
+
+int timeline_start(const char* path){
+    timeline_path = path;
+    origin_ticks = stats_ticks();
+    origin_seconds = stats_seconds();
+    atomic_store(&recording, true);
+    return 0;
+}
+
+void timeline_set_recording(bool on){
+    if(timeline_path != NULL){
+        atomic_store(&recording, on);
+    }
+}
+
+bool timeline_recording(){
+    return atomic_load_explicit(&recording, memory_order_relaxed);
+}
+
+// The calling thread's buffer, claiming one on first use
+static Timeline_Buffer* timeline_buffer(){
+    if(local == NULL && !unbuffered){
+        int index = atomic_fetch_add(&buffer_count, 1);
+        if(index >= TIMELINE_THREADS){
+            unbuffered = true;
+            return NULL;
+        }
+        Timeline_Buffer* buffer = &buffers[index];
+        buffer->events = malloc(TIMELINE_EVENTS * sizeof(Timeline_Event));
+        if(buffer->events == NULL){
+            unbuffered = true;
+            return NULL;
+        }
+        local = buffer;
+    }
+    return local;
+}
+
+static void timeline_add(Timeline_Buffer* buffer, const char* name, char phase){
+    uint32_t count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+    buffer->events[count] = (Timeline_Event){ stats_ticks(), name, phase };
+    atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+void timeline_thread(const char* name){
+    Timeline_Buffer* buffer = timeline_recording() ? timeline_buffer() : local;
+    if(buffer != NULL){
+        buffer->name = name;
+    }
+}
+
+void timeline_begin(const char* name){
+    bool record = timeline_recording();
+    Timeline_Buffer* buffer = record ? timeline_buffer() : local;
+    if(buffer == NULL){
+        return;
+    }
+
+    // Room is kept for the ends of every zone that could be open
+    if(record && atomic_load_explicit(&buffer->count, memory_order_relaxed) >= TIMELINE_EVENTS - TIMELINE_DEPTH){
+        buffer->dropped++;
+        record = false;
+    }
+    if(buffer->depth < TIMELINE_DEPTH){
+        if(record){
+            buffer->recorded |= 1ull << buffer->depth;
+            timeline_add(buffer, name, 'B');
+        } else{
+            buffer->recorded &= ~(1ull << buffer->depth);
+        }
+    }
+    buffer->depth++;
+}
+
+void timeline_end(){
+    Timeline_Buffer* buffer = local;
+    if(buffer == NULL || buffer->depth == 0){
+        return;
+    }
+    buffer->depth--;
+    if(buffer->depth < TIMELINE_DEPTH && (buffer->recorded >> buffer->depth & 1)){
+        timeline_add(buffer, NULL, 'E');
+    }
+}
+
+void timeline_instant(const char* name){
+    if(!timeline_recording()){
+        return;
+    }
+    Timeline_Buffer* buffer = timeline_buffer();
+    if(buffer == NULL){
+        return;
+    }
+    if(atomic_load_explicit(&buffer->count, memory_order_relaxed) >= TIMELINE_EVENTS - TIMELINE_DEPTH){
+        buffer->dropped++;
+        return;
+    }
+    timeline_add(buffer, name, 'i');
+}
+
+void timeline_finish(){
+    if(timeline_path == NULL){
+        return;
+    }
+    atomic_store(&recording, false);
+
+    FILE* file = fopen(timeline_path, "w");
+    if(file == NULL){
+        printf("ERROR! Could not open timeline '%s'\n", timeline_path);
+    } else{
+        // Ticks to microseconds, calibrated over the whole run
+        double elapsed = stats_seconds() - origin_seconds;
+        uint64_t ticks = stats_ticks() - origin_ticks;
+        double us_per_tick = (ticks > 0) ? elapsed * 1e6 / ticks : 0;
+
+        int threads = atomic_load(&buffer_count);
+        if(threads > TIMELINE_THREADS){
+            threads = TIMELINE_THREADS;
+        }
+        uint64_t total = 0, dropped = 0;
+
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"unicom\"}}");
+        for(int t = 0; t < threads; t++){
+            Timeline_Buffer* buffer = &buffers[t];
+            uint32_t count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", t,
+                buffer->name ? buffer->name : "thread");
+
+            for(uint32_t i = 0; i < count; i++){
+                const Timeline_Event* event = &buffer->events[i];
+                double ts = (int64_t)(event->ticks - origin_ticks) * us_per_tick;
+                if(event->phase == 'E'){
+                    fprintf(file, ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", ts, t);
+                } else if(event->phase == 'i'){
+                    fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                        event->name, ts, t);
+                } else{
+                    fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", event->name,
+                        ts, t);
+                }
+            }
+            total += count;
+            dropped += buffer->dropped;
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+
+        printf("Timeline: %llu events from %d threads in '%s'%s\n", (unsigned long long)total, threads, timeline_path,
+            dropped ? " (buffers filled up; later events dropped)" : "");
+    }
+
+    for(int t = 0; t < TIMELINE_THREADS; t++){
+        free(buffers[t].events);
+        buffers[t].events = NULL;
+    }
+    timeline_path = NULL;
+}
+
+#endif
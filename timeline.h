@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*  Timeline of what every thread is doing, exported as Chrome trace events for Perfetto (ui.perfetto.dev) or
+    chrome://tracing. Made for seeing how the emulation, presentation and audio threads line up, and where
+    one stalls another.
+
+    Zones are marked with TIMELINE_BEGIN()/TIMELINE_END() pairs, which must nest within each thread, and
+    single moments with TIMELINE_INSTANT(). Names must be string literals (only the pointer is kept). Marked
+    so far: scanline batches of CPU/PPU steps, scanline rendering, OAM DMA, bank switches, the APU's frame
+    end, the audio callback, frame publish/acquire, texture upload, present and the emulation thread's sleep.
+
+    Only built with -DUNICOM_TIMELINE; otherwise every macro is empty and none of this is compiled in. When
+    built, recording is switched on and off at runtime (--timeline file, then F5 in the window), and costs
+    one atomic load per mark while off.
+
+    Each thread writes to a buffer of its own, registered on its first mark, so recording takes no locks:
+    the owner appends and publishes its count with a release store. Buffers hold TIMELINE_EVENTS marks and
+    simply stop when full. The file is written at exit, once every thread is done.
+*/
+
+#define TIMELINE_THREADS    16
+#define TIMELINE_EVENTS     (1 << 21)   // per thread, 24 bytes each (~35s of emulation at 60fps)
+#define TIMELINE_DEPTH      64          // nested zones tracked per thread
+
+#ifdef UNICOM_TIMELINE
+
+#define TIMELINE_THREAD(name)   timeline_thread(name)
+#define TIMELINE_BEGIN(name)    timeline_begin(name)
+#define TIMELINE_END()          timeline_end()
+#define TIMELINE_INSTANT(name)  timeline_instant(name)
+
+// Start recording into the given file (written by timeline_finish()). Returns 0 on success.
+int timeline_start(const char* path);
+
+// Switch recording on or off. Zones already open still get their ends.
+void timeline_set_recording(bool recording);
+bool timeline_recording();
+
+// Write the file and free the buffers. Every other thread must have stopped.
+void timeline_finish();
+
+// Name the calling thread in the trace
+void timeline_thread(const char* name);
+
+void timeline_begin(const char* name);
+void timeline_end();
+void timeline_instant(const char* name);
+
+#else
+
+#define TIMELINE_THREAD(name)   ((void)0)
+#define TIMELINE_BEGIN(name)    ((void)0)
+#define TIMELINE_END()          ((void)0)
+#define TIMELINE_INSTANT(name)  ((void)0)
+
+#endif
@@ -0,0 +1,97 @@
+#include "trace.h"
+#include "system.h"
+#include "digest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// A byte of the instruction stream. Code only runs from RAM or the cartridge, which read_page() covers.
+static uint8_t trace_peek(uint16_t addr){
+    const uint8_t* page = read_page(addr >> 8);
+    return page ? page[addr & 0xFF] : 0;
+}
+
+void trace_line(char* line, int size){
+    CPU* cpu = nes.cpu;
+    PPU* ppu = nes.ppu;
+
+    char instruction[32];
+    if(cpu->nmi){
+        snprintf(instruction, sizeof(instruction), "-- NMI --");
+    } else if(cpu->irq && !check_flag(cpu, FLAG_I)){
+        snprintf(instruction, sizeof(instruction), "-- IRQ --");
+    } else{
+        uint16_t pc = cpu->pc;
+        Op* op = get_op_data(trace_peek(pc));
+        uint8_t low = trace_peek(pc + 1);
+        uint16_t word = low | trace_peek(pc + 2) << 8;
+
+        char operand[16];
+        switch(op->mode){
+            case MODE_ABS: snprintf(operand, sizeof(operand), "$%.4X", word);                   break;
+            case MODE_ABX: snprintf(operand, sizeof(operand), "$%.4X,X", word);                 break;
+            case MODE_ABY: snprintf(operand, sizeof(operand), "$%.4X,Y", word);                 break;
+            case MODE_ACC: snprintf(operand, sizeof(operand), "A");                             break;
+            case MODE_IMM: snprintf(operand, sizeof(operand), "#$%.2X", low);                   break;
+            case MODE_IND: snprintf(operand, sizeof(operand), "($%.4X)", word);                 break;
+            case MODE_INX: snprintf(operand, sizeof(operand), "($%.2X,X)", low);                break;
+            case MODE_INY: snprintf(operand, sizeof(operand), "($%.2X),Y", low);                break;
+            case MODE_REL: snprintf(operand, sizeof(operand), "$%.4X", (uint16_t)(pc + 2 + (int8_t)low)); break;
+            case MODE_ZPG: snprintf(operand, sizeof(operand), "$%.2X", low);                    break;
+            case MODE_ZPX: snprintf(operand, sizeof(operand), "$%.2X,X", low);                  break;
+            case MODE_ZPY: snprintf(operand, sizeof(operand), "$%.2X,Y", low);                  break;
+            default:       operand[0] = '\0';                                                   break;
+        }
+        snprintf(instruction, sizeof(instruction), "%.4X %s %s", pc, op->label, operand);
+    }
+
+    snprintf(line, size, "%-20s A:%.2X X:%.2X Y:%.2X P:%.2X SP:%.2X CYC:%llu SL:%d DOT:%d", instruction, cpu->a,
+        cpu->x, cpu->y, cpu->p, cpu->s, (unsigned long long)nes.cycles, ppu->ppu_scanline, ppu->ppu_cycles);
+}
+
+static void put32(uint8_t* out, uint32_t value){
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+int trace_frame(const char* path){
+    FILE* file = fopen(path, "wb");
+    if(file == NULL){
+        printf("ERROR! Couldn't create trace '%s'.\n", path);
+        return 1;
+    }
+
+    // The count goes in at the end
+    uint8_t header[TRACE_HEADER_SIZE];
+    memcpy(header, TRACE_MAGIC, 4);
+    put32(&header[4], TRACE_VERSION);
+    put32(&header[8], nes.ppu->frame_count);
+    put32(&header[12], 0);
+    fwrite(header, 1, sizeof(header), file);
+
+    uint32_t count = 0;
+    system_begin_frame();
+    while(!nes.ppu->frame_complete){
+        uint8_t record[TRACE_RECORD_SIZE] = { 0 };
+        trace_line((char*)&record[8], TRACE_LINE_SIZE);
+
+        system_tick();
+
+        uint64_t hash = digest_state();
+        put32(&record[0], hash);
+        put32(&record[4], hash >> 32);
+        fwrite(record, 1, sizeof(record), file);
+        count++;
+    }
+    system_end_frame();
+
+    fwrite(ppu_finished_frame(nes.ppu), 1, FRAME_WIDTH * FRAME_HEIGHT, file);
+
+    put32(&header[12], count);
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+    fclose(file);
+    return 0;
+}
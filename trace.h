@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+/*  Instruction traces, for narrowing a divergence down within a frame (see bisect.h). One frame is run a CPU
+    instruction (or interrupt) at a time. For each one the trace holds a line describing it, with the registers
+    before it ran, and a digest_state() hash of the whole machine after it.
+
+    File layout (all integers little-endian):
+        Header      magic "UNCT", version (u32), frame number (u32), record count (u32)
+        Records     TRACE_RECORD_SIZE bytes each: state hash (u64), then the line (NUL-padded text)
+        Picture     the frame as drawn, FRAME_WIDTH * FRAME_HEIGHT colour indices
+*/
+
+#define TRACE_MAGIC         "UNCT"
+#define TRACE_VERSION       1
+#define TRACE_HEADER_SIZE   16
+#define TRACE_LINE_SIZE     88
+#define TRACE_RECORD_SIZE   (8 + TRACE_LINE_SIZE)
+
+// Describe the instruction the CPU is about to run (no side effects)
+void trace_line(char* line, int size);
+
+// Run the next frame with every instruction traced to a file. Returns 0 on success.
+int trace_frame(const char* path);
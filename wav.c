@@ -0,0 +1,81 @@
+#include "wav.h"
+
+#include <string.h>
+
+#define WAV_HEADER_SIZE 44
+
+static void put16(uint8_t* out, uint16_t value){
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void put32(uint8_t* out, uint32_t value){
+    put16(out, value);
+    put16(&out[2], value >> 16);
+}
+
+static void wav_header(uint8_t* header, int sample_rate, uint32_t samples){
+    uint32_t data_size = samples * 2;
+
+    memcpy(&header[0], "RIFF", 4);
+    put32(&header[4], 36 + data_size);
+    memcpy(&header[8], "WAVE", 4);
+
+    memcpy(&header[12], "fmt ", 4);
+    put32(&header[16], 16);             // format chunk size
+    put16(&header[20], 1);              // PCM
+    put16(&header[22], 1);              // mono
+    put32(&header[24], sample_rate);
+    put32(&header[28], sample_rate * 2);// bytes per second
+    put16(&header[32], 2);              // bytes per sample frame
+    put16(&header[34], 16);             // bits per sample
+
+    memcpy(&header[36], "data", 4);
+    put32(&header[40], data_size);
+}
+
+int wav_open(Wav* wav, const char* path, int sample_rate){
+    wav->sample_rate = sample_rate;
+    wav->samples = 0;
+    wav->file = fopen(path, "wb");
+    if(wav->file == NULL){
+        printf("ERROR! Couldn't create '%s'.\n", path);
+        return 1;
+    }
+
+    // Sizes are unknown until the end; the header is written again then
+    uint8_t header[WAV_HEADER_SIZE];
+    wav_header(header, sample_rate, 0);
+    fwrite(header, 1, sizeof(header), wav->file);
+    return 0;
+}
+
+void wav_write(Wav* wav, const int16_t* samples, int count){
+    // Little-endian whatever the host is
+    uint8_t data[2 * 1024];
+    while(count > 0){
+        int chunk = (count < 1024) ? count : 1024;
+        for(int i = 0; i < chunk; i++){
+            put16(&data[i * 2], samples[i]);
+        }
+        fwrite(data, 2, chunk, wav->file);
+
+        wav->samples += chunk;
+        samples += chunk;
+        count -= chunk;
+    }
+}
+
+void wav_close(Wav* wav){
+    if(wav->file == NULL){
+        return;
+    }
+
+    uint8_t header[WAV_HEADER_SIZE];
+    wav_header(header, wav->sample_rate, wav->samples);
+    fseek(wav->file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), wav->file);
+
+    fclose(wav->file);
+    wav->file = NULL;
+}
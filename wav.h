@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Mono 16-bit PCM .wav writer, for capturing the audio output. The header's sizes are filled in on close.
+typedef struct Wav{
+    FILE* file;
+    int sample_rate;
+    uint32_t samples;
+} Wav;
+
+// Returns 0 on success
+int wav_open(Wav* wav, const char* path, int sample_rate);
+void wav_write(Wav* wav, const int16_t* samples, int count);
+void wav_close(Wav* wav);